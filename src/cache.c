@@ -0,0 +1,597 @@
+/*
+
+  cache.c: Per-file result cache for incremental runs
+  Copyright (C) 2016 Gonzalo José Carracedo Carballal
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program.  If not, see
+  <http://www.gnu.org/licenses/>
+
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "cache.h"
+
+/********************************* Hashing ***********************************/
+
+#define CACHE_PRIME1 0x9e3779b185ebca87ull
+#define CACHE_PRIME2 0xc2b2ae3d27d4eb4full
+#define CACHE_PRIME3 0x165667b19e3779f9ull
+#define CACHE_PRIME4 0x85ebca77c2b2ae63ull
+#define CACHE_PRIME5 0x27d4eb2f165667c5ull
+
+static inline uint64_t
+cache_rotl(uint64_t x, unsigned int r)
+{
+  return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t
+cache_load64(const uint8_t *p)
+{
+  uint64_t w;
+
+  memcpy(&w, p, sizeof(uint64_t));
+
+  return w;
+}
+
+static inline uint64_t
+cache_round(uint64_t acc, uint64_t w)
+{
+  return cache_rotl(acc + w * CACHE_PRIME2, 31) * CACHE_PRIME1;
+}
+
+static inline uint64_t
+cache_merge(uint64_t h, uint64_t acc)
+{
+  return (h ^ cache_round(0, acc)) * CACHE_PRIME1 + CACHE_PRIME4;
+}
+
+/*
+ * Four independent lanes over 32-byte blocks, so that the multiplies of
+ * one block overlap, then the tail a word at a time (the xxHash64
+ * construction). Runs at memory speed on large captures.
+ */
+uint64_t
+cache_hash(const void *data, size_t len, uint64_t seed)
+{
+  const uint8_t *p = (const uint8_t *) data;
+  const uint8_t *end = p + len;
+  uint64_t v1, v2, v3, v4;
+  uint32_t half;
+  uint64_t h;
+
+  if (len >= 32) {
+    v1 = seed + CACHE_PRIME1 + CACHE_PRIME2;
+    v2 = seed + CACHE_PRIME2;
+    v3 = seed;
+    v4 = seed - CACHE_PRIME1;
+
+    do {
+      v1 = cache_round(v1, cache_load64(p));
+      v2 = cache_round(v2, cache_load64(p + 8));
+      v3 = cache_round(v3, cache_load64(p + 16));
+      v4 = cache_round(v4, cache_load64(p + 24));
+      p += 32;
+    } while (end - p >= 32);
+
+    h = cache_rotl(v1, 1) + cache_rotl(v2, 7)
+        + cache_rotl(v3, 12) + cache_rotl(v4, 18);
+    h = cache_merge(h, v1);
+    h = cache_merge(h, v2);
+    h = cache_merge(h, v3);
+    h = cache_merge(h, v4);
+  } else {
+    h = seed + CACHE_PRIME5;
+  }
+
+  h += len;
+
+  for (; end - p >= 8; p += 8)
+    h = cache_rotl(h ^ cache_round(0, cache_load64(p)), 27)
+        * CACHE_PRIME1 + CACHE_PRIME4;
+
+  if (end - p >= 4) {
+    memcpy(&half, p, sizeof(uint32_t));
+    h = cache_rotl(h ^ half * CACHE_PRIME1, 23) * CACHE_PRIME2 + CACHE_PRIME3;
+    p += 4;
+  }
+
+  for (; p < end; ++p)
+    h = cache_rotl(h ^ *p * CACHE_PRIME5, 11) * CACHE_PRIME1;
+
+  h ^= h >> 33;
+  h *= CACHE_PRIME2;
+  h ^= h >> 29;
+  h *= CACHE_PRIME3;
+  h ^= h >> 32;
+
+  return h;
+}
+
+BOOL
+cache_hash_file(
+    const char *path,
+    uint64_t limit,
+    uint64_t *size,
+    uint64_t *hash)
+{
+  struct stat sbuf;
+  void *map = MAP_FAILED;
+  size_t len = 0;
+  int fd = -1;
+  int saved_errno;
+
+  TRY((fd = open(path, O_RDONLY)) != -1);
+  TRY(fstat(fd, &sbuf) != -1);
+
+  *size = sbuf.st_size;
+  len = MIN(*size, limit);
+
+  if (len > 0) {
+    TRY((map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0)) != MAP_FAILED);
+    madvise(map, len, MADV_SEQUENTIAL);
+  }
+
+  *hash = cache_hash(len > 0 ? map : "", len, 0);
+
+  if (map != MAP_FAILED)
+    munmap(map, len);
+
+  close(fd);
+
+  return TRUE;
+
+fail:
+  saved_errno = errno;
+
+  if (fd != -1)
+    close(fd);
+
+  errno = saved_errno;
+
+  return FALSE;
+}
+
+/********************************* Records ***********************************/
+
+/* The same file reached through different paths has a single record */
+static char *
+cache_canonical_path(const char *path)
+{
+  char *canonical;
+
+  if ((canonical = realpath(path, NULL)) == NULL)
+    canonical = strdup(path);
+
+  return canonical;
+}
+
+void
+cache_record_destroy(struct cache_record *self)
+{
+  if (self->path != NULL)
+    free(self->path);
+
+  if (self->candidates != NULL)
+    free(self->candidates);
+
+  free(self);
+}
+
+struct cache_record *
+cache_record_new(const char *path, uint64_t size, uint64_t hash)
+{
+  struct cache_record *new = NULL;
+
+  ALLOCATE(new, struct cache_record);
+
+  TRY(new->path = cache_canonical_path(path));
+  new->size = size;
+  new->hash = hash;
+
+  return new;
+
+fail:
+  if (new != NULL)
+    cache_record_destroy(new);
+
+  return NULL;
+}
+
+BOOL
+cache_record_push(
+    struct cache_record *self,
+    const struct cache_candidate *candidate)
+{
+  struct cache_candidate *tmp;
+  unsigned int alloc;
+
+  if (self->candidate_count == self->candidate_alloc) {
+    alloc = self->candidate_alloc == 0 ? 16 : 2 * self->candidate_alloc;
+    TRY(tmp = realloc(
+        self->candidates,
+        alloc * sizeof(struct cache_candidate)));
+    self->candidates = tmp;
+    self->candidate_alloc = alloc;
+  }
+
+  self->candidates[self->candidate_count++] = *candidate;
+
+  return TRUE;
+
+fail:
+  return FALSE;
+}
+
+const struct cache_candidate *
+cache_record_find(
+    const struct cache_record *self,
+    uint64_t mask,
+    uint64_t phase,
+    unsigned int variant)
+{
+  unsigned int i;
+
+  for (i = 0; i < self->candidate_count; ++i)
+    if (self->candidates[i].mask == mask
+        && self->candidates[i].phase == phase
+        && self->candidates[i].variant == variant)
+      return self->candidates + i;
+
+  return NULL;
+}
+
+/* Short reads of a cache file mean it is corrupt */
+static BOOL
+cache_read(FILE *fp, void *buf, size_t size, size_t count)
+{
+  if (count == 0 || fread(buf, size, count, fp) == count)
+    return TRUE;
+
+  if (!ferror(fp))
+    errno = EINVAL;
+
+  return FALSE;
+}
+
+struct cache_record *
+cache_record_read(FILE *fp)
+{
+  struct cache_record *new = NULL;
+  struct cache_record_header header;
+
+  ALLOCATE(new, struct cache_record);
+
+  TRY(cache_read(fp, &header, sizeof(struct cache_record_header), 1));
+
+  if (header.path_len >= PATH_MAX) {
+    errno = EINVAL;
+    goto fail;
+  }
+
+  ALLOCATE_MANY(new->path, header.path_len + 1, char);
+  TRY(cache_read(fp, new->path, 1, header.path_len));
+
+  if (header.candidate_count > 0) {
+    ALLOCATE_MANY(
+        new->candidates,
+        header.candidate_count,
+        struct cache_candidate);
+    TRY(cache_read(
+        fp,
+        new->candidates,
+        sizeof(struct cache_candidate),
+        header.candidate_count));
+  }
+
+  new->size = header.size;
+  new->hash = header.hash;
+  new->bits = header.bits;
+  new->format = header.format;
+  new->candidate_count = header.candidate_count;
+  new->candidate_alloc = header.candidate_count;
+
+  return new;
+
+fail:
+  if (new != NULL)
+    cache_record_destroy(new);
+
+  return NULL;
+}
+
+BOOL
+cache_record_write(const struct cache_record *self, FILE *fp)
+{
+  struct cache_record_header header;
+
+  memset(&header, 0, sizeof(struct cache_record_header));
+
+  header.size = self->size;
+  header.hash = self->hash;
+  header.bits = self->bits;
+  header.format = self->format;
+  header.path_len = strlen(self->path);
+  header.candidate_count = self->candidate_count;
+
+  TRY(fwrite(&header, sizeof(struct cache_record_header), 1, fp) == 1);
+  TRY(fwrite(self->path, 1, header.path_len, fp) == header.path_len);
+  TRY(fwrite(
+      self->candidates,
+      sizeof(struct cache_candidate),
+      self->candidate_count,
+      fp) == self->candidate_count);
+
+  return TRUE;
+
+fail:
+  return FALSE;
+}
+
+/********************************** Cache ************************************/
+
+static inline size_t
+cache_content_slot(const cache_t *self, uint64_t size, uint64_t hash)
+{
+  return (hash ^ size * CACHE_PRIME1) & (self->index_size - 1);
+}
+
+static inline size_t
+cache_path_slot(const cache_t *self, const char *path)
+{
+  return cache_hash(path, strlen(path), 0) & (self->index_size - 1);
+}
+
+/*
+ * Built once, after loading. Of several records of a path, the first
+ * one wins and the others are dropped on the next save.
+ */
+static BOOL
+cache_build_index(cache_t *self)
+{
+  struct cache_record *record;
+  size_t slot;
+  unsigned int i;
+
+  self->index_size = CACHE_INDEX_MIN;
+  while (self->index_size < 2 * (size_t) self->record_count)
+    self->index_size <<= 1;
+
+  ALLOCATE_MANY(self->hash_index, self->index_size, struct cache_record *);
+  ALLOCATE_MANY(self->path_index, self->index_size, struct cache_record *);
+
+  for (i = 0; i < self->record_count; ++i) {
+    record = self->record_list[i];
+
+    slot = cache_content_slot(self, record->size, record->hash);
+    while (self->hash_index[slot] != NULL)
+      slot = (slot + 1) & (self->index_size - 1);
+    self->hash_index[slot] = record;
+
+    slot = cache_path_slot(self, record->path);
+    while (self->path_index[slot] != NULL
+        && strcmp(self->path_index[slot]->path, record->path) != 0)
+      slot = (slot + 1) & (self->index_size - 1);
+
+    if (self->path_index[slot] == NULL)
+      self->path_index[slot] = record;
+    else
+      record->superseded = TRUE;
+  }
+
+  return TRUE;
+
+fail:
+  return FALSE;
+}
+
+const struct cache_record *
+cache_lookup(const cache_t *self, uint64_t size, uint64_t hash)
+{
+  size_t slot = cache_content_slot(self, size, hash);
+
+  while (self->hash_index[slot] != NULL) {
+    if (self->hash_index[slot]->size == size
+        && self->hash_index[slot]->hash == hash)
+      return self->hash_index[slot];
+    slot = (slot + 1) & (self->index_size - 1);
+  }
+
+  return NULL;
+}
+
+static struct cache_record *
+cache_find_path(const cache_t *self, const char *canonical)
+{
+  size_t slot = cache_path_slot(self, canonical);
+
+  while (self->path_index[slot] != NULL) {
+    if (strcmp(self->path_index[slot]->path, canonical) == 0)
+      return self->path_index[slot];
+    slot = (slot + 1) & (self->index_size - 1);
+  }
+
+  return NULL;
+}
+
+const struct cache_record *
+cache_lookup_path(const cache_t *self, const char *path)
+{
+  struct cache_record *record = NULL;
+  char *canonical;
+
+  if ((canonical = cache_canonical_path(path)) != NULL) {
+    record = cache_find_path(self, canonical);
+    free(canonical);
+  }
+
+  return record;
+}
+
+BOOL
+cache_save(
+    cache_t *self,
+    const char *path,
+    struct cache_record *const *records,
+    unsigned int count)
+{
+  struct cache_header header;
+  struct cache_record *old;
+  char *tmp_path = NULL;
+  FILE *fp = NULL;
+  unsigned int i;
+  BOOL ok = FALSE;
+
+  memset(&header, 0, sizeof(struct cache_header));
+  memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+  header.version = CACHE_VERSION;
+  header.byte_order = CACHE_BYTE_ORDER;
+  header.config = self->config;
+
+  for (i = 0; i < count; ++i)
+    if (records[i] != NULL && records[i]->bits > 0) {
+      ++header.count;
+      if ((old = cache_find_path(self, records[i]->path)) != NULL)
+        old->superseded = TRUE;
+    }
+
+  for (i = 0; i < self->record_count; ++i)
+    if (!self->record_list[i]->superseded)
+      ++header.count;
+
+  /* Readers never see a half-written cache */
+  TRY(tmp_path = strbuild("%s.tmp", path));
+  TRY(fp = fopen(tmp_path, "wb"));
+
+  TRY(fwrite(&header, sizeof(struct cache_header), 1, fp) == 1);
+
+  for (i = 0; i < count; ++i)
+    if (records[i] != NULL && records[i]->bits > 0)
+      TRY(cache_record_write(records[i], fp));
+
+  for (i = 0; i < self->record_count; ++i)
+    if (!self->record_list[i]->superseded)
+      TRY(cache_record_write(self->record_list[i], fp));
+
+  TRY(fclose(fp) == 0);
+  fp = NULL;
+
+  TRY(rename(tmp_path, path) == 0);
+
+  ok = TRUE;
+
+fail:
+  if (fp != NULL)
+    fclose(fp);
+
+  if (!ok && tmp_path != NULL)
+    unlink(tmp_path);
+
+  if (tmp_path != NULL)
+    free(tmp_path);
+
+  return ok;
+}
+
+void
+cache_destroy(cache_t *self)
+{
+  unsigned int i;
+
+  for (i = 0; i < self->record_count; ++i)
+    if (self->record_list[i] != NULL)
+      cache_record_destroy(self->record_list[i]);
+
+  if (self->record_list != NULL)
+    free(self->record_list);
+
+  if (self->hash_index != NULL)
+    free(self->hash_index);
+
+  if (self->path_index != NULL)
+    free(self->path_index);
+
+  free(self);
+}
+
+cache_t *
+cache_new(const char *path, uint64_t config)
+{
+  cache_t *new = NULL;
+  struct cache_header header;
+  struct cache_record *record = NULL;
+  FILE *fp = NULL;
+  uint64_t i;
+  int saved_errno;
+
+  ALLOCATE(new, cache_t);
+
+  new->config = config;
+
+  if ((fp = fopen(path, "rb")) == NULL) {
+    TRY(errno == ENOENT);
+  } else {
+    TRY(cache_read(fp, &header, sizeof(struct cache_header), 1));
+
+    if (memcmp(header.magic, CACHE_MAGIC, sizeof(header.magic)) != 0
+        || header.version != CACHE_VERSION
+        || header.byte_order != CACHE_BYTE_ORDER) {
+      errno = EINVAL;
+      goto fail;
+    }
+
+    if (header.config != config)
+      new->discarded = header.count;
+    else
+      for (i = 0; i < header.count; ++i) {
+        TRY(record = cache_record_read(fp));
+        TRY(PTR_LIST_APPEND_CHECK(new->record, record) != -1);
+        record = NULL;
+      }
+
+    fclose(fp);
+    fp = NULL;
+  }
+
+  TRY(cache_build_index(new));
+
+  return new;
+
+fail:
+  saved_errno = errno;
+
+  if (record != NULL)
+    cache_record_destroy(record);
+
+  if (fp != NULL)
+    fclose(fp);
+
+  if (new != NULL)
+    cache_destroy(new);
+
+  errno = saved_errno;
+
+  return NULL;
+}
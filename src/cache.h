@@ -0,0 +1,171 @@
+/*
+
+  cache.h: Per-file result cache for incremental runs
+  Copyright (C) 2016 Gonzalo José Carracedo Carballal
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program.  If not, see
+  <http://www.gnu.org/licenses/>
+
+*/
+
+#ifndef _CACHE_H
+#define _CACHE_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "types.h"
+
+#define CACHE_MAGIC      "LFSRRES1"
+#define CACHE_VERSION    2
+#define CACHE_BYTE_ORDER 0x01020304
+
+#define CACHE_INDEX_MIN  64
+
+/*
+ * On-disk layout, in host byte order: this header, then `count' records.
+ * Each record is a cache_record_header, its path (`path_len' bytes, not
+ * terminated) and `candidate_count' cache_candidate entries.
+ *
+ * `config' identifies the settings the results were obtained with. A
+ * cache written under other settings is discarded as a whole.
+ */
+struct cache_header {
+  char     magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  uint64_t config;
+  uint64_t count;
+};
+
+struct cache_record_header {
+  uint64_t size; /* Bytes of the file the record describes */
+  uint64_t hash;
+  uint64_t bits; /* Parsed from them */
+  uint32_t format;
+  uint32_t path_len;
+  uint32_t candidate_count;
+  uint32_t reserved;
+};
+
+/* What one file said about one (polynomial, phase, variant) */
+struct cache_candidate {
+  uint64_t mask;        /* Feedback mask of the polynomial */
+  uint64_t phase;       /* From the first bit of the file */
+  uint64_t sync_hits;
+  uint64_t sync_period;
+  uint32_t variant;
+  uint32_t scored;      /* 1 if `quality' holds the score of the output */
+  uint32_t checked;
+  uint32_t synced;
+  float    quality;
+  float    score;       /* Correlation, as registered by the sweep */
+  uint32_t position;    /* In the sweep */
+  uint32_t reserved;
+};
+
+/*
+ * The result of one file: the candidates it produced, in the order they
+ * were found. Records are looked up by contents (size and hash) and by
+ * path, the latter to find the old record of a file that grew. Files
+ * that could not be analyzed have no bits, and are never cached.
+ */
+struct cache_record {
+  char *path; /* Canonical */
+  uint64_t size;
+  uint64_t hash;
+  uint64_t bits;
+  unsigned int format;
+  struct cache_candidate *candidates;
+  unsigned int candidate_count;
+  unsigned int candidate_alloc;
+  BOOL superseded; /* By a newer record of the same path */
+};
+
+struct cache {
+  uint64_t config;
+  unsigned int discarded; /* Records written under other settings */
+  PTR_LIST(struct cache_record, record);
+
+  /* Open addressing, at most half full */
+  struct cache_record **hash_index;
+  struct cache_record **path_index;
+  size_t index_size;
+};
+
+typedef struct cache cache_t;
+
+/* Fast 64-bit hash of a memory block */
+uint64_t cache_hash(const void *data, size_t len, uint64_t seed);
+
+/*
+ * Hash the first `limit' bytes of a file (all of them if it is shorter).
+ * `size' receives the size of the whole file. On failure, errno tells why.
+ */
+BOOL cache_hash_file(
+    const char *path,
+    uint64_t limit,
+    uint64_t *size,
+    uint64_t *hash);
+
+struct cache_record *cache_record_new(
+    const char *path,
+    uint64_t size,
+    uint64_t hash);
+
+BOOL cache_record_push(
+    struct cache_record *self,
+    const struct cache_candidate *candidate);
+
+const struct cache_candidate *cache_record_find(
+    const struct cache_record *self,
+    uint64_t mask,
+    uint64_t phase,
+    unsigned int variant);
+
+void cache_record_destroy(struct cache_record *self);
+
+/* Records in the layout of cache files, for other result files */
+struct cache_record *cache_record_read(FILE *fp);
+BOOL cache_record_write(const struct cache_record *self, FILE *fp);
+
+const struct cache_record *cache_lookup(
+    const cache_t *self,
+    uint64_t size,
+    uint64_t hash);
+
+const struct cache_record *cache_lookup_path(
+    const cache_t *self,
+    const char *path);
+
+/*
+ * Write `records' (empty ones are skipped), followed by the records
+ * already in the cache whose path is not among them. The file is
+ * replaced atomically.
+ */
+BOOL cache_save(
+    cache_t *self,
+    const char *path,
+    struct cache_record *const *records,
+    unsigned int count);
+
+void cache_destroy(cache_t *self);
+
+/*
+ * Load a cache file. A missing file yields an empty cache. On failure,
+ * errno tells why.
+ */
+cache_t *cache_new(const char *path, uint64_t config);
+
+#endif /* _CACHE_H */
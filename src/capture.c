@@ -0,0 +1,754 @@
+/*
+
+  capture.c: Capture file input layer
+  Copyright (C) 2016 Gonzalo José Carracedo Carballal
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program.  If not, see
+  <http://www.gnu.org/licenses/>
+
+*/
+
+#include "capture.h"
+
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#if defined(__AVX2__)
+#  include <immintrin.h>
+#  define CAPTURE_SIMD_WIDTH 32
+#elif defined(__SSE2__)
+#  include <emmintrin.h>
+#  define CAPTURE_SIMD_WIDTH 16
+#endif
+
+/* Append the `count' low bits of `value' (upper bits must be clear) */
+static inline void
+capture_append(uint64_t *words, uint64_t *pos, uint64_t value, unsigned int count)
+{
+  uint64_t *word = words + *pos / CAPTURE_WORD_BITS;
+  unsigned int shift = *pos % CAPTURE_WORD_BITS;
+
+  if (shift == 0) {
+    *word = value;
+  } else {
+    *word |= value << shift;
+    if (shift + count > CAPTURE_WORD_BITS)
+      word[1] = value >> (CAPTURE_WORD_BITS - shift);
+  }
+
+  *pos += count;
+}
+
+/* Byte bit-reversal table */
+#define R2(n) n, n + 2 * 64, n + 1 * 64, n + 3 * 64
+#define R4(n) R2(n), R2(n + 2 * 16), R2(n + 1 * 16), R2(n + 3 * 16)
+#define R6(n) R4(n), R4(n + 2 * 4), R4(n + 1 * 4), R4(n + 3 * 4)
+
+static const uint8_t capture_reverse[256] = { R6(0), R6(2), R6(1), R6(3) };
+
+#undef R2
+#undef R4
+#undef R6
+
+#ifdef CAPTURE_SIMD_WIDTH
+/* One bit per byte: whether it is a '1', and whether it is a bit at all */
+static inline void
+capture_classify(const char *text, uint32_t *ones, uint32_t *valid)
+{
+#  if CAPTURE_SIMD_WIDTH == 32
+  __m256i v = _mm256_loadu_si256((const __m256i *) text);
+  __m256i o = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('1'));
+  __m256i z = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('0'));
+
+  *ones  = _mm256_movemask_epi8(o);
+  *valid = _mm256_movemask_epi8(_mm256_or_si256(o, z));
+#  else
+  __m128i v = _mm_loadu_si128((const __m128i *) text);
+  __m128i o = _mm_cmpeq_epi8(v, _mm_set1_epi8('1'));
+  __m128i z = _mm_cmpeq_epi8(v, _mm_set1_epi8('0'));
+
+  *ones  = _mm_movemask_epi8(o);
+  *valid = _mm_movemask_epi8(_mm_or_si128(o, z));
+#  endif
+}
+#endif /* CAPTURE_SIMD_WIDTH */
+
+size_t
+capture_parse(const char *text, size_t len, uint64_t *words, uint64_t pos)
+{
+  uint64_t start = pos;
+  size_t i = 0;
+#ifdef CAPTURE_SIMD_WIDTH
+  const uint32_t full = (uint32_t) ((1ull << CAPTURE_SIMD_WIDTH) - 1);
+  uint32_t ones, valid;
+
+  for (; i + CAPTURE_SIMD_WIDTH <= len; i += CAPTURE_SIMD_WIDTH) {
+    capture_classify(text + i, &ones, &valid);
+
+    if (valid == full) {
+      /* Fast path: no whitespace in this chunk */
+      capture_append(words, &pos, ones, CAPTURE_SIMD_WIDTH);
+    } else if (valid != 0) {
+#  ifdef __BMI2__
+      capture_append(
+          words,
+          &pos,
+          _pext_u32(ones, valid),
+          __builtin_popcount(valid));
+#  else
+      while (valid != 0) {
+        capture_append(words, &pos, (ones >> __builtin_ctz(valid)) & 1, 1);
+        valid &= valid - 1;
+      }
+#  endif
+    }
+  }
+#endif /* CAPTURE_SIMD_WIDTH */
+
+  for (; i < len; ++i)
+    if (text[i] == '0' || text[i] == '1')
+      capture_append(words, &pos, text[i] - '0', 1);
+
+  return pos - start;
+}
+
+size_t
+capture_parse_packed(
+    const uint8_t *data,
+    size_t len,
+    BOOL msb_first,
+    uint64_t *words,
+    uint64_t pos)
+{
+  uint64_t byte = pos / 8;
+  size_t i;
+  uint8_t b;
+
+  for (i = 0; i < len; ++i, ++byte) {
+    b = msb_first ? capture_reverse[data[i]] : data[i];
+    if (byte % 8 == 0)
+      words[byte / 8] = b;
+    else
+      words[byte / 8] |= (uint64_t) b << (8 * (byte % 8));
+  }
+
+  return 8 * len;
+}
+
+enum capture_format
+capture_detect_format(const uint8_t *data, size_t len)
+{
+  size_t i;
+
+  if (len > CAPTURE_DETECT_LEN)
+    len = CAPTURE_DETECT_LEN;
+
+  for (i = 0; i < len; ++i)
+    if (data[i] != '0' && data[i] != '1' && !isspace(data[i]))
+      return CAPTURE_FORMAT_MSB;
+
+  return CAPTURE_FORMAT_ASCII;
+}
+
+BOOL
+capture_parse_format(const char *name, enum capture_format *format)
+{
+  if (strcmp(name, "auto") == 0)
+    *format = CAPTURE_FORMAT_AUTO;
+  else if (strcmp(name, "ascii") == 0)
+    *format = CAPTURE_FORMAT_ASCII;
+  else if (strcmp(name, "msb") == 0)
+    *format = CAPTURE_FORMAT_MSB;
+  else if (strcmp(name, "lsb") == 0)
+    *format = CAPTURE_FORMAT_LSB;
+  else
+    return FALSE;
+
+  return TRUE;
+}
+
+const char *
+capture_format_to_string(enum capture_format format)
+{
+  switch (format) {
+    case CAPTURE_FORMAT_AUTO:
+      return "auto";
+
+    case CAPTURE_FORMAT_ASCII:
+      return "ascii";
+
+    case CAPTURE_FORMAT_MSB:
+      return "msb";
+
+    case CAPTURE_FORMAT_LSB:
+      return "lsb";
+  }
+
+  return "unknown";
+}
+
+static const struct capture_variant_name {
+  const char *name;
+  unsigned int variant;
+} capture_variant_names[] = {
+  {"inverted", CAPTURE_VARIANT_INVERTED},
+  {"differential", CAPTURE_VARIANT_DIFFERENTIAL},
+  {"nrzi", CAPTURE_VARIANT_DIFFERENTIAL},
+  {"reversed", CAPTURE_VARIANT_REVERSED},
+  {"bitrev", CAPTURE_VARIANT_BITREV},
+  {"all", CAPTURE_VARIANT_ALL},
+  {"none", CAPTURE_VARIANT_NONE},
+  {NULL, 0}
+};
+
+BOOL
+capture_parse_variants(const char *list, unsigned int *variants)
+{
+  const char *end;
+  size_t len;
+  unsigned int i;
+
+  *variants = CAPTURE_VARIANT_NONE;
+
+  for (;;) {
+    end = strchr(list, ',');
+    len = end != NULL ? end - list : strlen(list);
+
+    for (i = 0; capture_variant_names[i].name != NULL; ++i)
+      if (strlen(capture_variant_names[i].name) == len
+          && strncmp(capture_variant_names[i].name, list, len) == 0)
+        break;
+
+    if (capture_variant_names[i].name == NULL)
+      return FALSE;
+
+    *variants |= capture_variant_names[i].variant;
+
+    if (end == NULL)
+      break;
+
+    list = end + 1;
+  }
+
+  return TRUE;
+}
+
+void
+capture_variant_to_string(unsigned int variant, char *buf, size_t size)
+{
+  unsigned int i, done = 0;
+  size_t len = 0;
+
+  if (variant == CAPTURE_VARIANT_NONE) {
+    snprintf(buf, size, "normal");
+    return;
+  }
+
+  *buf = '\0';
+
+  /* Aliases and groups are skipped: every flag is named once */
+  for (i = 0; capture_variant_names[i].name != NULL && len < size; ++i)
+    if (popcount64(capture_variant_names[i].variant) == 1
+        && (variant & capture_variant_names[i].variant)
+        && !(done & capture_variant_names[i].variant)) {
+      done |= capture_variant_names[i].variant;
+      len += snprintf(
+          buf + len,
+          size - len,
+          "%s%s",
+          len > 0 ? "+" : "",
+          capture_variant_names[i].name);
+    }
+}
+
+void
+capture_variant_bits(
+    unsigned int variant,
+    const uint8_t *in,
+    uint8_t *out,
+    size_t len)
+{
+  size_t i, j;
+  uint8_t tmp;
+
+  if (out != in)
+    memcpy(out, in, len);
+
+  if ((variant & CAPTURE_VARIANT_REVERSED) && len > 0)
+    for (i = 0, j = len - 1; i < j; ++i, --j) {
+      tmp = out[i];
+      out[i] = out[j];
+      out[j] = tmp;
+    }
+
+  if (variant & CAPTURE_VARIANT_BITREV)
+    for (i = 0; i + 8 <= len; i += 8)
+      for (j = 0; j < 4; ++j) {
+        tmp = out[i + j];
+        out[i + j] = out[i + 7 - j];
+        out[i + 7 - j] = tmp;
+      }
+
+  /* Backwards, so that every bit is XORed with the original previous one */
+  if (variant & CAPTURE_VARIANT_DIFFERENTIAL)
+    for (i = len; i-- > 1;)
+      out[i] ^= out[i - 1];
+
+  if (variant & CAPTURE_VARIANT_INVERTED)
+    for (i = 0; i < len; ++i)
+      out[i] ^= 1;
+}
+
+/* Reverse the bit order of every byte of a word */
+static inline uint64_t
+capture_reverse_bytes(uint64_t w)
+{
+  w = ((w >> 1) & 0x5555555555555555ull) | ((w & 0x5555555555555555ull) << 1);
+  w = ((w >> 2) & 0x3333333333333333ull) | ((w & 0x3333333333333333ull) << 2);
+
+  return ((w >> 4) & 0x0f0f0f0f0f0f0f0full) | ((w & 0x0f0f0f0f0f0f0f0full) << 4);
+}
+
+/* Reverse `len' bits in place: whole words first, then realign */
+static void
+capture_reverse_words(uint64_t *words, uint64_t len)
+{
+  size_t count = __UNITS(len, CAPTURE_WORD_BITS);
+  unsigned int shift = count * CAPTURE_WORD_BITS - len;
+  uint64_t tmp;
+  size_t i;
+
+  for (i = 0; i < count / 2; ++i) {
+    tmp = __builtin_bswap64(capture_reverse_bytes(words[i]));
+    words[i] = __builtin_bswap64(capture_reverse_bytes(words[count - 1 - i]));
+    words[count - 1 - i] = tmp;
+  }
+
+  if (count % 2 != 0)
+    words[count / 2] = __builtin_bswap64(capture_reverse_bytes(words[count / 2]));
+
+  /* Padding of the last word ended up at the bottom of the first one */
+  if (shift > 0)
+    for (i = 0; i < count; ++i)
+      words[i] = (words[i] >> shift)
+          | (i + 1 < count ? words[i + 1] << (CAPTURE_WORD_BITS - shift) : 0);
+}
+
+void
+capture_variant_words(
+    struct capture_variant_state *state,
+    const uint64_t *in,
+    uint64_t *out,
+    uint64_t len)
+{
+  size_t count = __UNITS(len, CAPTURE_WORD_BITS);
+  size_t bytes = len / 8;
+  uint64_t w = 0, mask;
+  size_t i;
+
+  if (out != in)
+    memcpy(out, in, count * sizeof(uint64_t));
+
+  if (count == 0)
+    return;
+
+  if (state->variant & CAPTURE_VARIANT_REVERSED)
+    capture_reverse_words(out, len);
+
+  if (state->variant & CAPTURE_VARIANT_BITREV) {
+    for (i = 0; i < bytes / CAPTURE_WORD_BYTES; ++i)
+      out[i] = capture_reverse_bytes(out[i]);
+
+    if (bytes % CAPTURE_WORD_BYTES != 0) {
+      mask = (1ull << (8 * (bytes % CAPTURE_WORD_BYTES))) - 1;
+      out[i] = (capture_reverse_bytes(out[i]) & mask) | (out[i] & ~mask);
+    }
+  }
+
+  if (state->variant & CAPTURE_VARIANT_DIFFERENTIAL) {
+    for (i = 0; i < count; ++i) {
+      w = out[i];
+      out[i] = w ^ ((w << 1) | state->last);
+      state->last = w >> (CAPTURE_WORD_BITS - 1);
+    }
+
+    if (len % CAPTURE_WORD_BITS != 0)
+      state->last = (w >> (len % CAPTURE_WORD_BITS - 1)) & 1;
+  }
+
+  if (state->variant & CAPTURE_VARIANT_INVERTED)
+    for (i = 0; i < count; ++i)
+      out[i] = ~out[i];
+}
+
+size_t
+capture_parse_as(
+    enum capture_format format,
+    const void *data,
+    size_t len,
+    uint64_t *words)
+{
+  if (format == CAPTURE_FORMAT_ASCII)
+    return capture_parse(data, len, words, 0);
+
+  return capture_parse_packed(
+      data,
+      len,
+      format == CAPTURE_FORMAT_MSB,
+      words,
+      0);
+}
+
+static BOOL
+capture_writer_put_bit(struct capture_writer *writer, unsigned int bit)
+{
+  if (writer->format == CAPTURE_FORMAT_ASCII)
+    return fputc('0' + bit, writer->fp) != EOF;
+
+  if (writer->format == CAPTURE_FORMAT_MSB)
+    writer->byte |= bit << (7 - writer->count);
+  else
+    writer->byte |= bit << writer->count;
+
+  if (++writer->count == 8) {
+    writer->count = 0;
+    if (fputc(writer->byte, writer->fp) == EOF)
+      return FALSE;
+    writer->byte = 0;
+  }
+
+  return TRUE;
+}
+
+BOOL
+capture_writer_put_bits(
+    struct capture_writer *writer,
+    const uint8_t *bits,
+    size_t len)
+{
+  size_t i;
+
+  for (i = 0; i < len; ++i)
+    if (!capture_writer_put_bit(writer, bits[i]))
+      return FALSE;
+
+  return TRUE;
+}
+
+BOOL
+capture_writer_put_words(
+    struct capture_writer *writer,
+    const uint64_t *words,
+    uint64_t len)
+{
+  uint8_t buf[CAPTURE_WRITE_SIZE];
+  uint64_t i = 0;
+  size_t p, k;
+
+  if (writer->format == CAPTURE_FORMAT_ASCII) {
+    while (i < len) {
+      p = MIN(len - i, sizeof(buf));
+      capture_unpack(words, i, p, buf);
+      for (k = 0; k < p; ++k)
+        buf[k] += '0';
+      if (fwrite(buf, 1, p, writer->fp) != p)
+        return FALSE;
+      i += p;
+    }
+
+    return TRUE;
+  }
+
+  /* Whole bytes go straight through when no partial byte is pending */
+  if (writer->count == 0) {
+    while (len - i >= 8) {
+      p = MIN((len - i) / 8, sizeof(buf));
+      for (k = 0; k < p; ++k) {
+        buf[k] = words[(i / 8 + k) / 8] >> (8 * ((i / 8 + k) % 8));
+        if (writer->format == CAPTURE_FORMAT_MSB)
+          buf[k] = capture_reverse[buf[k]];
+      }
+      if (fwrite(buf, 1, p, writer->fp) != p)
+        return FALSE;
+      i += 8 * p;
+    }
+  }
+
+  for (; i < len; ++i)
+    if (!capture_writer_put_bit(
+        writer,
+        (words[i / CAPTURE_WORD_BITS] >> (i % CAPTURE_WORD_BITS)) & 1))
+      return FALSE;
+
+  return TRUE;
+}
+
+BOOL
+capture_writer_flush(struct capture_writer *writer)
+{
+  if (writer->count > 0) {
+    writer->count = 0;
+    if (fputc(writer->byte, writer->fp) == EOF)
+      return FALSE;
+    writer->byte = 0;
+  }
+
+  return TRUE;
+}
+
+void
+capture_unpack(
+    const uint64_t *words,
+    uint64_t start,
+    size_t len,
+    uint8_t *out)
+{
+  uint64_t word;
+  size_t i = 0;
+  unsigned int k;
+
+  /* Leading bits up to a word boundary */
+  for (; i < len && (start + i) % CAPTURE_WORD_BITS != 0; ++i)
+    out[i] = (words[(start + i) / CAPTURE_WORD_BITS]
+        >> ((start + i) % CAPTURE_WORD_BITS)) & 1;
+
+  for (; i + CAPTURE_WORD_BITS <= len; i += CAPTURE_WORD_BITS) {
+    word = words[(start + i) / CAPTURE_WORD_BITS];
+    for (k = 0; k < CAPTURE_WORD_BITS; ++k)
+      out[i + k] = (word >> k) & 1;
+  }
+
+  for (; i < len; ++i)
+    out[i] = (words[(start + i) / CAPTURE_WORD_BITS]
+        >> ((start + i) % CAPTURE_WORD_BITS)) & 1;
+}
+
+const uint8_t *
+capture_get_bits(capture_t *self)
+{
+  if (self->bits == NULL) {
+    ALLOCATE_MANY(self->bits, self->N > 0 ? self->N : 1, uint8_t);
+    capture_unpack(self->words, 0, self->N, self->bits);
+  }
+
+  return self->bits;
+
+fail:
+  return NULL;
+}
+
+void
+capture_destroy(capture_t *self)
+{
+  if (self->words != NULL)
+    free(self->words);
+
+  if (self->bits != NULL)
+    free(self->bits);
+
+  free(self);
+}
+
+capture_t *
+capture_new(const char *path, enum capture_format format)
+{
+  capture_t *new = NULL;
+  struct stat sbuf;
+  const char *map = NULL;
+  int fd = -1;
+  int saved_errno;
+
+  ALLOCATE(new, capture_t);
+
+  TRY((fd = open(path, O_RDONLY)) != -1);
+  TRY(fstat(fd, &sbuf) != -1);
+
+  new->format = format == CAPTURE_FORMAT_AUTO
+      ? CAPTURE_FORMAT_ASCII
+      : format;
+
+  /* Up to 8 bits per byte, plus one spare word for capture_append */
+  ALLOCATE_MANY(
+      new->words,
+      __UNITS(sbuf.st_size, CAPTURE_WORD_BYTES) + 1,
+      uint64_t);
+
+  if (sbuf.st_size > 0) {
+    TRY((map = mmap(
+        NULL,
+        sbuf.st_size,
+        PROT_READ,
+        MAP_PRIVATE,
+        fd,
+        0)) != MAP_FAILED);
+
+    madvise((void *) map, sbuf.st_size, MADV_SEQUENTIAL);
+
+    if (format == CAPTURE_FORMAT_AUTO)
+      new->format = capture_detect_format((const uint8_t *) map, sbuf.st_size);
+
+    new->N = capture_parse_as(new->format, map, sbuf.st_size, new->words);
+
+    munmap((void *) map, sbuf.st_size);
+  }
+
+  close(fd);
+
+  return new;
+
+fail:
+  saved_errno = errno;
+
+  if (fd != -1)
+    close(fd);
+
+  if (new != NULL)
+    capture_destroy(new);
+
+  errno = saved_errno;
+
+  return NULL;
+}
+
+BOOL
+capture_walk_words(
+    const char *path,
+    enum capture_format format,
+    size_t window,
+    BOOL (*on_words) (const uint64_t *words, size_t len, void *private),
+    void *private)
+{
+  int fd = -1;
+  struct stat sbuf;
+  uint64_t pos = 0;
+  size_t page = sysconf(_SC_PAGESIZE);
+  size_t map_len, p;
+  const char *map = NULL;
+  uint8_t head[CAPTURE_DETECT_LEN];
+  uint64_t *words = NULL;
+  ssize_t got;
+  BOOL ok = FALSE;
+
+  if (window < CAPTURE_MIN_WINDOW)
+    window = CAPTURE_MIN_WINDOW;
+
+  TRY((fd = open(path, O_RDONLY)) != -1);
+  TRY(fstat(fd, &sbuf) != -1);
+
+  if (format == CAPTURE_FORMAT_AUTO) {
+    TRY((got = pread(fd, head, sizeof(head), 0)) != -1);
+    format = capture_detect_format(head, got);
+  }
+
+  /* Packed bytes expand to 8 bits: map less to deliver the same blocks */
+  if (format != CAPTURE_FORMAT_ASCII)
+    window /= 8;
+
+  window = __ALIGN(window, page);
+
+  ALLOCATE_MANY(words, __UNITS(window, CAPTURE_WORD_BYTES) + 1, uint64_t);
+
+  while (pos < (uint64_t) sbuf.st_size) {
+    map_len = MIN(window, (uint64_t) sbuf.st_size - pos);
+
+    TRY((map = mmap(
+        NULL,
+        map_len,
+        PROT_READ,
+        MAP_PRIVATE,
+        fd,
+        pos)) != MAP_FAILED);
+
+    madvise((void *) map, map_len, MADV_SEQUENTIAL);
+
+    p = capture_parse_as(format, map, map_len, words);
+
+    munmap((void *) map, map_len);
+    map = NULL;
+
+    if (p > 0)
+      TRY((on_words) (words, p, private));
+
+    pos += map_len;
+  }
+
+  ok = TRUE;
+
+fail:
+  if (map != NULL && map != MAP_FAILED)
+    munmap((void *) map, map_len);
+
+  if (words != NULL)
+    free(words);
+
+  if (fd != -1)
+    close(fd);
+
+  return ok;
+}
+
+struct capture_unpacker {
+  uint8_t *bits;
+  size_t alloc;
+  BOOL (*on_bits) (const uint8_t *bits, size_t len, void *private);
+  void *private;
+};
+
+static BOOL
+capture_unpack_words(const uint64_t *words, size_t len, void *private)
+{
+  struct capture_unpacker *unpacker = (struct capture_unpacker *) private;
+  uint8_t *bits;
+
+  /* Windows have similar sizes: this seldom grows past the first one */
+  if (len > unpacker->alloc) {
+    if ((bits = realloc(unpacker->bits, len)) == NULL)
+      return FALSE;
+
+    unpacker->bits = bits;
+    unpacker->alloc = len;
+  }
+
+  capture_unpack(words, 0, len, unpacker->bits);
+
+  return (unpacker->on_bits) (unpacker->bits, len, unpacker->private);
+}
+
+BOOL
+capture_walk(
+    const char *path,
+    enum capture_format format,
+    size_t window,
+    BOOL (*on_bits) (const uint8_t *bits, size_t len, void *private),
+    void *private)
+{
+  struct capture_unpacker unpacker = {NULL, 0, on_bits, private};
+  BOOL ok;
+
+  ok = capture_walk_words(
+      path,
+      format,
+      window,
+      capture_unpack_words,
+      &unpacker);
+
+  if (unpacker.bits != NULL)
+    free(unpacker.bits);
+
+  return ok;
+}
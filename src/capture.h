@@ -0,0 +1,204 @@
+/*
+
+  capture.h: Capture file input layer
+  Copyright (C) 2016 Gonzalo José Carracedo Carballal
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program.  If not, see
+  <http://www.gnu.org/licenses/>
+
+*/
+
+#ifndef _CAPTURE_H
+#define _CAPTURE_H
+
+#include <stdio.h>
+#include "types.h"
+
+#define CAPTURE_MIN_WINDOW (1 << 16)
+#define CAPTURE_WORD_BITS  64
+#define CAPTURE_WORD_BYTES (CAPTURE_WORD_BITS / 8)
+#define CAPTURE_DETECT_LEN 4096
+#define CAPTURE_WRITE_SIZE 65536
+
+/*
+ * On-disk representation of a bit stream: one ASCII character per bit,
+ * or raw bytes holding 8 bits each, most or least significant bit first.
+ * CAPTURE_FORMAT_AUTO is only meaningful for input.
+ */
+enum capture_format {
+  CAPTURE_FORMAT_AUTO,
+  CAPTURE_FORMAT_ASCII,
+  CAPTURE_FORMAT_MSB,
+  CAPTURE_FORMAT_LSB
+};
+
+/*
+ * Input variants: ways in which a capture may differ from the scrambled
+ * stream. Each flag names the transform that undoes it. Transforms are
+ * applied in this order: time reversal, bit order within bytes (whole
+ * bytes only), differential (NRZ-I) decoding and inversion.
+ */
+#define CAPTURE_VARIANT_NONE         0
+#define CAPTURE_VARIANT_INVERTED     (1 << 0)
+#define CAPTURE_VARIANT_DIFFERENTIAL (1 << 1) /* d[i] ^ d[i - 1] */
+#define CAPTURE_VARIANT_REVERSED     (1 << 2) /* Last bit first */
+#define CAPTURE_VARIANT_BITREV       (1 << 3)
+#define CAPTURE_VARIANT_ALL          0xf
+#define CAPTURE_VARIANT_STRLEN       64
+
+/* Differential decoding carries the last bit from one block to the next */
+struct capture_variant_state {
+  unsigned int variant;
+  uint64_t last;
+};
+
+#define capture_variant_state_INITIALIZER(variant) {variant, 0}
+
+/* Bits are accumulated until a whole byte can be written */
+struct capture_writer {
+  FILE *fp;
+  enum capture_format format;
+  uint8_t byte;
+  unsigned int count;
+};
+
+#define capture_writer_INITIALIZER(fp, format) {fp, format, 0, 0}
+
+/*
+ * A capture loaded in memory. Bits are packed in 64-bit words, bit i
+ * being bit (i % 64) of word (i / 64). A byte-per-bit view, as expected
+ * by the correlators, is built on demand and owned by the capture.
+ */
+struct capture {
+  enum capture_format format; /* As detected */
+  uint64_t *words;
+  uint64_t N;
+  uint8_t *bits;
+};
+
+typedef struct capture capture_t;
+
+static inline unsigned int
+capture_get_bit(const capture_t *self, uint64_t i)
+{
+  return (self->words[i / CAPTURE_WORD_BITS] >> (i % CAPTURE_WORD_BITS)) & 1;
+}
+
+/* Expand `len' packed bits starting at bit `start' to one byte per bit */
+void capture_unpack(
+    const uint64_t *words,
+    uint64_t start,
+    size_t len,
+    uint8_t *out);
+
+/*
+ * Parse `len' bytes of ASCII text, appending every '0' or '1' to the
+ * packed words starting at bit `pos'. Returns the number of bits parsed.
+ */
+size_t capture_parse(const char *text, size_t len, uint64_t *words, uint64_t pos);
+
+/* Append raw bytes to the packed words. `pos' must be a multiple of 8 */
+size_t capture_parse_packed(
+    const uint8_t *data,
+    size_t len,
+    BOOL msb_first,
+    uint64_t *words,
+    uint64_t pos);
+
+/* Parse a chunk in a known format (not AUTO) into words, from bit 0 */
+size_t capture_parse_as(
+    enum capture_format format,
+    const void *data,
+    size_t len,
+    uint64_t *words);
+
+/*
+ * Guess the format from the first bytes of a capture: text made only of
+ * '0', '1' and whitespace is ASCII, anything else is packed MSB first
+ * (bit order cannot be told apart from the data alone).
+ */
+enum capture_format capture_detect_format(const uint8_t *data, size_t len);
+
+BOOL capture_parse_format(const char *name, enum capture_format *format);
+
+const char *capture_format_to_string(enum capture_format format);
+
+/*
+ * Comma-separated variant names: inverted, differential (or nrzi),
+ * reversed and bitrev. "all" and "none" are accepted too.
+ */
+BOOL capture_parse_variants(const char *list, unsigned int *variants);
+
+/* "normal", or the names of the flags joined by '+' */
+void capture_variant_to_string(unsigned int variant, char *buf, size_t size);
+
+/* Apply a variant to `len' bits, one per byte. `out' may be `in' */
+void capture_variant_bits(
+    unsigned int variant,
+    const uint8_t *in,
+    uint8_t *out,
+    size_t len);
+
+/*
+ * Apply a variant to `len' packed bits. `out' may be `in'. Successive
+ * blocks of a stream may be fed in turn, except for time reversal, which
+ * needs the whole capture at once.
+ */
+void capture_variant_words(
+    struct capture_variant_state *state,
+    const uint64_t *in,
+    uint64_t *out,
+    uint64_t len);
+
+BOOL capture_writer_put_bits(
+    struct capture_writer *writer,
+    const uint8_t *bits,
+    size_t len);
+
+BOOL capture_writer_put_words(
+    struct capture_writer *writer,
+    const uint64_t *words,
+    uint64_t len);
+
+/* Pad the last byte with zeroes, if any */
+BOOL capture_writer_flush(struct capture_writer *writer);
+
+const uint8_t *capture_get_bits(capture_t *self);
+
+void capture_destroy(capture_t *self);
+
+/* Map and parse a whole capture. On failure, errno tells why */
+capture_t *capture_new(const char *path, enum capture_format format);
+
+/*
+ * Walk a capture file through a sliding memory map of at most `window'
+ * bytes. Bits are delivered in blocks, one byte (0 or 1) per bit, so
+ * memory usage is bounded regardless of the capture size.
+ */
+BOOL capture_walk(
+    const char *path,
+    enum capture_format format,
+    size_t window,
+    BOOL (*on_bits) (const uint8_t *bits, size_t len, void *private),
+    void *private);
+
+/* Same as capture_walk, delivering the bits of each window packed */
+BOOL capture_walk_words(
+    const char *path,
+    enum capture_format format,
+    size_t window,
+    BOOL (*on_words) (const uint64_t *words, size_t len, void *private),
+    void *private);
+
+#endif /* _CAPTURE_H */
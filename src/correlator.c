@@ -25,116 +25,180 @@
 #include "correlator.h"
 
 #include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
 #include <sys/stat.h>
 
-PTR_LIST_EXTERN(lfsrdesc_t, desc);
+static pthread_mutex_t correlator_planner_lock = PTHREAD_MUTEX_INITIALIZER;
+
+fftwf_plan
+correlator_plan_dft(
+    int n,
+    fftwf_complex *in,
+    fftwf_complex *out,
+    int sign,
+    unsigned int flags)
+{
+  fftwf_plan plan;
+
+  pthread_mutex_lock(&correlator_planner_lock);
+  plan = fftwf_plan_dft_1d(n, in, out, sign, flags);
+  pthread_mutex_unlock(&correlator_planner_lock);
+
+  return plan;
+}
+
+void
+correlator_plan_destroy(fftwf_plan plan)
+{
+  pthread_mutex_lock(&correlator_planner_lock);
+  fftwf_destroy_plan(plan);
+  pthread_mutex_unlock(&correlator_planner_lock);
+}
+
+static void
+correlator_stage_finalize(struct correlator_stage *stage)
+{
+  unsigned int i;
+
+  for (i = 0; i < CORRELATOR_MAX_VARIANTS; ++i)
+    if (stage->data_freq[i] != NULL)
+      fftwf_free(stage->data_freq[i]);
+
+  if (stage->prod != NULL && stage->prod != stage->seq_freq)
+    fftwf_free(stage->prod);
+
+  if (stage->seq_freq != NULL)
+    fftwf_free(stage->seq_freq);
+
+  if (stage->xcorr != NULL)
+    fftwf_free(stage->xcorr);
+
+  if (stage->fft_plan_inv != NULL)
+    correlator_plan_destroy(stage->fft_plan_inv);
+
+  if (stage->fft_plan != NULL)
+    correlator_plan_destroy(stage->fft_plan);
+}
 
 void
 correlator_destroy(correlator_t *self)
 {
   unsigned int i;
 
-  for (i = 0; i < self->candidate_count; ++i)
-    if (self->candidate_list[i] != NULL)
-      free(self->candidate_list[i]);
+  if (self->candidate_arena != NULL)
+    free(self->candidate_arena);
 
   if (self->candidate_list != NULL)
     free(self->candidate_list);
 
-  if (self->data != NULL)
-    free(self->data);
+  if (self->seq != NULL)
+    free(self->seq);
 
-  if (self->data_freq != NULL)
-    free(self->data_freq);
+  for (i = 0; i < self->stage_count; ++i)
+    correlator_stage_finalize(self->stage_list + i);
 
-  if (self->seq_freq != NULL)
-    free(self->seq_freq);
+  for (i = 1; i < self->variant_count; ++i)
+    free((void *) self->variant_data[i]);
 
-  if (self->xcorr != NULL)
-    free(self->xcorr);
+  for (i = 0; i < CORRELATOR_MAX_VARIANTS; ++i)
+    if (self->ntt_data[i] != NULL)
+      free(self->ntt_data[i]);
 
-  if (self->fft_plan_inv != NULL)
-    fftwf_destroy_plan(self->fft_plan_inv);
+  if (self->ntt_seq != NULL)
+    free(self->ntt_seq);
 
-  if (self->fft_plan != NULL)
-    fftwf_destroy_plan(self->fft_plan);
+  if (self->ntt_work != NULL)
+    free(self->ntt_work);
+
+  if (self->ntt != NULL)
+    ntt_destroy(self->ntt);
 
   free(self);
 }
 
-static void
-correlator_attempt_save(const char *path, const uint8_t *data, size_t N)
+/* Variant a candidate offset applies to, polarity aside */
+static unsigned int
+correlator_variant_index(const correlator_t *self, unsigned int variant)
 {
-  FILE *fp;
-
-  if ((fp = fopen(path, "w")) == NULL)
-    return;
+  unsigned int i;
 
-  while (N-- != 0)
-    fputc(*data++ + '0', fp);
+  for (i = 1; i < self->variant_count; ++i)
+    if (self->variant_list[i] == (variant & ~CAPTURE_VARIANT_INVERTED))
+      return i;
 
-  fclose(fp);
+  return 0;
 }
 
-static BOOL
-correlator_save_candidate(
-    const correlator_t *self,
-    const uint8_t *seq,
-    unsigned int offset,
-    const char *name)
+/*
+ * Descramble the capture with the `top' best candidates of the last run
+ * and queue the result for writing. Candidates are registered by
+ * increasing score, so the best ones are at the end of the list.
+ */
+BOOL
+correlator_dump(correlator_t *self, dumper_t *dumper, unsigned int top)
 {
+  const struct correlator_candidate *candidate;
+  char poly[LFSR_POLY_STRLEN];
+  char variant[CAPTURE_VARIANT_STRLEN];
   char *path = NULL;
-  FILE *fp = NULL;
-  unsigned int i = 0;
-  unsigned int hw = 0;
-  unsigned int max_seq = 0;
-  unsigned int curr_seq = 0;
-  unsigned int flip_count = 0;
-  uint8_t prev = 0;
-
-  uint8_t b;
-  BOOL ok = FALSE;
+  uint8_t *bits = NULL;
+  const uint8_t *data;
+  uint8_t invert;
+  unsigned int i, k;
+  uint64_t j;
 
   if (access("candidates/", F_OK) == -1)
-    TRY(mkdir("candidates", 0755) != -1);
-
-  TRY(
-      path = strbuild(
-          "candidates/unscrambled-off%d-%s.log", name));
+    TRY(mkdir("candidates", 0755) != -1 || errno == EEXIST);
+
+  for (k = 0; k < top && k < self->candidate_count; ++k) {
+    candidate = self->candidate_list[self->candidate_count - 1 - k];
+
+    lfsrdesc_format_poly(candidate->desc, poly, sizeof(poly));
+    lfsrdesc_generate_into(candidate->desc, self->seq, self->N);
+
+    data = self->variant_data[
+        correlator_variant_index(self, candidate->variant)];
+    invert = (candidate->variant & CAPTURE_VARIANT_INVERTED) != 0;
+
+    if (candidate->variant == CAPTURE_VARIANT_NONE) {
+      TRY(path = strbuild(
+          "candidates/unscrambled-off%" PRIu64 "-%s.log",
+          candidate->offset,
+          poly));
+    } else {
+      capture_variant_to_string(candidate->variant, variant, sizeof(variant));
+      TRY(path = strbuild(
+          "candidates/unscrambled-off%" PRIu64 "-%s-%s.log",
+          candidate->offset,
+          poly,
+          variant));
+    }
 
-  TRY(fp = fopen(path, "w"));
+    ALLOCATE_MANY(bits, self->N, uint8_t);
 
-  for (i = 0; i < self->N; ++i) {
-    b = (seq[(i + offset) % self->N] ^ self->data[i]);
-    if (i > 0) {
-      if (b == prev) {
-        if (++curr_seq > max_seq)
-          max_seq = curr_seq;
-      } else {
-        ++flip_count;
-        curr_seq = 0;
-      }
+    for (i = 0, j = candidate->offset % self->N; i < self->N; ++i) {
+      bits[i] = self->seq[j] ^ data[i] ^ invert;
+      if (++j == self->N)
+        j = 0;
     }
 
-    prev = b;
-    hw += b;
-    fputc('0' + b, fp);
+    dumper_push(dumper, path, bits, self->N);
+    path = NULL;
+    bits = NULL;
   }
 
-  _DEBUG("  Hamming weight:   %d\n", hw);
-  _DEBUG("  Longest sequence: %d\n", max_seq);
-  _DEBUG("  Bit flip count:   %d\n", flip_count);
-
-  ok = TRUE;
+  return TRUE;
 
 fail:
   if (path != NULL)
     free(path);
 
-  if (fp != NULL)
-    fclose(fp);
+  if (bits != NULL)
+    free(bits);
 
-  return ok;
+  return FALSE;
 }
 
 BOOL
@@ -152,101 +216,376 @@ correlator_walk_candidates(
   return TRUE;
 }
 
-BOOL
+/*
+ * A run registers at most one candidate per polynomial, so both the
+ * candidates and the list pointing to them are preallocated.
+ */
+static BOOL
 correlator_register_candidate(
     correlator_t *self,
-    lfsrdesc_t *desc,
-    unsigned int offset)
+    unsigned int position,
+    uint64_t offset,
+    unsigned int variant,
+    float score)
 {
-  struct correlator_candidate *candidate = NULL;
+  struct correlator_candidate *candidate;
+  lfsrdesc_t *desc = self->params.db->desc_list[position];
+  uint64_t cycle_len = lfsrdesc_get_cycle_len(desc);
+
+  if (self->candidate_count == self->candidate_alloc)
+    return FALSE;
 
-  ALLOCATE(candidate, struct correlator_candidate);
+  candidate = self->candidate_arena + self->candidate_count;
 
   candidate->desc = desc;
   candidate->offset = offset;
-  candidate->phase = offset % lfsrdesc_get_cycle_len(desc);
 
-  TRY(PTR_LIST_APPEND_CHECK(self->candidate, candidate) != -1);
+  /*
+   * Peaks past N / 2 are negative lags: the capture starts that many bits
+   * before the sequence, one cycle later. Unless N is a multiple of the
+   * cycle length, the index alone is not the phase.
+   */
+  if (offset < self->N / 2)
+    candidate->phase = offset % cycle_len;
+  else
+    candidate->phase = (cycle_len - (self->N - offset) % cycle_len) % cycle_len;
+  candidate->variant = variant;
+  candidate->position = position;
+  candidate->score = score;
+
+  self->candidate_list[self->candidate_count++] = candidate;
 
   return TRUE;
+}
 
-fail:
-  if (candidate != NULL)
-    free(candidate);
+static BOOL
+correlator_period_is_candidate(const correlator_t *self, uint64_t period)
+{
+  unsigned int i;
+
+  if (self->period_count == 0)
+    return TRUE;
+
+  /* Too long (or unknown) to show in the autocorrelation */
+  if (period == 0 || period > self->N / 2)
+    return TRUE;
+
+  for (i = 0; i < self->period_count; ++i)
+    if (self->period_list[i] == period)
+      return TRUE;
 
   return FALSE;
 }
 
-BOOL
-correlator_run(correlator_t *self)
+/*
+ * Exact circular cross-correlation with the NTT. With d' the time-reversed
+ * data and s' the sequence repeated twice, the linear convolution d' * s'
+ * at N - 1 + j is the number of lags i with d[i] = s[(i + j) mod N] = 1.
+ * A transform of size >= 2N keeps those indices free of aliasing.
+ *
+ * The transform of s' is computed once and multiplied by the data of
+ * every variant in turn.
+ */
+static void
+correlator_ntt_transform(correlator_t *self, const uint8_t *seq)
 {
-  unsigned int i, j;
-  unsigned int max_j;
-  float amp, max;
-  char *poly = NULL;
-  uint8_t *seq = NULL;
-  float K = 1.f / self->N;
-  BOOL ok = FALSE;
+  uint32_t *work = self->ntt_seq != NULL ? self->ntt_seq : self->ntt_work;
+  size_t i;
+  size_t size = ntt_get_size(self->ntt);
 
-  _DEBUG("Running against %d polynomials\n", desc_count);
+  for (i = 0; i < self->N; ++i)
+    work[i] = work[i + self->N] = seq[i];
 
-  self->best_score = 0;
+  for (i = 2 * self->N; i < size; ++i)
+    work[i] = 0;
 
-  /* Run correlator on each polynomial */
-  for (i = 0; i < desc_count; ++i) {
-    /* Get polynomial desc */
-    TRY(poly = lfsrdesc_get_poly(desc_list[i]));
+  ntt_forward(self->ntt, work);
+}
 
-    /* Generate float sequence */
-    TRY(seq = lfsrdesc_generate(desc_list[i], self->N));
+static void
+correlator_ntt_xcorr(correlator_t *self, unsigned int variant)
+{
+  if (self->ntt_seq != NULL)
+    memcpy(
+        self->ntt_work,
+        self->ntt_seq,
+        ntt_get_size(self->ntt) * sizeof(uint32_t));
+
+  ntt_multiply(self->ntt, self->ntt_work, self->ntt_data[variant]);
+  ntt_inverse(self->ntt, self->ntt_work);
+}
 
-    for (j = 0; j < self->N; ++j)
-      self->seq_freq[j] = 2 * K * (seq[j] - .5);
+/* Sum of data * seq as +/-1 at lag j, from the coincidence count */
+static inline int64_t
+correlator_ntt_lag(
+    const correlator_t *self,
+    unsigned int variant,
+    uint64_t seq_weight,
+    uint64_t j)
+{
+  int64_t ones = self->ntt_work[self->N - 1 + j];
+  int64_t disagree = self->data_weight[variant] + seq_weight - 2 * ones;
+
+  return (int64_t) self->N - 2 * disagree;
+}
+
+static float
+correlator_ntt_peak(
+    correlator_t *self,
+    unsigned int variant,
+    uint64_t weight,
+    uint64_t *max_j)
+{
+  uint64_t j;
+  int64_t lag, agree, max = 0;
+
+  correlator_ntt_xcorr(self, variant);
+
+  *max_j = 0;
+  for (j = 0; j < self->N; ++j) {
+    lag = correlator_ntt_lag(self, variant, weight, j);
+    agree = lag < 0 ? -lag : lag;
+
+    if (agree > max) {
+      max = agree;
+      *max_j = j;
+    }
+  }
 
-    fftwf_execute(self->fft_plan); /* Change to frequency */
+  /* Same units as the FFTW backend */
+  return ((float) max / self->N) * ((float) max / self->N);
+}
 
-    /* Multiply by data in frequency domain  */
+/*
+ * Additive scramblers leave the plaintext autocorrelation untouched at
+ * multiples of the keystream period. Compute the autocorrelation of the
+ * data once (reusing data_freq) and keep the cycle lengths of the database
+ * that stand out of the noise floor.
+ */
+static void
+correlator_detect_variant_periods(correlator_t *self, unsigned int variant)
+{
+  unsigned int i, j, m;
+  uint64_t period;
+  float acc, sigma;
+  struct correlator_stage *full = self->full;
+  const fftwf_complex *data_freq = full->data_freq[variant];
+  const lfsrdesc_db_t *db = self->params.db;
+  BOOL seen;
+
+  if (self->ntt != NULL) {
+    /* Autocorrelation is the cross-correlation of data with itself */
+    correlator_ntt_transform(self, self->variant_data[variant]);
+    correlator_ntt_xcorr(self, variant);
+  } else {
     for (j = 0; j < self->N; ++j)
-      self->seq_freq[j] *= conj(self->data_freq[j]);
-
-    /* Compute inverse FFT */
-    fftwf_execute(self->fft_plan_inv);
-
-    max = 0;
-    max_j = 0;
-    for (j = 0; j < self->N; ++j) {
-      amp = creal(self->xcorr[j] * conj(self->xcorr[j]));
-      if (amp > max) {
-        max = amp;
-        max_j = j;
+      full->prod[j] = data_freq[j] * conj(data_freq[j]);
+
+    /* xcorr[k] is now the normalized autocorrelation (xcorr[0] = 1) */
+    fftwf_execute(full->fft_plan_inv);
+  }
+
+  for (i = 0; i < db->desc_count; ++i) {
+    period = lfsrdesc_get_cycle_len(db->desc_list[i]);
+
+    /* We need at least two periods to see anything */
+    if (period == 0 || period > self->N / 2)
+      continue;
+
+    seen = FALSE;
+    for (j = 0; j < i && !seen; ++j)
+      seen = lfsrdesc_get_cycle_len(db->desc_list[j]) == period;
+
+    /* Already found in another variant */
+    for (j = 0; j < self->period_count && !seen; ++j)
+      seen = self->period_list[j] == period;
+
+    if (seen)
+      continue;
+
+    acc = 0;
+    for (m = 1;
+        m <= CORRELATOR_PERIOD_MULTIPLES && m * period <= self->N / 2;
+        ++m)
+      acc += self->ntt != NULL
+          ? (float) correlator_ntt_lag(
+              self,
+              variant,
+              self->data_weight[variant],
+              m * period) / self->N
+          : creal(full->xcorr[m * period]);
+
+    --m;
+
+    /* Noise floor of the mean of m lags is 1 / sqrt(N * m) */
+    sigma = fabsf(acc / m) * sqrtf((float) self->N * m);
+
+    if (sigma > self->period_sigma)
+      self->period_sigma = sigma;
+
+    if (sigma > CORRELATOR_PERIOD_SIGMA) {
+      if (self->period_count == CORRELATOR_MAX_PERIODS) {
+        self->periods_overflow = TRUE;
+        continue;
       }
+
+      _DEBUG(
+          "Period %" PRIu64 " stands out (%.1f sigma)\n",
+          period,
+          sigma);
+      self->period_list[self->period_count++] = period;
     }
+  }
+}
 
-    if (max > self->best_score) {
-      TRY(correlator_register_candidate(self, desc_list[i], max_j));
-      self->best_score = max;
+static void
+correlator_detect_periods(correlator_t *self)
+{
+  unsigned int i;
 
-      _DEBUG(
-          "Best score: %6.2f%% in %-5d (polynomial %s)\n",
-          100.f * max,
-          max_j,
-          poly);
+  self->period_count = 0;
+  self->period_sigma = 0;
+  self->periods_detected = TRUE;
+  self->periods_overflow = FALSE;
+
+  /* Time reversal leaves the autocorrelation untouched */
+  for (i = 0; i < self->variant_count; ++i)
+    if (self->variant_list[i] != CAPTURE_VARIANT_REVERSED)
+      correlator_detect_variant_periods(self, i);
+
+  if (self->periods_overflow) {
+    WARNING(
+        "More than %d periods stand out, sweeping all polynomials\n",
+        CORRELATOR_MAX_PERIODS);
+    self->period_count = 0;
+  } else if (self->period_count == 0)
+    _DEBUG("No period stands out, sweeping all polynomials\n");
+}
 
-      correlator_save_candidate(self, seq, max_j, poly);
-    }
+float
+correlator_get_period_sigma(correlator_t *self)
+{
+  if (!self->periods_detected)
+    correlator_detect_periods(self);
+
+  return self->period_sigma;
+}
 
-    free(poly);
-    poly = NULL;
+/* Transform a sequence, once for all the variants of a stage */
+static void
+correlator_stage_transform(struct correlator_stage *stage, const uint8_t *seq)
+{
+  unsigned int j;
+  float K = 1.f / stage->N;
 
-    free(seq);
-    seq = NULL;
+  for (j = 0; j < stage->N; ++j)
+    stage->seq_freq[j] = 2 * K * (seq[j] - .5);
+
+  fftwf_execute(stage->fft_plan); /* Change to frequency */
+}
+
+/*
+ * Spectrum of the keystream of the polynomial at `position' at the size
+ * of a stage, from the spectrum cache if it is there. Otherwise the
+ * keystream is generated (once for all stages, `generated' tells) and
+ * transformed, and the result offered to the cache.
+ */
+static const fftwf_complex *
+correlator_stage_spectrum(
+    correlator_t *self,
+    struct correlator_stage *stage,
+    unsigned int position,
+    BOOL *generated)
+{
+  const lfsrdesc_t *desc = self->params.db->desc_list[position];
+  const fftwf_complex *spectrum;
+
+  if (self->params.spectra != NULL
+      && (spectrum = spectrum_cache_lookup(
+          self->params.spectra,
+          desc->lfsr->mask,
+          stage->N)) != NULL)
+    return spectrum;
+
+  if (!*generated) {
+    lfsrdesc_generate_into(desc, self->seq, self->N);
+    *generated = TRUE;
+  }
+
+  correlator_stage_transform(stage, self->seq);
+
+  if (self->params.spectra != NULL)
+    spectrum_cache_insert(
+        self->params.spectra,
+        desc->lfsr->mask,
+        stage->N,
+        stage->seq_freq);
+
+  return stage->seq_freq;
+}
+
+BOOL
+correlator_prepare_spectra(const struct correlator_params *params)
+{
+  const lfsrdesc_db_t *db = params->db;
+  struct correlator_stage stage;
+  uint8_t *seq = NULL;
+  size_t len = 0;
+  unsigned int i, s;
+  BOOL ok = FALSE;
+
+  memset(&stage, 0, sizeof(struct correlator_stage));
+
+  if (params->spectra == NULL || params->stage_count == 0)
+    return TRUE;
+
+  for (s = 0; s < params->stage_count; ++s)
+    len = MAX(len, 2 * params->stage_len[s]);
+
+  ALLOCATE_MANY(seq, len, uint8_t);
+
+  /* As correlator_stage_init lays coarse stages out */
+  for (s = 0; s < params->stage_count; ++s) {
+    stage.N = 2 * params->stage_len[s];
+    stage.lags = params->stage_len[s] + 1;
+
+    ALLOCATE_FFT(stage.seq_freq, stage.N);
+    TRY(stage.fft_plan = correlator_plan_dft(
+        stage.N,
+        stage.seq_freq,
+        stage.seq_freq,
+        FFTW_FORWARD,
+        FFTW_ESTIMATE));
+
+    for (i = 0; i < db->desc_count; ++i) {
+      if (lfsrdesc_get_cycle_len(db->desc_list[i]) > stage.lags)
+        continue;
+
+      if (spectrum_cache_lookup(
+          params->spectra,
+          db->desc_list[i]->lfsr->mask,
+          stage.N) != NULL)
+        continue;
+
+      lfsrdesc_generate_into(db->desc_list[i], seq, stage.N);
+      correlator_stage_transform(&stage, seq);
+
+      if (!spectrum_cache_insert(
+          params->spectra,
+          db->desc_list[i]->lfsr->mask,
+          stage.N,
+          stage.seq_freq))
+        break;
+    }
+
+    correlator_stage_finalize(&stage);
+    memset(&stage, 0, sizeof(struct correlator_stage));
   }
 
   ok = TRUE;
 
 fail:
-  if (poly != NULL)
-    free(poly);
+  correlator_stage_finalize(&stage);
 
   if (seq != NULL)
     free(seq);
@@ -254,64 +593,264 @@ fail:
   return ok;
 }
 
-correlator_t *
-correlator_new(const uint8_t *data, size_t N)
+/*
+ * Correlate a keystream spectrum against a variant of the data. Returns
+ * peak power.
+ */
+static float
+correlator_stage_peak(
+    struct correlator_stage *stage,
+    const fftwf_complex *seq_freq,
+    unsigned int variant,
+    uint64_t *max_j)
 {
-  correlator_t *new = NULL;
-  fftwf_plan plan = NULL;
+  size_t j;
+  float amp, max = 0;
+  const fftwf_complex *data_freq = stage->data_freq[variant];
+
+  /* Multiply by data in frequency domain  */
+  for (j = 0; j < stage->N; ++j)
+    stage->prod[j] = seq_freq[j] * conj(data_freq[j]);
+
+  /* Compute inverse FFT */
+  fftwf_execute(stage->fft_plan_inv);
+
+  *max_j = 0;
+  for (j = 0; j < stage->lags; ++j) {
+    amp = creal(stage->xcorr[j] * conj(stage->xcorr[j]));
+    if (amp > max) {
+      max = amp;
+      *max_j = j;
+    }
+  }
+
+  return max;
+}
+
+BOOL
+correlator_run(correlator_t *self)
+{
+  unsigned int i, s, v, end;
+  uint64_t max_j, best_j = 0;
+  unsigned int best_v = 0;
+  unsigned int pruned = 0;
+  unsigned int variant;
+  uint64_t j, weight = 0;
+  float max, best;
+  char poly[LFSR_POLY_STRLEN];
+  char name[CAPTURE_VARIANT_STRLEN];
+  uint8_t *seq = self->seq;
+  const lfsrdesc_db_t *db = self->params.db;
+  const fftwf_complex *spectrum = NULL;
+  struct correlator_stage *stage;
+  BOOL generated;
   BOOL ok = FALSE;
-  float K;
-  unsigned int i;
 
-  ALLOCATE(new, correlator_t);
+  _DEBUG("Running against %d polynomials\n", db->desc_count);
 
-  ALLOCATE_MANY(new->data, N, uint8_t);
-  ALLOCATE_FFT(new->data_freq, N);
-  ALLOCATE_FFT(new->seq_freq, N);
-  ALLOCATE_FFT(new->xcorr, N);
+  self->best_score = 0;
+  self->candidate_count = 0;
 
-  memcpy(new->data, data, N * sizeof(uint8_t));
+  if (!self->params.period_filter)
+    self->period_count = 0;
+  else if (!self->periods_detected)
+    correlator_detect_periods(self);
 
-  new->N = N;
+  end = MIN(self->params.sweep_to, db->desc_count);
 
-  correlator_attempt_save("input.log", data, N);
+  /* Run correlator on each polynomial */
+  for (i = self->params.sweep_from; i < end; ++i) {
+    if (!correlator_period_is_candidate(
+        self,
+        lfsrdesc_get_cycle_len(db->desc_list[i])))
+      continue;
 
-  /*
-   * Compute some FFTs
-   */
+    generated = FALSE;
 
-  K = 1. / N;
-  for (i = 0; i < N; ++i)
-    new->data_freq[i] = 2 * K * (data[i] - .5);
+    /* Coarse stages: discard polynomials that stay in the noise floor */
+    for (s = 0; s < self->stage_count - 1; ++s) {
+      stage = self->stage_list + s;
 
-  _DEBUG("Computing FFT of data (%d bins)\n", N);
+      /* Its phase may lie past the lags of this stage */
+      if (lfsrdesc_get_cycle_len(db->desc_list[i]) > stage->lags)
+        continue;
 
-  TRY(plan = fftwf_plan_dft_1d(
-      new->N,
-      new->data_freq,
-      new->data_freq,
-      FFTW_FORWARD,
-      FFTW_ESTIMATE));
+      spectrum = correlator_stage_spectrum(self, stage, i, &generated);
 
-  _DEBUG("Computing...\n");
+      /* Survive if any variant stands out */
+      for (v = 0; v < self->variant_count; ++v) {
+        max = correlator_stage_peak(stage, spectrum, v, &max_j);
+        if (sqrtf(max * stage->len) >= stage->sigma)
+          break;
+      }
 
-  fftwf_execute(plan); /* In xcorr_freq: FFT of data */
-  fftwf_destroy_plan(plan);
-  plan = NULL;
+      if (v == self->variant_count)
+        break;
+    }
+
+    if (s < self->stage_count - 1) {
+      ++pruned;
+    } else {
+      if (self->ntt != NULL) {
+        if (!generated)
+          lfsrdesc_generate_into(db->desc_list[i], seq, self->N);
+
+        for (j = 0, weight = 0; j < self->N; ++j)
+          weight += seq[j];
+
+        correlator_ntt_transform(self, seq);
+      } else {
+        spectrum = correlator_stage_spectrum(self, self->full, i, &generated);
+      }
+
+      for (v = 0, best = 0; v < self->variant_count; ++v) {
+        if (self->ntt != NULL)
+          max = correlator_ntt_peak(self, v, weight, &max_j);
+        else
+          max = correlator_stage_peak(self->full, spectrum, v, &max_j);
+
+        if (v == 0 || max > best) {
+          best = max;
+          best_j = max_j;
+          best_v = v;
+        }
+      }
+
+      max = best;
+
+      if (max > self->best_score) {
+        variant = self->variant_list[best_v];
+
+        TRY(correlator_register_candidate(self, i, best_j, variant, max));
+        self->best_score = max;
+
+        /* Only format the polynomial when we actually need it */
+        lfsrdesc_format_poly(db->desc_list[i], poly, sizeof(poly));
+
+        if (self->params.variants != CAPTURE_VARIANT_NONE) {
+          capture_variant_to_string(variant, name, sizeof(name));
+          _DEBUG(
+              "Best score: %6.2f%% in %-5" PRIu64 " (polynomial %s, %s)\n",
+              100.f * max,
+              best_j,
+              poly,
+              name);
+        } else {
+          _DEBUG(
+              "Best score: %6.2f%% in %-5" PRIu64 " (polynomial %s)\n",
+              100.f * max,
+              best_j,
+              poly);
+        }
+
+        /* Peak far above the 1/sqrt(N) floor: no need to look further */
+        if (self->params.exit_sigma > 0
+            && sqrtf(max * self->N) >= self->params.exit_sigma) {
+          _DEBUG(
+              "Peak at %.1f sigma, stopping after %d polynomials\n",
+              sqrtf(max * self->N),
+              i + 1);
+          break;
+        }
+      }
+    }
+  }
 
-  _DEBUG("Done\n");
+  if (pruned > 0)
+    _DEBUG("%d polynomials pruned in coarse stages\n", pruned);
+
+  ok = TRUE;
+
+fail:
+  return ok;
+}
+
+/*
+ * The data prefix of every variant is transformed once, zero-padded to
+ * twice its length in coarse stages. The reversed capture needs no
+ * transform of its own at full length: it is the original one conjugated
+ * and advanced one bit.
+ */
+static BOOL
+correlator_stage_init(
+    correlator_t *self,
+    struct correlator_stage *stage,
+    size_t len,
+    float sigma)
+{
+  fftwf_plan plan = NULL;
+  const uint8_t *data;
+  size_t N;
+  float K;
+  unsigned int i, v;
+  BOOL ok = FALSE;
+
+  /* Full stage: circular, over the whole capture */
+  if (len == self->N) {
+    N = stage->N = stage->lags = len;
+  } else {
+    N = stage->N = 2 * len;
+    stage->lags = len + 1;
+  }
 
-  TRY(new->fft_plan = fftwf_plan_dft_1d(
-      new->N,
-      new->seq_freq,
-      new->seq_freq,
+  stage->len = len;
+  stage->sigma = sigma;
+
+  ALLOCATE_FFT(stage->seq_freq, N);
+  ALLOCATE_FFT(stage->xcorr, N);
+
+  /* With a single variant, the product overwrites the sequence */
+  if (self->variant_count > 1) {
+    ALLOCATE_FFT(stage->prod, N);
+  } else {
+    stage->prod = stage->seq_freq;
+  }
+
+  /* Scaled so that the peak is the fraction of agreeing bits */
+  K = 1. / len;
+  for (v = 0; v < self->variant_count; ++v) {
+    ALLOCATE_FFT(stage->data_freq[v], N);
+
+    if (v > 0
+        && self->variant_list[v] == CAPTURE_VARIANT_REVERSED
+        && N == self->N) {
+      for (i = 0; i < N; ++i)
+        stage->data_freq[v][i] = conj(stage->data_freq[0][i])
+            * cexp(I * (2 * M_PI * i / N));
+      continue;
+    }
+
+    data = self->variant_data[v];
+    for (i = 0; i < len; ++i)
+      stage->data_freq[v][i] = 2 * K * (data[i] - .5);
+    for (; i < N; ++i)
+      stage->data_freq[v][i] = 0;
+
+    _DEBUG("Computing FFT of data (%zu bins)\n", N);
+
+    TRY(plan = correlator_plan_dft(
+        N,
+        stage->data_freq[v],
+        stage->data_freq[v],
+        FFTW_FORWARD,
+        FFTW_ESTIMATE));
+
+    fftwf_execute(plan); /* In data_freq: FFT of data */
+    correlator_plan_destroy(plan);
+    plan = NULL;
+  }
+
+  TRY(stage->fft_plan = correlator_plan_dft(
+      N,
+      stage->seq_freq,
+      stage->seq_freq,
       FFTW_FORWARD,
       FFTW_ESTIMATE));
 
-  TRY(new->fft_plan_inv = fftwf_plan_dft_1d(
-      new->N,
-      new->seq_freq,
-      new->xcorr,
+  TRY(stage->fft_plan_inv = correlator_plan_dft(
+      N,
+      stage->prod,
+      stage->xcorr,
       FFTW_BACKWARD,
       FFTW_ESTIMATE));
 
@@ -319,8 +858,129 @@ correlator_new(const uint8_t *data, size_t N)
 
 fail:
   if (plan != NULL)
-    fftwf_destroy_plan(plan);
+    correlator_plan_destroy(plan);
+
+  return ok;
+}
+
+static BOOL
+correlator_ntt_init(correlator_t *self)
+{
+  size_t i, size;
+  unsigned int v;
+  const uint8_t *data;
+
+  CONSTRUCT(self->ntt, ntt, 2 * self->N);
+
+  size = ntt_get_size(self->ntt);
+
+  ALLOCATE_MANY(self->ntt_work, size, uint32_t);
+
+  if (self->variant_count > 1)
+    ALLOCATE_MANY(self->ntt_seq, size, uint32_t);
+
+  for (v = 0; v < self->variant_count; ++v) {
+    ALLOCATE_MANY(self->ntt_data[v], size, uint32_t);
+
+    data = self->variant_data[v];
+    for (i = 0; i < self->N; ++i) {
+      self->ntt_data[v][i] = data[self->N - 1 - i];
+      self->data_weight[v] += data[i];
+    }
 
+    _DEBUG("Computing NTT of data (%zu bins)\n", size);
+
+    ntt_forward(self->ntt, self->ntt_data[v]);
+  }
+
+  return TRUE;
+
+fail:
+  return FALSE;
+}
+
+correlator_t *
+correlator_new(
+    const struct correlator_params *params,
+    const uint8_t *data,
+    size_t N)
+{
+  static const unsigned int transforms[] = {
+    CAPTURE_VARIANT_DIFFERENTIAL,
+    CAPTURE_VARIANT_REVERSED,
+    CAPTURE_VARIANT_BITREV
+  };
+  correlator_t *new = NULL;
+  struct correlator_params defaults = correlator_params_INITIALIZER;
+  const lfsrdesc_db_t *db;
+  uint8_t *bits;
+  size_t last = 0;
+  BOOL ok = FALSE;
+  unsigned int i;
+
+  if (params == NULL)
+    params = &defaults;
+
+  ALLOCATE(new, correlator_t);
+
+  new->params = *params;
+
+  /* Every search runs against a database */
+  TRY(db = params->db);
+
+  /* Workspace: keystream buffer and candidate arena */
+  ALLOCATE_MANY(new->seq, N, uint8_t);
+
+  if (db->desc_count > 0) {
+    new->candidate_alloc = db->desc_count;
+    ALLOCATE_MANY(new->candidate_arena, db->desc_count, struct correlator_candidate);
+    ALLOCATE_MANY(new->candidate_list, db->desc_count, struct correlator_candidate *);
+  }
+
+  new->data = data;
+  new->N = N;
+
+  new->variant_list[0] = CAPTURE_VARIANT_NONE;
+  new->variant_data[0] = data;
+  new->variant_count = 1;
+
+  for (i = 0; i < sizeof(transforms) / sizeof(transforms[0]); ++i)
+    if (params->variants & transforms[i]) {
+      ALLOCATE_MANY(bits, N, uint8_t);
+      new->variant_list[new->variant_count] = transforms[i];
+      new->variant_data[new->variant_count++] = bits;
+      capture_variant_bits(transforms[i], data, bits, N);
+    }
+
+  /* Coarse stages only make sense for strictly increasing prefixes */
+  for (i = 0; i < params->stage_count && i < CORRELATOR_MAX_STAGES; ++i) {
+    if (params->stage_len[i] <= last || params->stage_len[i] >= N / 2)
+      continue;
+
+    last = params->stage_len[i];
+
+    TRY(correlator_stage_init(
+        new,
+        new->stage_list + new->stage_count++,
+        last,
+        params->stage_sigma[i]));
+  }
+
+  new->full = new->stage_list + new->stage_count;
+
+  /* With the NTT backend, the full-length stage keeps no FFTW buffers */
+  if (params->backend == CORRELATOR_BACKEND_NTT) {
+    new->full->N = new->full->len = new->full->lags = N;
+    TRY(correlator_ntt_init(new));
+  } else {
+    TRY(correlator_stage_init(new, new->full, N, 0));
+  }
+
+  ++new->stage_count;
+
+  ok = TRUE;
+
+fail:
   if (!ok && new != NULL) {
     correlator_destroy(new);
     new = NULL;
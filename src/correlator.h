@@ -23,33 +23,176 @@
 #define _CORRELATOR_H
 
 #include "lfsrdesc.h"
+#include "ntt.h"
+#include "dumper.h"
+#include "capture.h"
+#include "spectrum.h"
 
 #include <fftw3.h>
+#include <limits.h>
 
+/*
+ * Period prefilter: a candidate period L is accepted if the mean of the
+ * data autocorrelation over its first CORRELATOR_PERIOD_MULTIPLES multiples
+ * stands CORRELATOR_PERIOD_SIGMA standard deviations above the noise floor.
+ */
+#define CORRELATOR_PERIOD_MULTIPLES 8
+#define CORRELATOR_PERIOD_SIGMA     6.f
+
+/*
+ * Periods kept by the prefilter. Should more stand out, the filter is not
+ * trusted and every polynomial is swept. Polynomials whose period is not
+ * observable (not twice within the capture) are always swept.
+ */
+#define CORRELATOR_MAX_PERIODS      256
+
+/*
+ * Coarse-to-fine search: polynomials are first correlated against short
+ * prefixes of the capture. Only those whose peak exceeds the stage
+ * threshold (in standard deviations over the 1/sqrt(len) noise floor)
+ * make it to the next stage and, eventually, to the full-length one.
+ *
+ * A prefix of `len' bits is correlated linearly against the first 2 len
+ * bits of the keystream, which covers the lags 0 to len exactly. Phases
+ * of polynomials with a cycle longer than len + 1 may lie past those
+ * lags: such polynomials are never pruned by that stage.
+ */
+#define CORRELATOR_MAX_STAGES 4
+
+/*
+ * Input variants (see capture.h) are evaluated in the same sweep: the
+ * capture as is plus one per differential, reversed and bit order
+ * transform, sharing the keystream transform of every polynomial.
+ *
+ * Inversion cannot be told here: the sign of the peak is the polarity
+ * of the plaintext, and a mostly-ones plaintext looks just like an
+ * inverted capture of a mostly-zeros one. Candidates never carry
+ * CAPTURE_VARIANT_INVERTED; polarity is decided on the descrambled
+ * output, by the caller.
+ */
+#define CORRELATOR_MAX_VARIANTS 4
+
+/*
+ * Full-length correlation backend. NTT computes exact integer agreement
+ * counts at every lag, at the cost of transforms twice as long as the
+ * capture. Coarse stages always use FFTW.
+ */
+enum correlator_backend {
+  CORRELATOR_BACKEND_FFTW,
+  CORRELATOR_BACKEND_NTT
+};
+
+struct correlator_params {
+  const lfsrdesc_db_t *db; /* Polynomials swept, shared read-only */
+  enum correlator_backend backend;
+  BOOL period_filter;  /* Restrict sweep to detected periods */
+  unsigned int stage_count; /* Number of coarse stages */
+  size_t stage_len[CORRELATOR_MAX_STAGES]; /* Increasing prefix lengths */
+  float stage_sigma[CORRELATOR_MAX_STAGES]; /* Survival thresholds */
+  float exit_sigma;    /* Stop sweep above this significance, 0: never */
+  unsigned int variants; /* CAPTURE_VARIANT_* flags tried besides as is */
+  unsigned int sweep_from; /* Positions of db->desc_list swept, for shards */
+  unsigned int sweep_to;
+  spectrum_cache_t *spectra; /* Keystream spectra kept across runs, or NULL */
+};
+
+#define correlator_params_INITIALIZER \
+{                                     \
+  NULL, /* db */                      \
+  CORRELATOR_BACKEND_FFTW, /* backend */ \
+  TRUE, /* period_filter */           \
+  1,    /* stage_count */             \
+  {4096}, /* stage_len */             \
+  {5.f},  /* stage_sigma */           \
+  25.f,   /* exit_sigma */            \
+  CAPTURE_VARIANT_NONE, /* variants */ \
+  0,        /* sweep_from */          \
+  UINT_MAX, /* sweep_to */            \
+  NULL,     /* spectra */             \
+}
+
+/*
+ * Candidates are registered whenever a polynomial beats every one swept
+ * before it, so they come by increasing score. The position in the sweep
+ * and the score are kept so that sweeps split in ranges can be replayed
+ * as one.
+ */
 struct correlator_candidate {
   lfsrdesc_t *desc;
-  unsigned int offset;
-  unsigned int phase;
+  uint64_t offset;
+  uint64_t phase;
+  unsigned int variant; /* CAPTURE_VARIANT_* the offset applies to */
+  unsigned int position; /* In db->desc_list */
+  float score;           /* Peak, as a fraction of the bits */
+};
+
+struct correlator_stage {
+  size_t N;                 /* Transform size */
+  size_t len;               /* Data bits: N, or the prefix of a coarse stage */
+  size_t lags;              /* Lags searched for the peak */
+  float sigma;              /* Survival threshold (coarse stages only) */
+  fftwf_complex *data_freq[CORRELATOR_MAX_VARIANTS]; /* Data prefixes */
+  fftwf_complex *seq_freq;  /* Sequence in frequency domain */
+  fftwf_complex *prod;      /* Product with one variant, or seq_freq if one */
+  fftwf_complex *xcorr;     /* Computed on each run */
+
+  fftwf_plan fft_plan;     /* FFT(seq_freq) --> seq_freq */
+  fftwf_plan fft_plan_inv; /* IFFT(prod) --> xcorr */
 };
 
 struct correlator {
-  uint8_t *data;               /* Copy of input data */
-  fftwf_complex *data_freq; /* Data in frequency domain */
-  fftwf_complex *seq_freq;   /* Sequence in frequency domain */
-  fftwf_complex *xcorr;      /* Computed on each run */
+  struct correlator_params params;
+  const uint8_t *data;         /* Borrowed, must outlive the correlator */
 
   size_t N;
 
-  fftwf_plan fft_plan;     /* FFT(seq_freq) --> seq_freq */
-  fftwf_plan fft_plan_inv; /* IFFT(seq_freq) --> xcorr */
-
+  /* Variant 0 is the data as is, the others are owned copies */
+  unsigned int variant_list[CORRELATOR_MAX_VARIANTS]; /* CAPTURE_VARIANT_* */
+  const uint8_t *variant_data[CORRELATOR_MAX_VARIANTS];
+  unsigned int variant_count;
+
+  /* Coarse stages first, full-length stage last */
+  struct correlator_stage stage_list[CORRELATOR_MAX_STAGES + 1];
+  unsigned int stage_count;
+  struct correlator_stage *full;
+
+  /* NTT backend: exact full-length correlation */
+  ntt_t *ntt;
+  uint32_t *ntt_data[CORRELATOR_MAX_VARIANTS]; /* Time-reversed data */
+  uint32_t *ntt_seq;    /* Transform of the sequence, if several variants */
+  uint32_t *ntt_work;   /* Computed on each run */
+  uint64_t data_weight[CORRELATOR_MAX_VARIANTS]; /* Number of ones */
+
+  /* Workspace, so that the sweep does not allocate per polynomial */
+  uint8_t *seq;                                 /* Keystream buffer */
+  struct correlator_candidate *candidate_arena; /* One per polynomial */
+  unsigned int candidate_alloc;
   PTR_LIST(struct correlator_candidate, candidate);
 
+  uint64_t period_list[CORRELATOR_MAX_PERIODS]; /* Found in autocorrelation */
+  unsigned int period_count;           /* 0: sweep all polynomials */
+  float period_sigma;                  /* Of the strongest period */
+  BOOL periods_detected;
+  BOOL periods_overflow;               /* More than CORRELATOR_MAX_PERIODS */
+
   float best_score;
 };
 
 typedef struct correlator correlator_t;
 
+/*
+ * FFTW's planner is not thread-safe (executing plans is). Every plan in
+ * the program is created and destroyed through these.
+ */
+fftwf_plan correlator_plan_dft(
+    int n,
+    fftwf_complex *in,
+    fftwf_complex *out,
+    int sign,
+    unsigned int flags);
+
+void correlator_plan_destroy(fftwf_plan plan);
+
 void correlator_destroy(correlator_t *self);
 
 BOOL correlator_walk_candidates(
@@ -59,7 +202,26 @@ BOOL correlator_walk_candidates(
 
 BOOL correlator_run(correlator_t *corr);
 
-correlator_t *correlator_new(const uint8_t *data, size_t N);
+/*
+ * Significance of the strongest cycle length of the database in the
+ * data autocorrelation. Costs one transform, against one per polynomial
+ * for a run, which reuses the result.
+ */
+float correlator_get_period_sigma(correlator_t *self);
+
+/*
+ * Keystream spectra at the coarse stage lengths do not depend on the
+ * capture: compute those of every polynomial into the spectrum cache of
+ * `params', until it is full.
+ */
+BOOL correlator_prepare_spectra(const struct correlator_params *params);
+
+BOOL correlator_dump(correlator_t *self, dumper_t *dumper, unsigned int top);
+
+correlator_t *correlator_new(
+    const struct correlator_params *params,
+    const uint8_t *data,
+    size_t N);
 
 #endif /* _CORRELATOR_H */
 
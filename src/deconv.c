@@ -21,19 +21,33 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <ctype.h>
+#include <getopt.h>
 
 #include "viterbi.h"
+#include "capture.h"
+
+#define DECONV_READ_SIZE 4096
 
 void
 usage(const char *a0)
 {
   fprintf(stderr, "Usage:\n");
-  fprintf(stderr, "  %s K poly1 [poly2 [...]]\n", a0);
+  fprintf(stderr, "  %s [-i FMT] [-o FMT] K poly1 [poly2 [...]]\n\n", a0);
+  fprintf(
+      stderr,
+      "FMT is the format of the input (-i) or output (-o) bits: ascii, msb\n"
+      "or lsb (8 bits per byte, most or least significant first). Input\n"
+      "defaults to auto, output to ascii.\n");
 }
 
 struct error_info {
   int total;
   int failed;
+  struct capture_writer writer;
 };
 
 static BOOL
@@ -43,7 +57,6 @@ on_data(
     unsigned int errors,
     void *private)
 {
-  unsigned int i;
   struct error_info *info = (struct error_info *) private;
 
   if (errors > len / (VITERBI_TRELLIS_LENGTH - 1)) {
@@ -58,8 +71,8 @@ on_data(
     ++info->failed;
   }
 
-  for (i = 0; i < len; ++i)
-    putchar('0' + path[i]);
+  if (!capture_writer_put_bits(&info->writer, path, len))
+    return FALSE;
 
   ++info->total;
 
@@ -70,38 +83,71 @@ int
 main(int argc, char *argv[])
 {
   unsigned int n, K;
-  unsigned int i;
-  uint8_t *c;
-  uint32_t codeword;
+  unsigned int i, count = 0;
+  char buf[DECONV_READ_SIZE];
+  uint64_t words[DECONV_READ_SIZE / 8 + 1];
+  ssize_t got;
+  size_t j, p;
+  uint32_t codeword = 0;
   uint32_t *polies;
   viterbi_t *viterbi;
-  struct error_info info = {0, 0};
+  enum capture_format input_format = CAPTURE_FORMAT_AUTO;
+  struct error_info info = {0, 0, capture_writer_INITIALIZER(
+      stdout,
+      CAPTURE_FORMAT_ASCII)};
   struct viterbi_params params;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "i:o:")) != -1) {
+    switch (opt) {
+      case 'i':
+        if (!capture_parse_format(optarg, &input_format)) {
+          fprintf(stderr, "%s: unknown input format \"%s\"\n", argv[0], optarg);
+          exit(EXIT_FAILURE);
+        }
+        break;
+
+      case 'o':
+        if (!capture_parse_format(optarg, &info.writer.format)
+            || info.writer.format == CAPTURE_FORMAT_AUTO) {
+          fprintf(stderr, "%s: unknown output format \"%s\"\n", argv[0], optarg);
+          exit(EXIT_FAILURE);
+        }
+        break;
+
+      default:
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+  }
 
-  if (argc < 3) {
+  if (argc - optind < 2) {
     fprintf(stderr, "%s: wrong number of arguments\n", argv[0]);
     usage(argv[0]);
     exit(EXIT_FAILURE);
   }
 
-  if (sscanf(argv[1], "%u", &K) != 1) {
+  if (sscanf(argv[optind], "%u", &K) != 1) {
     fprintf(
         stderr,
         "%s: invalid constraint length \"%s\"\n",
         argv[0],
-        argv[1]);
+        argv[optind]);
     usage(argv[0]);
     exit(EXIT_FAILURE);
   }
 
-  n = argc - 2;
+  n = argc - optind - 1;
 
-  ALLOCATE_MANY(c,      n, uint8_t);
   ALLOCATE_MANY(polies, n, unsigned int);
 
   for (i = 0; i < n; ++i) {
-    if (sscanf(argv[2 + i], "%u", polies + i) != 1) {
-      fprintf(stderr, "%s: invalid polinomial\n", argv[0], argv[2 + i]);
+    if (sscanf(argv[optind + 1 + i], "%u", polies + i) != 1) {
+      fprintf(
+          stderr,
+          "%s: invalid polinomial \"%s\"\n",
+          argv[0],
+          argv[optind + 1 + i]);
       usage(argv[0]);
       exit(EXIT_FAILURE);
     }
@@ -115,29 +161,53 @@ main(int argc, char *argv[])
 
   CONSTRUCT(viterbi, viterbi, &params);
 
-  while (fread(c, sizeof(uint8_t), n, stdin) == n) {
-    codeword = 0;
-    for (i = 0; i < n; ++i) {
-      if (c[i] == '1') {
-        codeword |= 1 << (n - i - 1);
-      } else if (c[i] != '0') {
-        fprintf(
-            stderr,
-            "%s: invalid character \0%o in input\n",
-            argv[0],
-            c[i]);
-        goto fail;
-      }
-    }
+  /* Codewords may span reads: keep the partial one across chunks */
+  while ((got = read(STDIN_FILENO, buf, sizeof(buf))) != 0) {
+    if (got == -1) {
+      if (errno == EINTR)
+        continue;
 
-    if (!viterbi_feed(viterbi, codeword)) {
-      fprintf(stderr, "%s: Viterbi decoder refused to continue\n", argv[0]);
+      fprintf(stderr, "%s: cannot read from stdin: %s\n", argv[0], strerror(errno));
       goto fail;
     }
+
+    if (input_format == CAPTURE_FORMAT_AUTO)
+      input_format = capture_detect_format((const uint8_t *) buf, got);
+
+    /* The parser skips anything else, but here it means a wrong input */
+    if (input_format == CAPTURE_FORMAT_ASCII)
+      for (j = 0; j < (size_t) got; ++j)
+        if (buf[j] != '0' && buf[j] != '1' && !isspace((uint8_t) buf[j])) {
+          fprintf(
+              stderr,
+              "%s: invalid character \\%o in input\n",
+              argv[0],
+              (uint8_t) buf[j]);
+          goto fail;
+        }
+
+    p = capture_parse_as(input_format, buf, got, words);
+
+    for (j = 0; j < p; ++j) {
+      codeword = (codeword << 1)
+          | ((words[j / CAPTURE_WORD_BITS] >> (j % CAPTURE_WORD_BITS)) & 1);
+
+      if (++count == n) {
+        if (!viterbi_feed(viterbi, codeword)) {
+          fprintf(stderr, "%s: Viterbi decoder refused to continue\n", argv[0]);
+          goto fail;
+        }
+
+        codeword = 0;
+        count = 0;
+      }
+    }
   }
 
+  capture_writer_flush(&info.writer);
+
   if (info.total == info.failed) {
-    fprintf(stderr, "%s: all tracebacks failed. Decoding failed\n");
+    fprintf(stderr, "%s: all tracebacks failed. Decoding failed\n", argv[0]);
     goto fail;
   }
 
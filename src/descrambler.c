@@ -0,0 +1,144 @@
+/*
+
+  descrambler.c: Block descrambler
+  Copyright (C) 2016 Gonzalo José Carracedo Carballal
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program.  If not, see
+  <http://www.gnu.org/licenses/>
+
+*/
+
+#include "descrambler.h"
+
+/* 64 keystream bits starting at bit `pos' */
+static inline uint64_t
+descrambler_keystream_word(const descrambler_t *self, uint64_t pos)
+{
+  const uint64_t *word = self->keystream + pos / CAPTURE_WORD_BITS;
+  unsigned int shift = pos % CAPTURE_WORD_BITS;
+
+  if (shift == 0)
+    return word[0];
+
+  return (word[0] >> shift) | (word[1] << (CAPTURE_WORD_BITS - shift));
+}
+
+void
+descrambler_apply(
+    descrambler_t *self,
+    const uint64_t *words,
+    uint64_t *out,
+    size_t len)
+{
+  size_t count = __UNITS(len, CAPTURE_WORD_BITS);
+  uint64_t pos = self->phase;
+  size_t i;
+
+  if (self->variant.variant != CAPTURE_VARIANT_NONE) {
+    capture_variant_words(&self->variant, words, out, len);
+    words = out;
+  }
+
+  for (i = 0; i < count; ++i) {
+    out[i] = words[i] ^ descrambler_keystream_word(self, pos);
+    if ((pos += CAPTURE_WORD_BITS) >= self->period)
+      pos -= self->period;
+  }
+
+  self->phase = (self->phase + len) % self->period;
+}
+
+BOOL
+descrambler_feed(descrambler_t *self, const uint64_t *words, size_t len)
+{
+  size_t count = __UNITS(len, CAPTURE_WORD_BITS);
+  uint64_t *out;
+
+  if (count > self->out_alloc) {
+    TRY(out = realloc(self->out, count * sizeof(uint64_t)));
+    self->out = out;
+    self->out_alloc = count;
+  }
+
+  descrambler_apply(self, words, self->out, len);
+
+  return capture_writer_put_words(&self->writer, self->out, len);
+
+fail:
+  return FALSE;
+}
+
+BOOL
+descrambler_flush(descrambler_t *self)
+{
+  return capture_writer_flush(&self->writer);
+}
+
+void
+descrambler_destroy(descrambler_t *self)
+{
+  if (self->keystream != NULL)
+    free(self->keystream);
+
+  if (self->out != NULL)
+    free(self->out);
+
+  free(self);
+}
+
+descrambler_t *
+descrambler_new(
+    const lfsrdesc_t *desc,
+    uint64_t offset,
+    unsigned int variant,
+    FILE *fp,
+    enum capture_format format)
+{
+  descrambler_t *new = NULL;
+  uint64_t len = lfsrdesc_get_cycle_len(desc);
+  uint64_t total, i;
+  uint8_t *seq = NULL;
+
+  ALLOCATE(new, descrambler_t);
+
+  new->writer = (struct capture_writer) capture_writer_INITIALIZER(fp, format);
+  new->variant = (struct capture_variant_state)
+      capture_variant_state_INITIALIZER(variant);
+
+  /* Short cycles are repeated so that a word never wraps twice */
+  new->period = len * __UNITS(CAPTURE_WORD_BITS, len);
+  new->phase = offset % new->period;
+
+  total = new->period + 2 * CAPTURE_WORD_BITS;
+
+  TRY(seq = lfsrdesc_generate(desc, len));
+  ALLOCATE_MANY(new->keystream, __UNITS(total, CAPTURE_WORD_BITS), uint64_t);
+
+  for (i = 0; i < total; ++i)
+    new->keystream[i / CAPTURE_WORD_BITS] |=
+        (uint64_t) seq[i % len] << (i % CAPTURE_WORD_BITS);
+
+  free(seq);
+
+  return new;
+
+fail:
+  if (seq != NULL)
+    free(seq);
+
+  if (new != NULL)
+    descrambler_destroy(new);
+
+  return NULL;
+}
@@ -0,0 +1,80 @@
+/*
+
+  descrambler.h: Block descrambler
+  Copyright (C) 2016 Gonzalo José Carracedo Carballal
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program.  If not, see
+  <http://www.gnu.org/licenses/>
+
+*/
+
+#ifndef _DESCRAMBLER_H
+#define _DESCRAMBLER_H
+
+#include "lfsrdesc.h"
+#include "capture.h"
+
+#define DESCRAMBLER_WINDOW  (1 << 22) /* Bytes of capture mapped at once */
+#define DESCRAMBLER_BUFSIZ  (1 << 20) /* Output stream buffer */
+
+/*
+ * XORs packed blocks of a capture with the keystream of a polynomial,
+ * a word at a time. The keystream is stored packed and repeated so that
+ * any phase can be read as whole (unaligned) words.
+ */
+struct descrambler {
+  uint64_t *keystream; /* `period' bits, followed by two spare words */
+  uint64_t period;     /* Multiple of the cycle length, at least 64 */
+  uint64_t phase;      /* Keystream position of the next bit */
+
+  uint64_t *out;       /* Scratch for descrambled words */
+  size_t out_alloc;
+
+  struct capture_variant_state variant; /* Undone before descrambling */
+
+  struct capture_writer writer;
+};
+
+typedef struct descrambler descrambler_t;
+
+/*
+ * Descramble `len' bits into `out', without writing them. Reversed
+ * variants must be given the whole capture at once.
+ */
+void descrambler_apply(
+    descrambler_t *self,
+    const uint64_t *words,
+    uint64_t *out,
+    size_t len);
+
+/* Descramble `len' bits and write them */
+BOOL descrambler_feed(descrambler_t *self, const uint64_t *words, size_t len);
+
+BOOL descrambler_flush(descrambler_t *self);
+
+void descrambler_destroy(descrambler_t *self);
+
+/*
+ * Keystream starts at phase `offset' of the input once `variant' (a set
+ * of CAPTURE_VARIANT_* flags) is applied. The stream is not owned, and
+ * may be NULL if only descrambler_apply is used.
+ */
+descrambler_t *descrambler_new(
+    const lfsrdesc_t *desc,
+    uint64_t offset,
+    unsigned int variant,
+    FILE *fp,
+    enum capture_format format);
+
+#endif /* _DESCRAMBLER_H */
@@ -0,0 +1,169 @@
+/*
+
+  dumper.c: Background bit stream writer
+  Copyright (C) 2016 Gonzalo José Carracedo Carballal
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program.  If not, see
+  <http://www.gnu.org/licenses/>
+
+*/
+
+#include "dumper.h"
+
+#include <string.h>
+#include <errno.h>
+
+static void
+dumper_job_finalize(struct dumper_job *job)
+{
+  if (job->path != NULL)
+    free(job->path);
+
+  if (job->bits != NULL)
+    free(job->bits);
+}
+
+static BOOL
+dumper_job_write(const struct dumper_job *job, enum capture_format format)
+{
+  FILE *fp = NULL;
+  struct capture_writer writer;
+  BOOL ok = FALSE;
+
+  TRY(fp = fopen(job->path, "w"));
+
+  writer = (struct capture_writer) capture_writer_INITIALIZER(fp, format);
+
+  TRY(capture_writer_put_bits(&writer, job->bits, job->len));
+  TRY(capture_writer_flush(&writer));
+
+  ok = TRUE;
+
+fail:
+  if (fp != NULL && fclose(fp) == EOF)
+    ok = FALSE;
+
+  if (!ok)
+    WARNING("Cannot dump %s: %s\n", job->path, strerror(errno));
+
+  return ok;
+}
+
+static void *
+dumper_thread_func(void *data)
+{
+  dumper_t *self = (dumper_t *) data;
+  struct dumper_job job;
+
+  for (;;) {
+    pthread_mutex_lock(&self->lock);
+
+    while (self->count == 0 && !self->done)
+      pthread_cond_wait(&self->not_empty, &self->lock);
+
+    if (self->count == 0) {
+      pthread_mutex_unlock(&self->lock);
+      break;
+    }
+
+    job = self->queue[self->head];
+    self->head = (self->head + 1) % DUMPER_QUEUE_LEN;
+    --self->count;
+
+    pthread_cond_signal(&self->not_full);
+    pthread_mutex_unlock(&self->lock);
+
+    /* Disk I/O happens without holding the lock */
+    if (!dumper_job_write(&job, self->format)) {
+      pthread_mutex_lock(&self->lock);
+      ++self->failed;
+      pthread_mutex_unlock(&self->lock);
+    }
+
+    dumper_job_finalize(&job);
+  }
+
+  return NULL;
+}
+
+BOOL
+dumper_push(dumper_t *self, char *path, uint8_t *bits, size_t len)
+{
+  struct dumper_job job = {path, bits, len};
+
+  pthread_mutex_lock(&self->lock);
+
+  while (self->count == DUMPER_QUEUE_LEN)
+    pthread_cond_wait(&self->not_full, &self->lock);
+
+  self->queue[(self->head + self->count) % DUMPER_QUEUE_LEN] = job;
+  ++self->count;
+
+  pthread_cond_signal(&self->not_empty);
+  pthread_mutex_unlock(&self->lock);
+
+  return TRUE;
+}
+
+unsigned int
+dumper_destroy(dumper_t *self)
+{
+  unsigned int failed;
+
+  pthread_mutex_lock(&self->lock);
+  self->done = TRUE;
+  pthread_cond_signal(&self->not_empty);
+  pthread_mutex_unlock(&self->lock);
+
+  pthread_join(self->thread, NULL);
+
+  failed = self->failed;
+
+  pthread_cond_destroy(&self->not_full);
+  pthread_cond_destroy(&self->not_empty);
+  pthread_mutex_destroy(&self->lock);
+
+  free(self);
+
+  return failed;
+}
+
+dumper_t *
+dumper_new(enum capture_format format)
+{
+  dumper_t *new = NULL;
+
+  ALLOCATE(new, dumper_t);
+
+  new->format = format;
+
+  pthread_mutex_init(&new->lock, NULL);
+  pthread_cond_init(&new->not_empty, NULL);
+  pthread_cond_init(&new->not_full, NULL);
+
+  if (pthread_create(&new->thread, NULL, dumper_thread_func, new) != 0) {
+    pthread_cond_destroy(&new->not_full);
+    pthread_cond_destroy(&new->not_empty);
+    pthread_mutex_destroy(&new->lock);
+    goto fail;
+  }
+
+  return new;
+
+fail:
+  if (new != NULL)
+    free(new);
+
+  return NULL;
+}
@@ -0,0 +1,66 @@
+/*
+
+  dumper.h: Background bit stream writer
+  Copyright (C) 2016 Gonzalo José Carracedo Carballal
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program.  If not, see
+  <http://www.gnu.org/licenses/>
+
+*/
+
+#ifndef _DUMPER_H
+#define _DUMPER_H
+
+#include <pthread.h>
+
+#include "capture.h"
+
+#define DUMPER_QUEUE_LEN 8
+
+struct dumper_job {
+  char *path;
+  uint8_t *bits; /* One byte per bit */
+  size_t len;
+};
+
+/*
+ * Bit streams are queued and written to disk by a background thread.
+ * The queue is bounded: producers wait only if DUMPER_QUEUE_LEN jobs are
+ * already pending.
+ */
+struct dumper {
+  enum capture_format format;
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t not_empty;
+  pthread_cond_t not_full;
+
+  struct dumper_job queue[DUMPER_QUEUE_LEN];
+  unsigned int head;
+  unsigned int count;
+  unsigned int failed;
+  BOOL done;
+};
+
+typedef struct dumper dumper_t;
+
+/* Takes ownership of `path' and `bits', even on failure */
+BOOL dumper_push(dumper_t *self, char *path, uint8_t *bits, size_t len);
+
+/* Waits for pending jobs. Returns the number of files that failed */
+unsigned int dumper_destroy(dumper_t *self);
+
+dumper_t *dumper_new(enum capture_format format);
+
+#endif /* _DUMPER_H */
@@ -0,0 +1,485 @@
+/*
+
+  foldcorr.c: Folded (bounded-memory) correlator
+  Copyright (C) 2016 Gonzalo José Carracedo Carballal
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program.  If not, see
+  <http://www.gnu.org/licenses/>
+
+*/
+
+#include <complex.h>
+#include <math.h>
+
+#include "foldcorr.h"
+
+#include <string.h>
+
+static void
+foldcorr_fold_destroy(struct foldcorr_fold *fold)
+{
+  if (fold->acc != NULL)
+    free(fold->acc);
+
+  if (fold->fold_freq != NULL)
+    fftwf_free(fold->fold_freq);
+
+  if (fold->seq_freq != NULL)
+    fftwf_free(fold->seq_freq);
+
+  if (fold->xcorr != NULL)
+    fftwf_free(fold->xcorr);
+
+  if (fold->fft_plan_inv != NULL)
+    correlator_plan_destroy(fold->fft_plan_inv);
+
+  if (fold->fft_plan != NULL)
+    correlator_plan_destroy(fold->fft_plan);
+
+  free(fold);
+}
+
+static struct foldcorr_fold *
+foldcorr_fold_new(uint64_t period)
+{
+  struct foldcorr_fold *new = NULL;
+
+  ALLOCATE(new, struct foldcorr_fold);
+
+  new->period = period;
+
+  ALLOCATE_MANY(new->acc, period, int64_t);
+  ALLOCATE_FFT(new->fold_freq, period);
+  ALLOCATE_FFT(new->seq_freq, period);
+  ALLOCATE_FFT(new->xcorr, period);
+
+  TRY(new->fft_plan = correlator_plan_dft(
+      period,
+      new->seq_freq,
+      new->seq_freq,
+      FFTW_FORWARD,
+      FFTW_ESTIMATE));
+
+  TRY(new->fft_plan_inv = correlator_plan_dft(
+      period,
+      new->seq_freq,
+      new->xcorr,
+      FFTW_BACKWARD,
+      FFTW_ESTIMATE));
+
+  return new;
+
+fail:
+  if (new != NULL)
+    foldcorr_fold_destroy(new);
+
+  return NULL;
+}
+
+void
+foldcorr_destroy(foldcorr_t *self)
+{
+  unsigned int i;
+
+  for (i = 0; i < self->fold_count; ++i)
+    if (self->fold_list[i] != NULL)
+      foldcorr_fold_destroy(self->fold_list[i]);
+
+  if (self->fold_list != NULL)
+    free(self->fold_list);
+
+  if (self->candidate_arena != NULL)
+    free(self->candidate_arena);
+
+  if (self->candidate_list != NULL)
+    free(self->candidate_list);
+
+  if (self->seq != NULL)
+    free(self->seq);
+
+  free(self);
+}
+
+static struct foldcorr_fold *
+foldcorr_lookup_fold(const foldcorr_t *self, uint64_t period)
+{
+  unsigned int i;
+
+  for (i = 0; i < self->fold_count; ++i)
+    if (self->fold_list[i]->period == period)
+      return self->fold_list[i];
+
+  return NULL;
+}
+
+size_t
+foldcorr_get_footprint(const foldcorr_t *self)
+{
+  unsigned int i;
+  size_t size = sizeof(foldcorr_t);
+
+  for (i = 0; i < self->fold_count; ++i)
+    size += self->fold_list[i]->period
+        * (sizeof(int64_t) + 3 * sizeof(fftwf_complex));
+
+  return size;
+}
+
+/* Best candidate of the last run, NULL if none */
+const struct correlator_candidate *
+foldcorr_get_best(const foldcorr_t *self)
+{
+  if (self->candidate_count == 0)
+    return NULL;
+
+  return self->candidate_list[self->candidate_count - 1];
+}
+
+/* Significance of the best peak of the last run */
+float
+foldcorr_get_sigma(const foldcorr_t *self)
+{
+  return sqrtf(self->best_score * self->N);
+}
+
+BOOL
+foldcorr_walk_candidates(
+    foldcorr_t *self,
+    BOOL (*callback) (const struct correlator_candidate *, void *),
+    void *private)
+{
+  unsigned int i;
+
+  for (i = 0; i < self->candidate_count; ++i)
+    if (!(callback) (self->candidate_list[i], private))
+      return FALSE;
+
+  return TRUE;
+}
+
+static BOOL
+foldcorr_register_candidate(
+    foldcorr_t *self,
+    unsigned int position,
+    uint64_t offset,
+    float score)
+{
+  struct correlator_candidate *candidate;
+  lfsrdesc_t *desc = self->params.db->desc_list[position];
+
+  if (self->candidate_count == self->candidate_alloc)
+    return FALSE;
+
+  candidate = self->candidate_arena + self->candidate_count;
+
+  candidate->desc = desc;
+  candidate->offset = offset;
+  candidate->phase = offset % lfsrdesc_get_cycle_len(desc);
+  candidate->position = position;
+  candidate->score = score;
+
+  self->candidate_list[self->candidate_count++] = candidate;
+
+  return TRUE;
+}
+
+BOOL
+foldcorr_feed(foldcorr_t *self, const uint8_t *bits, size_t len)
+{
+  unsigned int i;
+  size_t j;
+  struct foldcorr_fold *fold;
+  uint64_t pos;
+
+  for (i = 0; i < self->fold_count; ++i) {
+    fold = self->fold_list[i];
+    pos = fold->pos;
+
+    for (j = 0; j < len; ++j) {
+      fold->acc[pos] += 2 * (int64_t) bits[j] - 1;
+      if (++pos == fold->period)
+        pos = 0;
+    }
+
+    fold->pos = pos;
+  }
+
+  self->N += len;
+
+  return TRUE;
+}
+
+/*
+ * Prepare the spectrum of every fold. The centered fold energy of a
+ * random capture follows a chi-square distribution with L - 1 degrees of
+ * freedom (in units of N / L): this is the folded counterpart of the
+ * autocorrelation period prefilter of the full-length correlator.
+ */
+static uint64_t
+foldcorr_gcd(uint64_t a, uint64_t b)
+{
+  uint64_t t;
+
+  while (b != 0) {
+    t = a % b;
+    a = b;
+    b = t;
+  }
+
+  return a;
+}
+
+static unsigned int
+foldcorr_prepare_folds(foldcorr_t *self)
+{
+  unsigned int i, j;
+  unsigned int accepted = 0;
+  uint64_t r;
+  struct foldcorr_fold *fold;
+  fftwf_plan plan = NULL;
+  double mean, energy;
+  float K = 1.f / self->N;
+
+  for (i = 0; i < self->fold_count; ++i) {
+    fold = self->fold_list[i];
+    fold->accepted = FALSE;
+
+    mean = 0;
+    for (r = 0; r < fold->period; ++r)
+      mean += fold->acc[r];
+    mean /= fold->period;
+
+    energy = 0;
+    for (r = 0; r < fold->period; ++r) {
+      energy += (fold->acc[r] - mean) * (fold->acc[r] - mean);
+      fold->fold_freq[r] = K * fold->acc[r];
+    }
+
+    fold->sigma = 0;
+    if (self->N >= 2 * fold->period && fold->period > 1) {
+      fold->sigma =
+          (energy * fold->period / self->N - (fold->period - 1))
+          / sqrt(2. * (fold->period - 1));
+
+    }
+
+    /* In-place transform, we only need it once per run */
+    if ((plan = correlator_plan_dft(
+        fold->period,
+        fold->fold_freq,
+        fold->fold_freq,
+        FFTW_FORWARD,
+        FFTW_ESTIMATE)) != NULL) {
+      fftwf_execute(plan);
+      correlator_plan_destroy(plan);
+    }
+  }
+
+  /*
+   * A fold also picks up energy from any period sharing a common factor
+   * with it (e.g. 63 and 511 share 7). Keep only the strongest of each
+   * group.
+   */
+  for (i = 0; i < self->fold_count; ++i) {
+    fold = self->fold_list[i];
+    if (fold->sigma <= CORRELATOR_PERIOD_SIGMA)
+      continue;
+
+    for (j = 0; j < self->fold_count; ++j)
+      if (self->fold_list[j]->sigma > fold->sigma
+          && foldcorr_gcd(self->fold_list[j]->period, fold->period) > 1)
+        break;
+
+    if (j < self->fold_count)
+      continue;
+
+    _DEBUG(
+        "Period %lu stands out (%.1f sigma)\n",
+        (unsigned long) fold->period,
+        fold->sigma);
+
+    fold->accepted = TRUE;
+    ++accepted;
+  }
+
+  return accepted;
+}
+
+/* Correlate one period of the keystream against its fold */
+static float
+foldcorr_fold_peak(
+    struct foldcorr_fold *fold,
+    const uint8_t *seq,
+    uint64_t *max_j)
+{
+  uint64_t j;
+  float amp, max = 0;
+  float K = 1.f / fold->period;
+
+  for (j = 0; j < fold->period; ++j)
+    fold->seq_freq[j] = 2 * K * (seq[j] - .5);
+
+  fftwf_execute(fold->fft_plan);
+
+  for (j = 0; j < fold->period; ++j)
+    fold->seq_freq[j] *= conj(fold->fold_freq[j]);
+
+  fftwf_execute(fold->fft_plan_inv);
+
+  *max_j = 0;
+  for (j = 0; j < fold->period; ++j) {
+    amp = creal(fold->xcorr[j] * conj(fold->xcorr[j]));
+    if (amp > max) {
+      max = amp;
+      *max_j = j;
+    }
+  }
+
+  return max;
+}
+
+BOOL
+foldcorr_run(foldcorr_t *self)
+{
+  unsigned int i, end;
+  unsigned int accepted;
+  uint64_t max_j;
+  float max;
+  char poly[LFSR_POLY_STRLEN];
+  const lfsrdesc_db_t *db = self->params.db;
+  struct foldcorr_fold *fold;
+  BOOL ok = FALSE;
+
+  /* Folds keep accumulating, candidates are per run */
+  self->candidate_count = 0;
+
+  self->best_score = 0;
+
+  if (self->N == 0)
+    return TRUE;
+
+  _DEBUG(
+      "Running %lu bits against %d polynomials (%d folds)\n",
+      (unsigned long) self->N,
+      db->desc_count,
+      self->fold_count);
+
+  accepted = foldcorr_prepare_folds(self);
+
+  if (accepted == 0 || !self->params.period_filter)
+    _DEBUG("Sweeping all polynomials\n");
+
+  end = MIN(self->params.sweep_to, db->desc_count);
+
+  for (i = self->params.sweep_from; i < end; ++i) {
+    fold = foldcorr_lookup_fold(
+        self,
+        lfsrdesc_get_cycle_len(db->desc_list[i]));
+
+    if (fold == NULL)
+      continue;
+
+    /* Periods not yet seen twice cannot stand out */
+    if (self->params.period_filter
+        && accepted > 0
+        && self->N >= 2 * fold->period
+        && !fold->accepted)
+      continue;
+
+    lfsrdesc_generate_into(db->desc_list[i], self->seq, fold->period);
+
+    max = foldcorr_fold_peak(fold, self->seq, &max_j);
+
+    if (max > self->best_score) {
+      TRY(foldcorr_register_candidate(self, i, max_j, max));
+      self->best_score = max;
+
+      lfsrdesc_format_poly(db->desc_list[i], poly, sizeof(poly));
+
+      _DEBUG(
+          "Best score: %6.2f%% in %-5lu (polynomial %s)\n",
+          100.f * max,
+          (unsigned long) max_j,
+          poly);
+
+      if (self->params.exit_sigma > 0
+          && sqrtf(max * self->N) >= self->params.exit_sigma) {
+        _DEBUG(
+            "Peak at %.1f sigma, stopping after %d polynomials\n",
+            sqrtf(max * self->N),
+            i + 1);
+        break;
+      }
+    }
+  }
+
+  ok = TRUE;
+
+fail:
+  return ok;
+}
+
+foldcorr_t *
+foldcorr_new(const struct correlator_params *params)
+{
+  foldcorr_t *new = NULL;
+  struct foldcorr_fold *fold = NULL;
+  struct correlator_params defaults = correlator_params_INITIALIZER;
+  const lfsrdesc_db_t *db;
+  uint64_t period;
+  uint64_t max_period = 0;
+  unsigned int i;
+
+  if (params == NULL)
+    params = &defaults;
+
+  ALLOCATE(new, foldcorr_t);
+
+  new->params = *params;
+
+  /* Every search runs against a database */
+  TRY(db = params->db);
+
+  if (db->desc_count > 0) {
+    new->candidate_alloc = db->desc_count;
+    ALLOCATE_MANY(new->candidate_arena, db->desc_count, struct correlator_candidate);
+    ALLOCATE_MANY(new->candidate_list, db->desc_count, struct correlator_candidate *);
+  }
+
+  for (i = 0; i < db->desc_count; ++i) {
+    period = lfsrdesc_get_cycle_len(db->desc_list[i]);
+    if (period == 0 || foldcorr_lookup_fold(new, period) != NULL)
+      continue;
+
+    CONSTRUCT(fold, foldcorr_fold, period);
+    TRY(PTR_LIST_APPEND_CHECK(new->fold, fold) != -1);
+    fold = NULL;
+
+    if (period > max_period)
+      max_period = period;
+  }
+
+  ALLOCATE_MANY(new->seq, MAX(max_period, 1), uint8_t);
+
+  return new;
+
+fail:
+  if (fold != NULL)
+    foldcorr_fold_destroy(fold);
+
+  if (new != NULL)
+    foldcorr_destroy(new);
+
+  return NULL;
+}
@@ -0,0 +1,87 @@
+/*
+
+  foldcorr.h: Folded (bounded-memory) correlator
+  Copyright (C) 2016 Gonzalo José Carracedo Carballal
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program.  If not, see
+  <http://www.gnu.org/licenses/>
+
+*/
+
+#ifndef _FOLDCORR_H
+#define _FOLDCORR_H
+
+#include "correlator.h"
+
+/*
+ * A keystream of period L only depends on the capture through the sum of
+ * the input bits (as +/-1) that fall in each of the L residues modulo L.
+ * The folded correlator keeps one such accumulator per distinct cycle
+ * length of the database, so memory depends on the database only and the
+ * capture can be fed in blocks of any size. The per-lag scores are the
+ * cyclic correlation of each fold against one period of the keystream.
+ */
+struct foldcorr_fold {
+  uint64_t period;
+  uint64_t pos;     /* Residue of the next bit */
+  int64_t *acc;     /* Sum of bits as +/-1, per residue */
+
+  fftwf_complex *fold_freq; /* Fold in frequency domain */
+  fftwf_complex *seq_freq;  /* Sequence in frequency domain */
+  fftwf_complex *xcorr;     /* Computed on each run */
+
+  fftwf_plan fft_plan;     /* FFT(seq_freq) --> seq_freq */
+  fftwf_plan fft_plan_inv; /* IFFT(seq_freq) --> xcorr */
+
+  float sigma;      /* Fold energy over the noise floor */
+  BOOL accepted;    /* Period stands out */
+};
+
+struct foldcorr {
+  struct correlator_params params;
+  uint64_t N;       /* Bits fed so far */
+
+  PTR_LIST(struct foldcorr_fold, fold);
+
+  /* Workspace, so that the sweep does not allocate per polynomial */
+  uint8_t *seq;                                 /* One keystream period */
+  struct correlator_candidate *candidate_arena; /* One per polynomial */
+  unsigned int candidate_alloc;
+  PTR_LIST(struct correlator_candidate, candidate);
+
+  float best_score;
+};
+
+typedef struct foldcorr foldcorr_t;
+
+void foldcorr_destroy(foldcorr_t *self);
+
+BOOL foldcorr_walk_candidates(
+    foldcorr_t *self,
+    BOOL (*callback) (const struct correlator_candidate *, void *),
+    void *private);
+
+BOOL foldcorr_feed(foldcorr_t *self, const uint8_t *bits, size_t len);
+
+BOOL foldcorr_run(foldcorr_t *self);
+
+const struct correlator_candidate *foldcorr_get_best(const foldcorr_t *self);
+
+float foldcorr_get_sigma(const foldcorr_t *self);
+
+size_t foldcorr_get_footprint(const foldcorr_t *self);
+
+foldcorr_t *foldcorr_new(const struct correlator_params *params);
+
+#endif /* _FOLDCORR_H */
@@ -0,0 +1,447 @@
+/*
+
+  hits.c: Polynomials and offsets voted by the inputs
+  Copyright (C) 2016 Gonzalo José Carracedo Carballal
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program.  If not, see
+  <http://www.gnu.org/licenses/>
+
+*/
+
+#include <string.h>
+
+#include "hits.h"
+
+void
+lfsr_hit_destroy(struct lfsr_hit *hit)
+{
+  unsigned int i;
+
+  for (i = 0; i < hit->params_hit_count; ++i)
+    if (hit->params_hit_list[i] != NULL)
+      free(hit->params_hit_list[i]);
+
+  if (hit->params_hit_list != NULL)
+    free(hit->params_hit_list);
+
+  free(hit);
+}
+
+static inline size_t
+lfsr_hit_hash(const lfsrdesc_t *desc, uint64_t offset)
+{
+  uint64_t x = (uint64_t) (uintptr_t) desc ^ (offset * 0x9e3779b97f4a7c15ull);
+
+  /* splitmix64 finalizer: pointers are aligned, offsets are small */
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ull;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebull;
+  x ^= x >> 31;
+
+  return (size_t) x;
+}
+
+static struct lfsr_hit **
+lfsr_hit_index_slot(
+    struct lfsr_hit **index,
+    size_t size,
+    const lfsrdesc_t *desc)
+{
+  size_t i = lfsr_hit_hash(desc, 0) & (size - 1);
+
+  while (index[i] != NULL && index[i]->desc != desc)
+    i = (i + 1) & (size - 1);
+
+  return index + i;
+}
+
+static struct lfsr_params_hit **
+lfsr_params_hit_index_slot(
+    struct lfsr_params_hit **index,
+    size_t size,
+    const lfsrdesc_t *desc,
+    uint64_t offset,
+    unsigned int variant)
+{
+  size_t i = lfsr_hit_hash(desc, (offset + 1) ^ ((uint64_t) variant << 56))
+      & (size - 1);
+
+  while (index[i] != NULL
+      && (index[i]->desc != desc
+      || index[i]->offset != offset
+      || index[i]->variant != variant))
+    i = (i + 1) & (size - 1);
+
+  return index + i;
+}
+
+/* Make room for one more hit in the descriptor index */
+static BOOL
+lfsr_hit_table_reserve_hit(struct lfsr_hit_table *table)
+{
+  struct lfsr_hit **index = NULL;
+  size_t size;
+  unsigned int i;
+
+  if (2 * (table->hit_count + 1) <= table->hit_index_size)
+    return TRUE;
+
+  size = table->hit_index_size == 0
+      ? LFSR_HIT_INDEX_MIN
+      : 2 * table->hit_index_size;
+
+  ALLOCATE_MANY(index, size, struct lfsr_hit *);
+
+  for (i = 0; i < table->hit_count; ++i)
+    *lfsr_hit_index_slot(index, size, table->hit_list[i]->desc) =
+        table->hit_list[i];
+
+  if (table->hit_index != NULL)
+    free(table->hit_index);
+
+  table->hit_index = index;
+  table->hit_index_size = size;
+
+  return TRUE;
+
+fail:
+  return FALSE;
+}
+
+/* Make room for one more offset in the (descriptor, offset, variant) index */
+static BOOL
+lfsr_hit_table_reserve_params(struct lfsr_hit_table *table)
+{
+  struct lfsr_params_hit **index = NULL;
+  struct lfsr_params_hit *params_hit;
+  size_t size;
+  size_t i;
+
+  if (2 * (table->params_count + 1) <= table->params_index_size)
+    return TRUE;
+
+  size = table->params_index_size == 0
+      ? LFSR_HIT_INDEX_MIN
+      : 2 * table->params_index_size;
+
+  ALLOCATE_MANY(index, size, struct lfsr_params_hit *);
+
+  for (i = 0; i < table->params_index_size; ++i)
+    if ((params_hit = table->params_index[i]) != NULL)
+      *lfsr_params_hit_index_slot(
+          index,
+          size,
+          params_hit->desc,
+          params_hit->offset,
+          params_hit->variant) = params_hit;
+
+  if (table->params_index != NULL)
+    free(table->params_index);
+
+  table->params_index = index;
+  table->params_index_size = size;
+
+  return TRUE;
+
+fail:
+  return FALSE;
+}
+
+static BOOL
+lfsr_hit_push(
+    struct lfsr_hit_table *table,
+    struct lfsr_hit *self,
+    uint64_t offset,
+    unsigned int variant,
+    unsigned int count,
+    unsigned int file)
+{
+  struct lfsr_params_hit **slot;
+  struct lfsr_params_hit *hit = NULL;
+
+  TRY(lfsr_hit_table_reserve_params(table));
+
+  slot = lfsr_params_hit_index_slot(
+      table->params_index,
+      table->params_index_size,
+      self->desc,
+      offset,
+      variant);
+
+  if (*slot == NULL) {
+    ALLOCATE(hit, struct lfsr_params_hit);
+    hit->desc = self->desc;
+    hit->offset = offset;
+    hit->variant = variant;
+    hit->first_file = file;
+    TRY(PTR_LIST_APPEND_CHECK(self->params_hit, hit) != -1);
+    *slot = hit;
+    ++table->params_count;
+  } else {
+    hit = *slot;
+    if (file < hit->first_file)
+      hit->first_file = file;
+  }
+
+  self->hits += count;
+  hit->hits += count;
+
+  if (hit->hits > self->max_offset_hits)
+    self->max_offset_hits = hit->hits;
+
+  return TRUE;
+
+fail:
+  if (hit != NULL && *slot != hit)
+    free(hit);
+
+  return FALSE;
+}
+
+struct lfsr_hit *
+lfsr_hit_new(lfsrdesc_t *desc)
+{
+  struct lfsr_hit *self = NULL;
+
+  ALLOCATE(self, struct lfsr_hit);
+
+  self->desc = desc;
+
+  return self;
+
+fail:
+  if (self != NULL)
+    lfsr_hit_destroy(self);
+
+  return NULL;
+}
+
+struct lfsr_hit *
+lfsr_hit_lookup(const struct lfsr_hit_table *table, const lfsrdesc_t *desc)
+{
+  if (table->hit_index_size == 0)
+    return NULL;
+
+  return *lfsr_hit_index_slot(table->hit_index, table->hit_index_size, desc);
+}
+
+struct lfsr_params_hit *
+lfsr_params_hit_lookup(
+    const struct lfsr_hit_table *table,
+    const lfsrdesc_t *desc,
+    uint64_t offset,
+    unsigned int variant)
+{
+  if (table->params_index_size == 0)
+    return NULL;
+
+  return *lfsr_params_hit_index_slot(
+      table->params_index,
+      table->params_index_size,
+      desc,
+      offset,
+      variant);
+}
+
+BOOL
+lfsr_hit_assert(
+    struct lfsr_hit_table *table,
+    lfsrdesc_t *desc,
+    uint64_t offset,
+    unsigned int variant,
+    unsigned int count,
+    unsigned int file,
+    unsigned int rank)
+{
+  struct lfsr_hit *hit, *new_hit = NULL;
+
+  if ((hit = lfsr_hit_lookup(table, desc)) == NULL) {
+    TRY(lfsr_hit_table_reserve_hit(table));
+    CONSTRUCT(new_hit, lfsr_hit, desc);
+    new_hit->first_file = file;
+    new_hit->first_rank = rank;
+    TRY(PTR_LIST_APPEND_CHECK(table->hit, new_hit) != -1);
+    *lfsr_hit_index_slot(table->hit_index, table->hit_index_size, desc) =
+        new_hit;
+    hit = new_hit;
+    new_hit = NULL;
+  } else if (file < hit->first_file
+      || (file == hit->first_file && rank < hit->first_rank)) {
+    hit->first_file = file;
+    hit->first_rank = rank;
+  }
+
+  TRY(lfsr_hit_push(table, hit, offset, variant, count, file));
+
+  return TRUE;
+
+fail:
+  if (new_hit != NULL)
+    lfsr_hit_destroy(new_hit);
+
+  return FALSE;
+}
+
+void
+lfsr_hit_table_finalize(struct lfsr_hit_table *table)
+{
+  unsigned int i;
+
+  for (i = 0; i < table->hit_count; ++i)
+    if (table->hit_list[i] != NULL)
+      lfsr_hit_destroy(table->hit_list[i]);
+
+  if (table->hit_list != NULL)
+    free(table->hit_list);
+
+  if (table->hit_index != NULL)
+    free(table->hit_index);
+
+  if (table->params_index != NULL)
+    free(table->params_index);
+
+  memset(table, 0, sizeof(struct lfsr_hit_table));
+}
+
+void
+lfsr_params_hit_add(
+    struct lfsr_params_hit *dest,
+    const struct lfsr_params_hit *src)
+{
+  dest->quality += src->quality;
+  dest->scored += src->scored;
+  dest->checked += src->checked;
+  dest->synced += src->synced;
+  dest->sync_hits += src->sync_hits;
+  if (src->sync_period != 0
+      && (dest->sync_period == 0 || src->sync_period < dest->sync_period))
+    dest->sync_period = src->sync_period;
+}
+
+BOOL
+lfsr_hit_table_merge(struct lfsr_hit_table *dest, const struct lfsr_hit_table *src)
+{
+  const struct lfsr_hit *hit;
+  const struct lfsr_params_hit *params_hit;
+  struct lfsr_params_hit *merged_params;
+  struct lfsr_hit *merged;
+  unsigned int i, j;
+
+  for (i = 0; i < src->hit_count; ++i) {
+    hit = src->hit_list[i];
+    for (j = 0; j < hit->params_hit_count; ++j) {
+      params_hit = hit->params_hit_list[j];
+      TRY(lfsr_hit_assert(
+          dest,
+          hit->desc,
+          params_hit->offset,
+          params_hit->variant,
+          params_hit->hits,
+          params_hit->first_file,
+          hit->first_rank));
+
+      merged_params = lfsr_params_hit_lookup(
+          dest,
+          hit->desc,
+          params_hit->offset,
+          params_hit->variant);
+      lfsr_params_hit_add(merged_params, params_hit);
+    }
+
+    /* The rank above is only meaningful along with the first file */
+    merged = lfsr_hit_lookup(dest, hit->desc);
+    if (hit->first_file < merged->first_file
+        || (hit->first_file == merged->first_file
+        && hit->first_rank < merged->first_rank)) {
+      merged->first_file = hit->first_file;
+      merged->first_rank = hit->first_rank;
+    }
+  }
+
+  return TRUE;
+
+fail:
+  return FALSE;
+}
+
+static int
+lfsr_hit_cmp(const void *a, const void *b)
+{
+  const struct lfsr_hit *ha = *(const struct lfsr_hit **) a;
+  const struct lfsr_hit *hb = *(const struct lfsr_hit **) b;
+
+  if (ha->first_file != hb->first_file)
+    return ha->first_file < hb->first_file ? -1 : 1;
+
+  if (ha->first_rank != hb->first_rank)
+    return ha->first_rank < hb->first_rank ? -1 : 1;
+
+  return 0;
+}
+
+static int
+lfsr_params_hit_cmp(const void *a, const void *b)
+{
+  const struct lfsr_params_hit *pa = *(const struct lfsr_params_hit **) a;
+  const struct lfsr_params_hit *pb = *(const struct lfsr_params_hit **) b;
+
+  if (pa->first_file != pb->first_file)
+    return pa->first_file < pb->first_file ? -1 : 1;
+
+  return 0;
+}
+
+/* Order of first appearance, regardless of which worker saw it */
+void
+lfsr_hit_table_sort(struct lfsr_hit_table *table)
+{
+  unsigned int i;
+
+  for (i = 0; i < table->hit_count; ++i)
+    if (table->hit_list[i]->params_hit_count > 1)
+      qsort(
+          table->hit_list[i]->params_hit_list,
+          table->hit_list[i]->params_hit_count,
+          sizeof(struct lfsr_params_hit *),
+          lfsr_params_hit_cmp);
+
+  if (table->hit_count > 1)
+    qsort(
+        table->hit_list,
+        table->hit_count,
+        sizeof(struct lfsr_hit *),
+        lfsr_hit_cmp);
+}
+
+void
+lfsr_hit_table_destroy(struct lfsr_hit_table *table)
+{
+  lfsr_hit_table_finalize(table);
+
+  free(table);
+}
+
+struct lfsr_hit_table *
+lfsr_hit_table_new(void)
+{
+  struct lfsr_hit_table *new = NULL;
+
+  ALLOCATE(new, struct lfsr_hit_table);
+
+  return new;
+
+fail:
+  return NULL;
+}
@@ -0,0 +1,126 @@
+/*
+
+  hits.h: Polynomials and offsets voted by the inputs
+  Copyright (C) 2016 Gonzalo José Carracedo Carballal
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program.  If not, see
+  <http://www.gnu.org/licenses/>
+
+*/
+
+#ifndef _HITS_H
+#define _HITS_H
+
+#include "lfsrdesc.h"
+
+struct lfsr_params_hit {
+  const lfsrdesc_t *desc; /* Key of the offset index, with offset and variant */
+  uint64_t offset;
+  unsigned int variant;   /* CAPTURE_VARIANT_* the offset applies to */
+  unsigned int hits;
+  unsigned int first_file;
+  float quality; /* Sum of the scores of `scored' files */
+  unsigned int scored;
+
+  /* Sync word search, in files where the output was scored */
+  unsigned int checked;
+  unsigned int synced;  /* Files where a sync word locked */
+  uint64_t sync_hits;
+  uint64_t sync_period; /* Shortest period seen, 0 if none */
+};
+
+struct lfsr_hit {
+  lfsrdesc_t *desc;
+  unsigned int hits;
+  unsigned int max_offset_hits;
+  unsigned int first_file; /* Where it was first seen, for a stable order */
+  unsigned int first_rank;
+  PTR_LIST(struct lfsr_params_hit, params_hit);
+};
+
+/*
+ * Hits are kept in lists (for the report) and indexed by two open
+ * addressing hash tables: one by descriptor and one by (descriptor,
+ * offset, variant). Both are sized to powers of two and kept at most
+ * half full.
+ */
+#define LFSR_HIT_INDEX_MIN 64
+
+struct lfsr_hit_table {
+  PTR_LIST(struct lfsr_hit, hit);
+
+  struct lfsr_hit **hit_index;
+  size_t hit_index_size;
+
+  struct lfsr_params_hit **params_index;
+  size_t params_index_size;
+  size_t params_count;
+};
+
+/* Sync words were looked for, but never found in its output */
+static inline BOOL
+lfsr_params_hit_is_rejected(const struct lfsr_params_hit *self)
+{
+  return self->checked > 0 && self->synced == 0;
+}
+
+/* Mean score of the files where this offset was scored, -1 if none */
+static inline float
+lfsr_params_hit_get_quality(const struct lfsr_params_hit *self)
+{
+  return self->scored > 0 ? self->quality / self->scored : -1;
+}
+
+struct lfsr_hit *lfsr_hit_new(lfsrdesc_t *desc);
+void lfsr_hit_destroy(struct lfsr_hit *hit);
+
+/* NULL if not in the table */
+struct lfsr_hit *lfsr_hit_lookup(
+    const struct lfsr_hit_table *table,
+    const lfsrdesc_t *desc);
+
+struct lfsr_params_hit *lfsr_params_hit_lookup(
+    const struct lfsr_hit_table *table,
+    const lfsrdesc_t *desc,
+    uint64_t offset,
+    unsigned int variant);
+
+/* Count `count' hits of (desc, offset, variant), seen in `file' */
+BOOL lfsr_hit_assert(
+    struct lfsr_hit_table *table,
+    lfsrdesc_t *desc,
+    uint64_t offset,
+    unsigned int variant,
+    unsigned int count,
+    unsigned int file,
+    unsigned int rank);
+
+/* Add the quality and sync word evidence of `src' to `dest' */
+void lfsr_params_hit_add(
+    struct lfsr_params_hit *dest,
+    const struct lfsr_params_hit *src);
+
+BOOL lfsr_hit_table_merge(
+    struct lfsr_hit_table *dest,
+    const struct lfsr_hit_table *src);
+
+void lfsr_hit_table_sort(struct lfsr_hit_table *table);
+
+/* Release the contents of a table that is not its own allocation */
+void lfsr_hit_table_finalize(struct lfsr_hit_table *table);
+
+void lfsr_hit_table_destroy(struct lfsr_hit_table *table);
+struct lfsr_hit_table *lfsr_hit_table_new(void);
+
+#endif /* _HITS_H */
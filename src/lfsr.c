@@ -31,33 +31,37 @@ lfsr_destroy(lfsr_t *self)
   free(self);
 }
 
-char *
-lfsr_get_poly(const lfsr_t *self)
+/* Format polynomial in caller's buffer. Returns would-be length */
+size_t
+lfsr_format_poly(const lfsr_t *self, char *buf, size_t size)
 {
   unsigned int i;
-  char *prev = NULL;
-  char *poly = NULL;
+  size_t len = 0;
+  int ret;
 
   for (i = 63; i >= 1; --i)
     if ((self->mask & (1ull << i)) != 0) {
-      TRY(poly = strbuild("%sx^%d + ", prev == NULL ? "" : prev, i));
-      if (prev != NULL)
-        free(prev);
-      prev = poly;
+      ret = snprintf(
+          buf + MIN(len, size),
+          size - MIN(len, size),
+          "x^%d + ",
+          i);
+      len += ret;
     }
 
-  TRY(poly = strbuild("%s1", prev == NULL ? "" : prev));
+  len += snprintf(buf + MIN(len, size), size - MIN(len, size), "1");
 
-  if (prev != NULL)
-    free(prev);
+  return len;
+}
 
-  return poly;
+char *
+lfsr_get_poly(const lfsr_t *self)
+{
+  char buf[LFSR_POLY_STRLEN];
 
-fail:
-  if (prev != NULL)
-    free(prev);
+  lfsr_format_poly(self, buf, sizeof(buf));
 
-  return NULL;
+  return strdup(buf);
 }
 
 void
@@ -22,11 +22,14 @@
 #ifndef _LFSR_H
 #define _LFSR_H
 
-#include <util.h>
+#include "util.h"
 #include <stdint.h>
 
 #define LFSR_MAX_TAPS 63
 
+/* Longest polynomial string: "x^NN + " per tap, plus "1" */
+#define LFSR_POLY_STRLEN (7 * LFSR_MAX_TAPS + 2)
+
 struct lfsr {
   uint64_t mask;
   uint64_t reg;
@@ -47,6 +50,7 @@ uint8_t lfsr_scramble(lfsr_t *self, uint8_t input);
 uint8_t lfsr_descramble(lfsr_t *self, uint8_t input);
 void lfsr_reset(lfsr_t *self);
 char *lfsr_get_poly(const lfsr_t *self);
+size_t lfsr_format_poly(const lfsr_t *self, char *buf, size_t size);
 void lfsr_destroy(lfsr_t *);
 
 #endif /* _LFSR_H */
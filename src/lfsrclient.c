@@ -0,0 +1,76 @@
+/*
+
+  lfsrclient.c: Run lfsrintruder in a resident server
+  Copyright (C) 2016 Gonzalo José Carracedo Carballal
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program.  If not, see
+  <http://www.gnu.org/licenses/>
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "server.h"
+
+/*
+ * Everything after the socket is the command line of lfsrintruder. The
+ * run happens in the server, in this directory and on these standard
+ * streams, and its exit status is this one's.
+ */
+int
+main(int argc, char *argv[])
+{
+  int fd, status;
+
+  if (argc < 3) {
+    fprintf(
+        stderr,
+        "Usage:\n\t%s SOCKET [OPTIONS] file1.log [file2.log [...]]\n\n"
+        "Run lfsrintruder with OPTIONS in the server listening on SOCKET\n"
+        "(see lfsrintruder --listen)\n",
+        argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  if ((fd = server_connect(argv[1])) == -1) {
+    fprintf(
+        stderr,
+        "%s: cannot connect to %s: %s\n",
+        argv[0],
+        argv[1],
+        strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+
+  /* Messages of the run carry our name */
+  argv[1] = argv[0];
+
+  if (!server_send_request(fd, argc - 1, argv + 1)) {
+    fprintf(stderr, "%s: cannot send request: %s\n", argv[0], strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+
+  if (!server_receive_status(fd, &status)) {
+    fprintf(stderr, "%s: server went away\n", argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  close(fd);
+
+  return status;
+}
@@ -20,11 +20,23 @@
 */
 
 #include "lfsrdesc.h"
+#include "polydb.h"
 
 #include <string.h>
 #include <ctype.h>
+#include <errno.h>
+#include <sys/stat.h>
 
-PTR_LIST(lfsrdesc_t, desc);
+/*
+ * Descriptors loaded from a compiled database share two arenas, one for
+ * the descriptors and one for their registers: two allocations in total,
+ * whatever the number of polynomials.
+ */
+struct lfsrdesc_arena {
+  lfsrdesc_t *descs;
+  lfsr_t *lfsrs;
+  unsigned int count;
+};
 
 void
 lfsrdesc_destroy(lfsrdesc_t *self)
@@ -61,29 +73,38 @@ fail:
   return NULL;
 }
 
-uint8_t *
-lfsrdesc_generate(lfsrdesc_t *self, size_t len)
+/*
+ * Generate the keystream on a private copy of the register, so the
+ * description stays untouched and can be shared between threads.
+ */
+void
+lfsrdesc_generate_into(const lfsrdesc_t *self, uint8_t *buf, size_t len)
 {
-  uint8_t *alloc = NULL;
-  unsigned int i;
-
-  ALLOCATE_MANY(alloc, len, uint8_t);
+  lfsr_t lfsr = *self->lfsr;
+  size_t i;
 
-  lfsr_reset(self->lfsr);
+  lfsr_reset(&lfsr);
 
   /* Empty pipeline */
   for (i = 0; i < 64; ++i)
-    lfsr_scramble(self->lfsr, 0);
+    lfsr_scramble(&lfsr, 0);
 
   for (i = 0; i < len; ++i)
-    alloc[i] = lfsr_scramble(self->lfsr, 0);
+    buf[i] = lfsr_scramble(&lfsr, 0);
+}
+
+uint8_t *
+lfsrdesc_generate(const lfsrdesc_t *self, size_t len)
+{
+  uint8_t *alloc = NULL;
+
+  ALLOCATE_MANY(alloc, len, uint8_t);
+
+  lfsrdesc_generate_into(self, alloc, len);
 
   return alloc;
 
 fail:
-  if (alloc != NULL)
-    free(alloc);
-
   return NULL;
 }
 
@@ -93,8 +114,94 @@ lfsrdesc_get_poly(const lfsrdesc_t *self)
   return lfsr_get_poly(self->lfsr);
 }
 
+size_t
+lfsrdesc_format_poly(const lfsrdesc_t *self, char *buf, size_t size)
+{
+  return lfsr_format_poly(self->lfsr, buf, size);
+}
+
+static void
+lfsrdesc_arena_destroy(struct lfsrdesc_arena *self)
+{
+  if (self->descs != NULL)
+    free(self->descs);
+
+  if (self->lfsrs != NULL)
+    free(self->lfsrs);
+
+  free(self);
+}
+
+static BOOL
+lfsrdesc_arena_contains(
+    const struct lfsrdesc_arena *self,
+    const lfsrdesc_t *desc)
+{
+  return desc >= self->descs && desc < self->descs + self->count;
+}
+
+static inline size_t
+lfsrdesc_mask_hash(uint64_t mask)
+{
+  uint64_t x = mask;
+
+  /* splitmix64 finalizer: masks of similar degree share their top bits */
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ull;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebull;
+  x ^= x >> 31;
+
+  return (size_t) x;
+}
+
+static lfsrdesc_t **
+lfsrdesc_mask_index_slot(lfsrdesc_t **index, size_t size, uint64_t mask)
+{
+  size_t i = lfsrdesc_mask_hash(mask) & (size - 1);
+
+  while (index[i] != NULL && index[i]->lfsr->mask != mask)
+    i = (i + 1) & (size - 1);
+
+  return index + i;
+}
+
+/* Index every descriptor by mask. The first of repeated masks wins */
+static BOOL
+lfsrdesc_db_index_masks(lfsrdesc_db_t *self)
+{
+  lfsrdesc_t **index = NULL;
+  lfsrdesc_t **slot;
+  size_t size = 16;
+  unsigned int i;
+
+  while (size < 2 * (size_t) self->desc_count)
+    size <<= 1;
+
+  ALLOCATE_MANY(index, size, lfsrdesc_t *);
+
+  for (i = 0; i < self->desc_count; ++i)
+    if (self->desc_list[i] != NULL) {
+      slot = lfsrdesc_mask_index_slot(index, size, self->desc_list[i]->lfsr->mask);
+      if (*slot == NULL)
+        *slot = self->desc_list[i];
+    }
+
+  if (self->mask_index != NULL)
+    free(self->mask_index);
+
+  self->mask_index = index;
+  self->mask_index_size = size;
+  self->mask_indexed = self->desc_count;
+
+  return TRUE;
+
+fail:
+  return FALSE;
+}
+
 BOOL
-lfsrdesc_load_from_file(const char *path)
+lfsrdesc_db_load_from_file(lfsrdesc_db_t *self, const char *path)
 {
   FILE *fp = NULL;
   lfsrdesc_t *desc = NULL;
@@ -132,7 +239,9 @@ lfsrdesc_load_from_file(const char *path)
 
       CONSTRUCT(desc, lfsrdesc, taps, args->al_argc);
 
-      TRY(PTR_LIST_APPEND_CHECK(desc, desc) != -1);
+      desc->index = self->desc_count;
+
+      TRY(PTR_LIST_APPEND_CHECK(self->desc, desc) != -1);
 
       desc = NULL;
 
@@ -144,6 +253,8 @@ lfsrdesc_load_from_file(const char *path)
     line = NULL;
   }
 
+  TRY(lfsrdesc_db_index_masks(self));
+
   ok = TRUE;
 
 fail:
@@ -165,3 +276,229 @@ fail:
   return ok;
 }
 
+BOOL
+lfsrdesc_db_load_from_db(lfsrdesc_db_t *self, const char *path)
+{
+  polydb_t *db = NULL;
+  struct lfsrdesc_arena *arena = NULL;
+  lfsrdesc_t *descs;
+  lfsr_t *lfsrs;
+  uint64_t i, n = 0;
+  BOOL ok = FALSE;
+
+  TRY(db = polydb_new(path));
+
+  for (i = 0; i < db->count; ++i)
+    if (polydb_is_primitive(db, i))
+      ++n;
+
+  ALLOCATE(arena, struct lfsrdesc_arena);
+
+  if (n > 0) {
+    ALLOCATE_MANY(arena->descs, n, lfsrdesc_t);
+    ALLOCATE_MANY(arena->lfsrs, n, lfsr_t);
+  }
+
+  descs = arena->descs;
+  lfsrs = arena->lfsrs;
+
+  /* Same order as the text loader, see polydb.h */
+  for (i = 0, n = 0; i < db->count; ++i)
+    if (polydb_is_primitive(db, i)) {
+      lfsrs[n].mask = db->masks[i];
+      lfsrs[n].len = db->degrees[i] - 1;
+      lfsrs[n].cycle_len = db->cycle_lens[i];
+      lfsr_reset(lfsrs + n);
+
+      descs[n].lfsr = lfsrs + n;
+      descs[n].index = self->desc_count;
+
+      TRY(PTR_LIST_APPEND_CHECK(self->desc, descs + n) != -1);
+      arena->count = ++n;
+    }
+
+  TRY(lfsrdesc_db_index_masks(self));
+
+  TRY(PTR_LIST_APPEND_CHECK(self->arena, arena) != -1);
+  arena = NULL;
+
+  ok = TRUE;
+
+fail:
+  /* Nothing removes descriptors, so the ones we added are the last ones */
+  if (arena != NULL) {
+    self->desc_count -= arena->count;
+    lfsrdesc_arena_destroy(arena);
+  }
+
+  if (db != NULL)
+    polydb_destroy(db);
+
+  return ok;
+}
+
+/* Prefer the compiled database, unless the text one is newer */
+BOOL
+lfsrdesc_db_load(
+    lfsrdesc_db_t *self,
+    const char *db_path,
+    const char *text_path)
+{
+  struct stat db_stat, text_stat;
+
+  if (stat(db_path, &db_stat) != -1
+      && (stat(text_path, &text_stat) == -1
+      || db_stat.st_mtime >= text_stat.st_mtime)) {
+    if (lfsrdesc_db_load_from_db(self, db_path))
+      return TRUE;
+
+    WARNING("%s: %s, falling back to %s\n", db_path, strerror(errno), text_path);
+  }
+
+  return lfsrdesc_db_load_from_file(self, text_path);
+}
+
+lfsrdesc_t *
+lfsrdesc_db_lookup_by_mask(const lfsrdesc_db_t *self, uint64_t mask)
+{
+  unsigned int i;
+
+  if (self->mask_index != NULL && self->mask_indexed == self->desc_count)
+    return *lfsrdesc_mask_index_slot(
+        self->mask_index,
+        self->mask_index_size,
+        mask);
+
+  for (i = 0; i < self->desc_count; ++i)
+    if (self->desc_list[i] != NULL && self->desc_list[i]->lfsr->mask == mask)
+      return self->desc_list[i];
+
+  return NULL;
+}
+
+/*
+ * Prior file format: one polynomial per line, as "HITS MASK", with the
+ * feedback mask in hexadecimal. Unknown polynomials are ignored. A missing
+ * file is not an error: it just means we have no history yet.
+ */
+BOOL
+lfsrdesc_db_load_prior(lfsrdesc_db_t *self, const char *path)
+{
+  FILE *fp = NULL;
+  char *line = NULL;
+  lfsrdesc_t *desc;
+  unsigned int hits;
+  unsigned long long mask;
+
+  if ((fp = fopen(path, "r")) == NULL)
+    return errno == ENOENT;
+
+  while ((line = fread_line(fp)) != NULL) {
+    if (*line != '#' && sscanf(line, "%u %llx", &hits, &mask) == 2)
+      if ((desc = lfsrdesc_db_lookup_by_mask(self, mask)) != NULL)
+        desc->prior = hits;
+
+    free(line);
+  }
+
+  fclose(fp);
+
+  return TRUE;
+}
+
+BOOL
+lfsrdesc_db_save_prior(const lfsrdesc_db_t *self, const char *path)
+{
+  FILE *fp = NULL;
+  unsigned int i;
+  BOOL ok = FALSE;
+
+  TRY(fp = fopen(path, "w"));
+
+  fprintf(fp, "# lfsrintruder polynomial prior: HITS MASK\n");
+
+  for (i = 0; i < self->desc_count; ++i)
+    if (self->desc_list[i] != NULL && self->desc_list[i]->prior > 0)
+      fprintf(
+          fp,
+          "%u %llx\n",
+          self->desc_list[i]->prior,
+          (unsigned long long) self->desc_list[i]->lfsr->mask);
+
+  ok = TRUE;
+
+fail:
+  if (fp != NULL)
+    fclose(fp);
+
+  return ok;
+}
+
+static int
+lfsrdesc_prior_cmp(const void *a, const void *b)
+{
+  const lfsrdesc_t *da = *(const lfsrdesc_t **) a;
+  const lfsrdesc_t *db = *(const lfsrdesc_t **) b;
+
+  if (da->prior != db->prior)
+    return da->prior > db->prior ? -1 : 1;
+
+  return (int) da->index - (int) db->index;
+}
+
+/* Most frequent polynomials first, file order otherwise */
+void
+lfsrdesc_db_sort_by_prior(lfsrdesc_db_t *self)
+{
+  if (self->desc_count > 0)
+    qsort(
+        self->desc_list,
+        self->desc_count,
+        sizeof(lfsrdesc_t *),
+        lfsrdesc_prior_cmp);
+}
+
+void
+lfsrdesc_db_destroy(lfsrdesc_db_t *self)
+{
+  unsigned int i, j;
+
+  for (i = 0; i < self->desc_count; ++i) {
+    if (self->desc_list[i] == NULL)
+      continue;
+
+    for (j = 0; j < self->arena_count; ++j)
+      if (lfsrdesc_arena_contains(self->arena_list[j], self->desc_list[i]))
+        break;
+
+    if (j == self->arena_count)
+      lfsrdesc_destroy(self->desc_list[i]);
+  }
+
+  for (i = 0; i < self->arena_count; ++i)
+    lfsrdesc_arena_destroy(self->arena_list[i]);
+
+  if (self->desc_list != NULL)
+    free(self->desc_list);
+
+  if (self->arena_list != NULL)
+    free(self->arena_list);
+
+  if (self->mask_index != NULL)
+    free(self->mask_index);
+
+  free(self);
+}
+
+lfsrdesc_db_t *
+lfsrdesc_db_new(void)
+{
+  lfsrdesc_db_t *new = NULL;
+
+  ALLOCATE(new, lfsrdesc_db_t);
+
+  return new;
+
+fail:
+  return NULL;
+}
@@ -30,6 +30,8 @@ struct lfsrdesc {
   unsigned int *poly;
   size_t poly_size;
   lfsr_t *lfsr;
+  unsigned int index; /* Position in the database file */
+  unsigned int prior; /* Historical hit count */
 };
 
 typedef struct lfsrdesc lfsrdesc_t;
@@ -41,11 +43,52 @@ lfsrdesc_get_cycle_len(const lfsrdesc_t *desc)
 }
 
 lfsrdesc_t *lfsrdesc_new(const unsigned int *poly, size_t poly_size);
-uint8_t *lfsrdesc_generate(lfsrdesc_t *desc, size_t len);
+uint8_t *lfsrdesc_generate(const lfsrdesc_t *desc, size_t len);
+void lfsrdesc_generate_into(const lfsrdesc_t *desc, uint8_t *buf, size_t len);
 char *lfsrdesc_get_poly(const lfsrdesc_t *self);
+size_t lfsrdesc_format_poly(const lfsrdesc_t *self, char *buf, size_t size);
 void lfsrdesc_destroy(lfsrdesc_t *);
 
-BOOL lfsrdesc_load_from_file(const char *path);
+struct lfsrdesc_arena;
+
+/*
+ * A set of polynomials, in sweep order. Loading, priors and sorting
+ * modify it; once ready it is only read, and any number of searches may
+ * share it, from any thread.
+ */
+struct lfsrdesc_db {
+  PTR_LIST(lfsrdesc_t, desc);
+  PTR_LIST(struct lfsrdesc_arena, arena); /* Of compiled databases */
+
+  /*
+   * Descriptors by feedback mask, built by the loaders. Only trusted
+   * while it covers every descriptor: lists appended to by hand are
+   * looked up the slow way.
+   */
+  lfsrdesc_t **mask_index;
+  size_t mask_index_size; /* Power of two */
+  unsigned int mask_indexed;
+};
+
+typedef struct lfsrdesc_db lfsrdesc_db_t;
+
+/* NULL if the feedback mask is not in the database */
+lfsrdesc_t *lfsrdesc_db_lookup_by_mask(
+    const lfsrdesc_db_t *self,
+    uint64_t mask);
+
+BOOL lfsrdesc_db_load_from_file(lfsrdesc_db_t *self, const char *path);
+BOOL lfsrdesc_db_load_from_db(lfsrdesc_db_t *self, const char *path);
+BOOL lfsrdesc_db_load(
+    lfsrdesc_db_t *self,
+    const char *db_path,
+    const char *text_path);
+BOOL lfsrdesc_db_load_prior(lfsrdesc_db_t *self, const char *path);
+BOOL lfsrdesc_db_save_prior(const lfsrdesc_db_t *self, const char *path);
+void lfsrdesc_db_sort_by_prior(lfsrdesc_db_t *self);
+
+void lfsrdesc_db_destroy(lfsrdesc_db_t *self);
+lfsrdesc_db_t *lfsrdesc_db_new(void);
 
 #endif /* _LFSRDESC_H */
 
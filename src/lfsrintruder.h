@@ -1,12 +1,15 @@
 /*
- * lfsrintruder.h: headers, prototypes and declarations for lfsrintruder
+ * lfsrintruder.h: public interface of liblfsrintruder
  * Creation date: Tue Jan 22 10:15:41 2019
  */
 
 #ifndef _MAIN_INCLUDE_H
 #define _MAIN_INCLUDE_H
 
-#include <config.h> /* General compile-time configuration parameters */
-#include <util.h> /* From util: Common utility library */
+#include "util.h" /* From util: Common utility library */
+
+#include "session.h" /* Analysis of captures, vote and descrambling */
+#include "foldcorr.h"
+#include "polydb.h"
 
 #endif /* _MAIN_INCLUDE_H */
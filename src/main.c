@@ -8,367 +8,1010 @@
 #include <string.h>
 #include <errno.h>
 #include <getopt.h>
-#include <sys/stat.h>
-
-#include "correlator.h"
-
-#define OUTPUT_DIRECTORY "descrambled"
-
-struct lfsr_params_hit {
-  unsigned int offset;
-  unsigned int hits;
+#include <inttypes.h>
+
+#include "session.h"
+#include "foldcorr.h"
+#include "capture.h"
+#include "server.h"
+
+#define POLY_TEXT_FILE "all-irredpoly.txt"
+#define POLY_DB_FILE "all-irredpoly.db"
+#define STREAM_READ_SIZE 4096
+#define STREAM_DEFAULT_INTERVAL 65536
+#define STREAM_MIN_SIGMA 8.f /* Detections need this, whatever -e says */
+#define SERVER_SPECTRA_MIB 256 /* Keystream spectra kept by a server */
+
+/* What runs of a server inherit from it */
+struct lfsr_resident {
+  lfsrdesc_db_t *db;
+  spectrum_cache_t *spectra;
 };
 
-struct lfsr_hit {
-  lfsrdesc_t *desc;
-  unsigned int hits;
-  unsigned int max_offset_hits;
-  PTR_LIST(struct lfsr_params_hit, params_hit);
+static struct option long_options[] = {
+  {"stage", required_argument, NULL, 's'},
+  {"no-period-filter", no_argument, NULL, 'F'},
+  {"exit-sigma", required_argument, NULL, 'e'},
+  {"prior", required_argument, NULL, 'p'},
+  {"memory", required_argument, NULL, 'M'},
+  {"stream", optional_argument, NULL, 'S'},
+  {"backend", required_argument, NULL, 'b'},
+  {"segment", required_argument, NULL, 'B'},
+  {"threads", required_argument, NULL, 'j'},
+  {"input-format", required_argument, NULL, 'i'},
+  {"output-format", required_argument, NULL, 'o'},
+  {"top", required_argument, NULL, 'k'},
+  {"dump", optional_argument, NULL, 'd'},
+  {"sync", required_argument, NULL, 'y'},
+  {"variants", required_argument, NULL, 'V'},
+  {"symbols", required_argument, NULL, 'm'},
+  {"cache", required_argument, NULL, 'C'},
+  {"sweep", required_argument, NULL, 'R'},
+  {"partial", required_argument, NULL, 'P'},
+  {"merge", no_argument, NULL, 'G'},
+  {"listen", required_argument, NULL, 'L'},
+  {"help", no_argument, NULL, 'h'},
+  {NULL, 0, NULL, 0}
 };
 
-PTR_LIST(struct lfsr_hit, hit);
+static void
+help(const char *a0)
+{
+  fprintf(stderr, "Usage:\n\t%s [OPTIONS] file1.log [file2.log [...]]\n\n", a0);
+  fprintf(stderr, "Options:\n");
+  fprintf(
+      stderr,
+      "  -s, --stage=LEN[:SIGMA]  add a coarse stage correlating the first LEN\n"
+      "                           bits. Polynomials whose peak is below SIGMA\n"
+      "                           standard deviations are pruned (default: 4096:5).\n"
+      "                           Use \"-s none\" to disable coarse stages\n");
+  fprintf(
+      stderr,
+      "  -F, --no-period-filter   do not restrict the sweep to the periods\n"
+      "                           detected in the data autocorrelation\n");
+  fprintf(
+      stderr,
+      "  -e, --exit-sigma=SIGMA   stop the sweep as soon as a peak exceeds SIGMA\n"
+      "                           standard deviations (default: 25, 0 disables)\n");
+  fprintf(
+      stderr,
+      "  -p, --prior=FILE         sweep polynomials by decreasing historical hit\n"
+      "                           count, as stored in FILE. The file is updated\n"
+      "                           with the best match of this run\n");
+  fprintf(
+      stderr,
+      "  -M, --memory=MIB         bounded-memory mode: fold the capture modulo\n"
+      "                           each cycle length while reading it through a\n"
+      "                           memory map of at most MIB mebibytes\n");
+  fprintf(
+      stderr,
+      "  -S, --stream[=BITS]      read bits continuously from standard input and\n"
+      "                           re-evaluate the folded correlator every BITS\n"
+      "                           bits (default: %d). A detection is reported as\n"
+      "                           soon as its peak exceeds the exit threshold,\n"
+      "                           and never below %g sigma\n",
+      STREAM_DEFAULT_INTERVAL,
+      STREAM_MIN_SIGMA);
+  fprintf(
+      stderr,
+      "  -b, --backend=NAME       full-length correlation backend: fftw (single\n"
+      "                           precision, default) or ntt (exact integer\n"
+      "                           counts, for very long captures)\n");
+  fprintf(
+      stderr,
+      "  -B, --segment=BITS       segmented mode: correlate blocks of BITS bits\n"
+      "                           independently and report the keystream phase\n"
+      "                           of each segment, tolerating bit slips\n");
+  fprintf(
+      stderr,
+      "  -j, --threads=N          analyze and descramble files in N threads. A\n"
+      "                           single file in segmented mode has its\n"
+      "                           segments correlated in parallel (default: 1)\n");
+  fprintf(
+      stderr,
+      "  -i, --input-format=FMT   format of the captures: ascii (one '0' or '1'\n"
+      "                           per bit), msb or lsb (8 bits per byte, most or\n"
+      "                           least significant first) or auto (default)\n");
+  fprintf(
+      stderr,
+      "  -o, --output-format=FMT  format of descrambled files and dumps: ascii\n"
+      "                           (default), msb or lsb\n");
+  fprintf(
+      stderr,
+      "  -k, --top=K              descramble every input with the K best\n"
+      "                           (polynomial, offset) pairs in a single pass\n"
+      "                           (default: 1)\n");
+  fprintf(
+      stderr,
+      "  -d, --dump[=K]           save the parsed input to input.log and the\n"
+      "                           input descrambled with the K best candidates\n"
+      "                           of the correlator under candidates/ (default:\n"
+      "                           1). Files are written in the background\n");
+  fprintf(
+      stderr,
+      "  -y, --sync=WORD[/ERRS]   look for a frame sync word (hex as 0x1ACFFC1D\n"
+      "                           or binary as 0b01111110, first bit first) in\n"
+      "                           the output of every candidate, allowing ERRS\n"
+      "                           bit errors. Candidates where no sync word\n"
+      "                           shows up periodically are rejected. Up to %d\n"
+      "                           words may be given\n",
+      SESSION_MAX_SYNC_WORDS);
+  fprintf(
+      stderr,
+      "  -V, --variants=LIST      also try the captures inverted, differentially\n"
+      "                           decoded (NRZ-I), reversed in time or with the\n"
+      "                           bit order of every byte swapped, in the same\n"
+      "                           sweep. LIST is a comma-separated subset of\n"
+      "                           inverted, differential, reversed and bitrev,\n"
+      "                           or \"all\". The correlation cannot tell an\n"
+      "                           inverted capture from a plaintext of opposite\n"
+      "                           bias: inversion is only reported when a sync\n"
+      "                           word (-y) shows up in the inverted output\n");
+  fprintf(
+      stderr,
+      "  -m, --symbols=ORDER      the captures hold symbol indices (one digit\n"
+      "                           or byte per symbol) of a bpsk, qpsk or 8psk\n"
+      "                           constellation. Every rotation, mirroring,\n"
+      "                           Gray or natural labeling and bit order is\n"
+      "                           tried, and the best one descrambled. Mappings\n"
+      "                           that only differ in the polarity of every bit\n"
+      "                           are told apart with \"-V inverted\" and -y\n");
+  fprintf(
+      stderr,
+      "  -C, --cache=FILE         keep the candidates of every file in FILE.\n"
+      "                           Files whose contents were seen before are not\n"
+      "                           analyzed again, and files that grew since the\n"
+      "                           last run only have the appended bits\n"
+      "                           correlated (whole-capture mode, except with\n"
+      "                           reversed or bitrev variants). FILE is created\n"
+      "                           if it does not exist\n");
+  fprintf(
+      stderr,
+      "  -R, --sweep=FROM:TO      only sweep the polynomials at positions FROM\n"
+      "                           to TO - 1 of the sweep order. I/N sweeps the\n"
+      "                           I-th of N equal parts (from 0)\n");
+  fprintf(
+      stderr,
+      "  -P, --partial=FILE       shard mode: write the candidates of every file\n"
+      "                           to FILE instead of voting. Shards over parts of\n"
+      "                           the sweep (-R) or over different files are\n"
+      "                           merged with -G. Every shard must use the same\n"
+      "                           settings and polynomials\n");
+  fprintf(
+      stderr,
+      "  -G, --merge              the arguments are partial results (-P): vote\n"
+      "                           and descramble as a single run over all their\n"
+      "                           files would. Analysis settings are taken from\n"
+      "                           the partials\n");
+  fprintf(
+      stderr,
+      "  -L, --listen=SOCKET      resident mode: keep the polynomials and their\n"
+      "                           keystream spectra loaded, and run the command\n"
+      "                           lines sent by lfsrclient to the Unix domain\n"
+      "                           socket SOCKET. Each one runs in a process of\n"
+      "                           its own, in the directory and on the standard\n"
+      "                           streams of the client. Up to %d MiB of\n"
+      "                           spectra are kept, shared by all runs\n",
+      SERVER_SPECTRA_MIB);
+  fprintf(stderr, "  -h, --help               this help\n");
+}
 
-void
-lfsr_hit_destroy(struct lfsr_hit *hit)
+static BOOL
+parse_stage(struct correlator_params *params, BOOL *user_stages, const char *arg)
 {
-  unsigned int i;
+  unsigned int len;
+  float sigma = 5.f;
 
-  for (i = 0; i < hit->params_hit_count; ++i)
-    if (hit->params_hit_list[i] != NULL)
-      free(hit->params_hit_list[i]);
+  if (!*user_stages) {
+    params->stage_count = 0;
+    *user_stages = TRUE;
+  }
 
-  if (hit->params_hit_list != NULL)
-    free(hit->params_hit_list);
+  if (strcmp(arg, "none") == 0)
+    return TRUE;
 
-  free(hit);
-}
+  if (params->stage_count == CORRELATOR_MAX_STAGES) {
+    fprintf(stderr, "Too many stages (max %d)\n", CORRELATOR_MAX_STAGES);
+    return FALSE;
+  }
 
-BOOL
-lfsr_hit_push(struct lfsr_hit *self, unsigned int offset)
-{
-  unsigned int i;
-  struct lfsr_params_hit *hit = NULL;
+  if (sscanf(arg, "%u:%f", &len, &sigma) < 1 || len == 0 || sigma < 0) {
+    fprintf(stderr, "Invalid stage specification \"%s\"\n", arg);
+    return FALSE;
+  }
 
-  for (i = 0; i < self->params_hit_count; ++i)
-    if (self->params_hit_list[i]->offset == offset) {
-      hit = self->params_hit_list[i];
-      break;
-    }
+  params->stage_len[params->stage_count] = len;
+  params->stage_sigma[params->stage_count] = sigma;
+  ++params->stage_count;
 
-  if (hit == NULL) {
-    ALLOCATE(hit, struct lfsr_params_hit);
-    hit->offset = offset;
-    TRY(PTR_LIST_APPEND_CHECK(self->params_hit, hit) != -1);
-  }
+  return TRUE;
+}
 
-  ++self->hits;
-  ++hit->hits;
+/* Positions are only known once the polynomials are loaded */
+static BOOL
+parse_sweep(struct correlator_params *params, const char *arg)
+{
+  unsigned int a, b;
+  char sep;
+  int len = 0;
+
+  if (sscanf(arg, "%u%c%u%n", &a, &sep, &b, &len) != 3 || arg[len] != '\0')
+    goto fail;
+
+  if (sep == '/' && a < b) {
+    params->sweep_from = (uint64_t) params->db->desc_count * a / b;
+    params->sweep_to = (uint64_t) params->db->desc_count * (a + 1) / b;
+  } else if (sep == ':') {
+    params->sweep_from = a;
+    params->sweep_to = MIN(b, (unsigned int) params->db->desc_count);
+  } else {
+    goto fail;
+  }
 
-  if (hit->hits > self->max_offset_hits)
-    self->max_offset_hits = hit->hits;
+  if (params->sweep_from >= params->sweep_to) {
+    fprintf(stderr, "Sweep range \"%s\" is empty\n", arg);
+    return FALSE;
+  }
 
   return TRUE;
 
 fail:
-  if (hit != NULL)
-    free(hit);
-
+  fprintf(stderr, "Invalid sweep range \"%s\"\n", arg);
   return FALSE;
 }
 
-struct lfsr_hit *
-lfsr_hit_new(lfsrdesc_t *desc)
+static BOOL
+on_segment(const struct segcorr_segment *segment, void *private)
+{
+  if (segment->phase == SEGCORR_NO_LOCK)
+    printf(
+        "      Bits %10" PRIu64 "-%-10" PRIu64 " no lock\n",
+        segment->start,
+        segment->end);
+  else
+    printf(
+        "      Bits %10" PRIu64 "-%-10" PRIu64 " phase %" PRIu64 "\n",
+        segment->start,
+        segment->end,
+        segment->phase);
+
+  return TRUE;
+}
+
+static BOOL
+on_segments(const char *path, const segcorr_t *seg, void *private)
 {
-  struct lfsr_hit *self = NULL;
+  char poly[LFSR_POLY_STRLEN];
 
-  ALLOCATE(self, struct lfsr_hit);
+  if (seg->best != NULL) {
+    lfsrdesc_format_poly(seg->best, poly, sizeof(poly));
 
-  self->desc = desc;
+    /* Keep the report of each file in one piece */
+    flockfile(stdout);
+    printf(
+        "%s: [%s] in %u segments\n",
+        path,
+        poly,
+        seg->segment_count);
+    segcorr_walk_segments(seg, on_segment, NULL);
+    putchar(10);
+    funlockfile(stdout);
+  }
 
-  return self;
+  return TRUE;
+}
 
-fail:
-  if (self != NULL)
-    lfsr_hit_destroy(self);
+static BOOL
+on_symbol_map(const char *path, const struct symbol_map *map, void *private)
+{
+  char name[SYMBOLS_MAP_STRLEN];
 
-  return NULL;
+  symbol_map_to_string(map, name, sizeof(name));
+  printf("%s: symbols mapped as %s\n", path, name);
+
+  return TRUE;
 }
 
-struct lfsr_hit *
-lfsr_hit_lookup(const lfsrdesc_t *desc)
+static void
+stream_report(const foldcorr_t *fold, const char *tag)
 {
-  unsigned int i;
+  const struct correlator_candidate *best;
+  char *poly;
+
+  if ((best = foldcorr_get_best(fold)) == NULL)
+    return;
 
-  for (i = 0; i < hit_count; ++i)
-    if (hit_list[i]->desc == desc)
-      return hit_list[i];
+  if ((poly = lfsrdesc_get_poly(best->desc)) == NULL)
+    return;
 
-  return NULL;
+  printf(
+      "%s: [%s] PHASE %" PRIu64 " AT BIT %" PRIu64 " (%.1f SIGMA)\n",
+      tag,
+      poly,
+      best->phase,
+      fold->N,
+      foldcorr_get_sigma(fold));
+  fflush(stdout);
+
+  free(poly);
 }
 
-BOOL
-lfsr_hit_assert(
-    lfsrdesc_t *desc,
-    unsigned int offset)
+/*
+ * Streaming mode: fold bits as they arrive and re-run the (cheap) folded
+ * sweep every `interval' bits. Memory is bounded by the folds and latency
+ * by the interval.
+ */
+static BOOL
+analyze_stream(
+    const char *a0,
+    enum capture_format format,
+    const struct correlator_params *params,
+    uint64_t interval)
 {
-  struct lfsr_hit *hit, *new_hit = NULL;
-  unsigned int i = 0;
-
-  if ((hit = lfsr_hit_lookup(desc)) == NULL) {
-    CONSTRUCT(new_hit, lfsr_hit, desc);
-    TRY(PTR_LIST_APPEND_CHECK(hit, new_hit) != -1);
-    hit = new_hit;
-    new_hit = NULL;
+  foldcorr_t *fold = NULL;
+  char buf[STREAM_READ_SIZE];
+  uint64_t words[STREAM_READ_SIZE / 8 + 1];
+  uint8_t bits[8 * STREAM_READ_SIZE];
+  const struct correlator_candidate *best;
+  const lfsrdesc_t *last_desc = NULL;
+  uint64_t last_phase = 0;
+  float threshold = MAX(params->exit_sigma, STREAM_MIN_SIGMA);
+  uint64_t next_run = interval;
+  ssize_t got;
+  size_t p;
+  BOOL detected = FALSE;
+  BOOL ok = FALSE;
+
+  TRY_EXCEPT(
+      fold = foldcorr_new(params),
+      fprintf(stderr, "%s: cannot create folded correlator\n", a0));
+
+  for (;;) {
+    if ((got = read(STDIN_FILENO, buf, sizeof(buf))) == -1) {
+      if (errno == EINTR)
+        continue;
+
+      fprintf(stderr, "%s: cannot read from stdin: %s\n", a0, strerror(errno));
+      goto fail;
+    }
+
+    /* The first chunk decides the format of the whole stream */
+    if (format == CAPTURE_FORMAT_AUTO && got > 0)
+      format = capture_detect_format((const uint8_t *) buf, got);
+
+    p = got > 0 ? capture_parse_as(format, buf, got, words) : 0;
+    capture_unpack(words, 0, p, bits);
+
+    TRY(foldcorr_feed(fold, bits, p));
+
+    if (got == 0 || fold->N >= next_run) {
+      TRY(foldcorr_run(fold));
+      next_run = fold->N + interval;
+
+      /* Report only new (polynomial, phase) detections */
+      if ((best = foldcorr_get_best(fold)) != NULL
+          && foldcorr_get_sigma(fold) >= threshold
+          && (best->desc != last_desc || best->phase != last_phase)) {
+        stream_report(fold, "DETECTED");
+        last_desc = best->desc;
+        last_phase = best->phase;
+        detected = TRUE;
+      }
+    }
+
+    if (got == 0)
+      break;
   }
 
-  TRY(lfsr_hit_push(hit, offset));
+  if (!detected) {
+    printf("%s: no detection in %" PRIu64 " bits\n", a0, fold->N);
+    stream_report(fold, "BEST GUESS");
+  }
 
-  return TRUE;
+  ok = TRUE;
 
 fail:
-  if (new_hit != NULL)
-    lfsr_hit_destroy(new_hit);
+  if (fold != NULL)
+    foldcorr_destroy(fold);
 
-  return FALSE;
+  return ok;
 }
-
+/*
+ * Report the hits of every polynomial, pick the best match and descramble
+ * the inputs with it and the hypotheses that follow. `files' is how many
+ * of them were analyzed.
+ */
 static BOOL
-on_candidate(const struct correlator_candidate *candidate, void *private)
+lfsr_report(
+    lfsr_session_t *session,
+    unsigned int files,
+    const char *prior_file)
 {
-  /* Record only polynomials whose cycle length is at least 31 */
-  if (lfsrdesc_get_cycle_len(candidate->desc) >= 16)
-    TRY(lfsr_hit_assert(candidate->desc, candidate->phase));
+  const char *a0 = session->params.name;
+  const struct lfsr_hit *hit;
+  const struct lfsr_params_hit *params_hit;
+  struct lfsr_vote vote;
+  unsigned int i, j;
+  char variant[CAPTURE_VARIANT_STRLEN];
+  char *poly;
+  int ret;
+
+  memset(&vote, 0, sizeof(struct lfsr_vote));
+
+  for (i = 0; i < session->hits->hit_count; ++i) {
+    hit = session->hits->hit_list[i];
+    if (files == 1 || hit->hits > 1) {
+      TRY(poly = lfsrdesc_get_poly(hit->desc));
+      printf("%3d/%d hits: %s\n", hit->hits, files, poly);
+      free(poly);
+      for (j = 0; j < hit->params_hit_count; ++j) {
+        params_hit = hit->params_hit_list[j];
+        printf(
+            "      Offset %4" PRIu64 " with %3d hits",
+            params_hit->offset,
+            params_hit->hits);
+        if (params_hit->variant != CAPTURE_VARIANT_NONE) {
+          capture_variant_to_string(
+              params_hit->variant,
+              variant,
+              sizeof(variant));
+          printf(" (%s)", variant);
+        }
+        if (params_hit->synced > 0)
+          printf(
+              ", sync in %u/%u files (period %" PRIu64 ")",
+              params_hit->synced,
+              params_hit->checked,
+              params_hit->sync_period);
+        else if (lfsr_params_hit_is_rejected(params_hit))
+          printf(", rejected (no sync)");
+        putchar(10);
+      }
+
+      putchar(10);
+
+    }
+  }
+
+  TRY(lfsr_session_vote(session, &vote));
+
+  if (vote.best != NULL) {
+    TRY(poly = lfsrdesc_get_poly(vote.best->desc));
+    printf(
+        "\033[1mBEST MATCH: [%s] WITH %d/%d HITS\033[0m\n",
+        poly,
+        vote.best->hits,
+        files);
+    free(poly);
+
+    printf(
+        "\033[1mBEST OFFSET: %" PRIu64 " WITH %d/%d HITS\033[0m\n",
+        vote.best_offset->offset,
+        vote.best_offset->hits,
+        vote.best->hits);
+
+    if (session->params.correlator.variants != CAPTURE_VARIANT_NONE) {
+      capture_variant_to_string(
+          vote.best_offset->variant,
+          variant,
+          sizeof(variant));
+      printf("\033[1mBEST VARIANT: %s\033[0m\n", variant);
+    }
+
+    if (vote.best_offset->scored > 0)
+      printf(
+          "\033[1mOUTPUT QUALITY: %.3f\033[0m\n",
+          lfsr_params_hit_get_quality(vote.best_offset));
+
+    if (vote.best_offset->synced > 0)
+      printf(
+          "\033[1mSYNC: %" PRIu64 " HITS IN %u/%u FILES, PERIOD %" PRIu64
+          " BITS\033[0m\n",
+          vote.best_offset->sync_hits,
+          vote.best_offset->synced,
+          vote.best_offset->checked,
+          vote.best_offset->sync_period);
+
+    for (i = 1; i < vote.hypothesis_count; ++i) {
+      TRY(poly = lfsrdesc_get_poly(vote.hypotheses[i].hit->desc));
+      printf(
+          "TOP %d: [%s] OFFSET %" PRIu64 " WITH %d/%d HITS",
+          i + 1,
+          poly,
+          vote.hypotheses[i].offset,
+          vote.hypotheses[i].hits,
+          vote.hypotheses[i].hit->hits);
+      if (vote.hypotheses[i].variant != CAPTURE_VARIANT_NONE) {
+        capture_variant_to_string(
+            vote.hypotheses[i].variant,
+            variant,
+            sizeof(variant));
+        printf(" (%s)", variant);
+      }
+      putchar(10);
+      free(poly);
+    }
+
+    TRY((ret = lfsr_session_descramble(session, &vote)) != -1);
+
+    printf(
+        "\033[1mDESCRAMBLED %d FILES UNDER %s\033[0m\n",
+        ret,
+        SESSION_OUTPUT_DIRECTORY);
+
+    if (prior_file != NULL) {
+      vote.best->desc->prior += vote.best->hits;
+      if (!lfsrdesc_db_save_prior(session->params.correlator.db, prior_file))
+        fprintf(
+            stderr,
+            "%s: cannot update prior %s: %s\n",
+            a0,
+            prior_file,
+            strerror(errno));
+    }
+  } else if (session->params.sync_count > 0 && session->hits->hit_count > 0) {
+    printf("%s: no candidate passed the sync word check\n", a0);
+  } else {
+    printf("%s: no candidate polynomials found. Shame :(\n", a0);
+  }
+
+  lfsr_vote_finalize(&vote);
 
   return TRUE;
 
 fail:
+  lfsr_vote_finalize(&vote);
+
   return FALSE;
 }
 
-BOOL
-lfsr_hit_descramble_file(
-    const struct lfsr_hit *candidate,
-    const char *input,
-    unsigned int index,
-    unsigned int offset)
+static int lfsr_main(
+    int argc,
+    char *argv[],
+    const struct lfsr_resident *resident);
+
+/* Runs in a process of its own, forked from the server */
+static int
+on_request(const struct server_request *request, void *private)
 {
-  char *path = NULL;
-  FILE *ofp = NULL;
-  FILE *fp = NULL;
-
-  uint8_t *seq = NULL;
-  uint8_t c;
-  unsigned int len = lfsrdesc_get_cycle_len(candidate->desc);
-  unsigned int p = offset % len;
-  BOOL ok = FALSE;
+  optind = 0; /* Parse a new command line */
 
-  if (access(OUTPUT_DIRECTORY, F_OK) == -1)
-    TRY_EXCEPT(
-        mkdir(OUTPUT_DIRECTORY, 0755) == -1,
-        fprintf(
-            stderr,
-            "Failed to create output directory %s: %s\n",
-            OUTPUT_DIRECTORY,
-            strerror(errno)));
+  return lfsr_main(
+      request->argc,
+      request->argv,
+      (const struct lfsr_resident *) private);
+}
+
+/*
+ * Resident mode. Polynomials are loaded once, and the keystream spectra
+ * of the coarse stages computed ahead: runs fork from here and find them
+ * ready. Spectra computed by runs are kept for the next ones.
+ */
+static BOOL
+lfsr_serve(
+    const char *a0,
+    const char *path,
+    lfsrdesc_db_t *db,
+    struct correlator_params *params)
+{
+  struct lfsr_resident resident;
+  unsigned int count;
+  size_t bytes;
+  int fd = -1;
 
-  TRY(path = strbuild("%s/descrambled-%06d.log", OUTPUT_DIRECTORY, index));
+  resident.db = db;
+  resident.spectra = NULL;
 
   TRY_EXCEPT(
-      fp = fopen(input, "r"),
-      fprintf(
-          stderr,
-          "Failed to open %s for reading: %s\n",
-          input,
-          strerror(errno)));
+      (fd = server_listen(path)) != -1,
+      fprintf(stderr, "%s: cannot listen on %s: %s\n", a0, path, strerror(errno)));
 
   TRY_EXCEPT(
-      ofp = fopen(path, "w"),
+      resident.spectra = spectrum_cache_new((size_t) SERVER_SPECTRA_MIB << 20),
       fprintf(
           stderr,
-          "Failed to open %s for writing: %s\n",
-          path,
+          "%s: cannot allocate spectrum cache: %s\n",
+          a0,
           strerror(errno)));
 
-  /* Generate a cycle */
-  TRY(seq = lfsrdesc_generate(candidate->desc, len));
+  params->spectra = resident.spectra;
+  TRY(correlator_prepare_spectra(params));
 
-  while (fread(&c, 1, 1, fp) == 1)
-    if (c == '0' || c == '1') {
-      c -= '0';
-      c ^= seq[p++];
-      if (p == len)
-        p = 0;
-      fputc(c + '0', ofp);
-    }
-  ok = TRUE;
+  spectrum_cache_get_usage(resident.spectra, &count, &bytes);
+  fprintf(
+      stderr,
+      "%s: %d polynomials and %u spectra (%zu KiB) loaded, listening on %s\n",
+      a0,
+      db->desc_count,
+      count,
+      bytes >> 10,
+      path);
 
-fail:
-  if (path != NULL)
-    free(path);
+  server_run(fd, on_request, &resident);
 
-  if (ofp != NULL)
-    fclose(ofp);
+  fprintf(stderr, "%s: cannot accept requests: %s\n", a0, strerror(errno));
 
-  if (fp != NULL)
-    fclose(fp);
+fail:
+  if (fd != -1)
+    close(fd);
 
-  if (seq != NULL)
-    free(seq);
+  if (resident.spectra != NULL)
+    spectrum_cache_destroy(resident.spectra);
 
-  return ok;
+  return FALSE;
 }
 
-int
-main(int argc, char *argv[], char *envp[])
+static int
+lfsr_main(int argc, char *argv[], const struct lfsr_resident *resident)
 {
-  FILE *fp = NULL;
-  correlator_t *corr = NULL;
-  char *buffer = NULL;
-  uint8_t c;
-  unsigned int p = 0;
-  unsigned int i, j;
-  unsigned int files = 0;
-  unsigned int max_hits = 0;
-  unsigned int best_offset = 0;
-  struct lfsr_hit *best_hit = NULL;
-  char *poly;
+  struct lfsr_session_params session_params = lfsr_session_params_INITIALIZER;
+  lfsr_session_t *session = NULL;
+  lfsrdesc_db_t *db = resident != NULL ? resident->db : NULL;
+  size_t memory_budget = 0;
+  uint64_t stream_interval = 0;
+  int files;
+  struct correlator_params params = correlator_params_INITIALIZER;
+  size_t segment_len = 0;
+  BOOL user_stages = FALSE;
+  enum capture_format input_format = CAPTURE_FORMAT_AUTO;
+  unsigned int top = 1;
+  unsigned int dump_top = 0;
+  struct syncword sync[SESSION_MAX_SYNC_WORDS];
+  unsigned int sync_count = 0;
+  unsigned int symbol_bits = 0;
+  enum capture_format output_format = CAPTURE_FORMAT_ASCII;
+  dumper_t *dumper = NULL;
+  unsigned int threads = 1;
+  const char *prior_file = NULL;
+  const char *cache_path = NULL;
+  const char *sweep = NULL;
+  const char *partial_path = NULL;
+  const char *listen_path = NULL;
+  BOOL merge = FALSE;
+  int opt;
+
+  while ((opt = getopt_long(argc, argv, "s:Fe:p:M:S::b:B:j:i:o:k:d::y:V:m:C:R:P:GL:h", long_options, NULL)) != -1) {
+    switch (opt) {
+      case 's':
+        if (!parse_stage(&params, &user_stages, optarg))
+          exit(EXIT_FAILURE);
+        break;
+
+      case 'F':
+        params.period_filter = FALSE;
+        break;
+
+      case 'e':
+        if (sscanf(optarg, "%f", &params.exit_sigma) != 1
+            || params.exit_sigma < 0) {
+          fprintf(stderr, "%s: invalid exit threshold\n", argv[0]);
+          exit(EXIT_FAILURE);
+        }
+        break;
+
+      case 'p':
+        prior_file = optarg;
+        break;
+
+      case 'M':
+        if (sscanf(optarg, "%zu", &memory_budget) != 1
+            || memory_budget == 0) {
+          fprintf(stderr, "%s: invalid memory budget\n", argv[0]);
+          exit(EXIT_FAILURE);
+        }
+        memory_budget <<= 20;
+        break;
+
+      case 'S':
+        stream_interval = STREAM_DEFAULT_INTERVAL;
+        if (optarg != NULL
+            && (sscanf(optarg, "%" SCNu64, &stream_interval) != 1
+            || stream_interval == 0)) {
+          fprintf(stderr, "%s: invalid stream interval\n", argv[0]);
+          exit(EXIT_FAILURE);
+        }
+        break;
+
+      case 'b':
+        if (strcmp(optarg, "fftw") == 0) {
+          params.backend = CORRELATOR_BACKEND_FFTW;
+        } else if (strcmp(optarg, "ntt") == 0) {
+          params.backend = CORRELATOR_BACKEND_NTT;
+        } else {
+          fprintf(stderr, "%s: unknown backend \"%s\"\n", argv[0], optarg);
+          exit(EXIT_FAILURE);
+        }
+        break;
+
+      case 'B':
+        if (sscanf(optarg, "%zu", &segment_len) != 1 || segment_len == 0) {
+          fprintf(stderr, "%s: invalid segment length\n", argv[0]);
+          exit(EXIT_FAILURE);
+        }
+        break;
+
+      case 'j':
+        if (sscanf(optarg, "%u", &threads) != 1 || threads == 0) {
+          fprintf(stderr, "%s: invalid thread count\n", argv[0]);
+          exit(EXIT_FAILURE);
+        }
+        break;
+
+      case 'i':
+        if (!capture_parse_format(optarg, &input_format)) {
+          fprintf(stderr, "%s: unknown input format \"%s\"\n", argv[0], optarg);
+          exit(EXIT_FAILURE);
+        }
+        break;
+
+      case 'o':
+        if (!capture_parse_format(optarg, &output_format)
+            || output_format == CAPTURE_FORMAT_AUTO) {
+          fprintf(stderr, "%s: unknown output format \"%s\"\n", argv[0], optarg);
+          exit(EXIT_FAILURE);
+        }
+        break;
+
+      case 'k':
+        if (sscanf(optarg, "%u", &top) != 1 || top == 0) {
+          fprintf(stderr, "%s: invalid number of hypotheses\n", argv[0]);
+          exit(EXIT_FAILURE);
+        }
+        break;
+
+      case 'd':
+        dump_top = 1;
+        if (optarg != NULL
+            && (sscanf(optarg, "%u", &dump_top) != 1 || dump_top == 0)) {
+          fprintf(stderr, "%s: invalid number of candidates to dump\n", argv[0]);
+          exit(EXIT_FAILURE);
+        }
+        break;
+
+      case 'y':
+        if (sync_count == SESSION_MAX_SYNC_WORDS) {
+          fprintf(
+              stderr,
+              "%s: too many sync words (max %d)\n",
+              argv[0],
+              SESSION_MAX_SYNC_WORDS);
+          exit(EXIT_FAILURE);
+        }
+        if (!syncword_parse(optarg, sync + sync_count)) {
+          fprintf(stderr, "%s: invalid sync word \"%s\"\n", argv[0], optarg);
+          exit(EXIT_FAILURE);
+        }
+        ++sync_count;
+        break;
+
+      case 'V':
+        if (!capture_parse_variants(optarg, &params.variants)) {
+          fprintf(stderr, "%s: invalid variant list \"%s\"\n", argv[0], optarg);
+          exit(EXIT_FAILURE);
+        }
+        break;
+
+      case 'm':
+        if (!symbols_parse_order(optarg, &symbol_bits)) {
+          fprintf(stderr, "%s: invalid symbol order \"%s\"\n", argv[0], optarg);
+          exit(EXIT_FAILURE);
+        }
+        break;
+
+      case 'C':
+        cache_path = optarg;
+        break;
+
+      case 'R':
+        sweep = optarg;
+        break;
+
+      case 'P':
+        partial_path = optarg;
+        break;
+
+      case 'G':
+        merge = TRUE;
+        break;
+
+      case 'L':
+        listen_path = optarg;
+        break;
+
+      case 'h':
+        help(argv[0]);
+        exit(EXIT_SUCCESS);
+
+      default:
+        help(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+  }
 
-  struct stat sbuf;
+  if (listen_path != NULL && (resident != NULL || optind < argc)) {
+    fprintf(stderr, "%s: a server takes no captures\n", argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  if (optind >= argc && stream_interval == 0 && listen_path == NULL) {
+    fprintf(stderr, "%s: wrong number of arguments\n", argv[0]);
+    help(argv[0]);
+    exit(EXIT_FAILURE);
+  }
 
-  if (argc < 2) {
+  if (sync_count > 0 && (memory_budget > 0 || stream_interval > 0))
     fprintf(
         stderr,
-        "Wrong number of arguments. Usage:\n\t%s file1.log [file2.log [...]]\n",
+        "%s: warning: sync words are only checked on whole captures\n",
         argv[0]);
+
+  if (symbol_bits > 0
+      && (memory_budget > 0 || stream_interval > 0 || segment_len > 0)) {
+    fprintf(stderr, "%s: symbol captures need whole-capture mode\n", argv[0]);
     exit(EXIT_FAILURE);
   }
 
-  if (!lfsrdesc_load_from_file("all-irredpoly.txt")) {
-    fprintf(stderr, "%s: cannot load polynomials\n", argv[0]);
+  if (symbol_bits > 0 && dump_top > 0) {
+    fprintf(
+        stderr,
+        "%s: warning: candidates of symbol captures are not dumped\n",
+        argv[0]);
+    dump_top = 0;
+  }
+
+  if (params.variants != CAPTURE_VARIANT_NONE
+      && (memory_budget > 0 || stream_interval > 0 || segment_len > 0))
+    fprintf(
+        stderr,
+        "%s: warning: input variants are only tried on whole captures\n",
+        argv[0]);
+
+  if (merge
+      && (partial_path != NULL || stream_interval > 0 || symbol_bits > 0)) {
+    fprintf(stderr, "%s: partial results are merged on their own\n", argv[0]);
     exit(EXIT_FAILURE);
   }
 
-  for (i = 1; i < argc; ++i) {
-    if (stat(argv[i], &sbuf) == -1) {
-      fprintf(
-          stderr,
-          "%s: cannot stat %s: %s\n",
-          argv[0],
-          argv[1],
-          strerror(errno));
+  if (partial_path != NULL
+      && (stream_interval > 0 || segment_len > 0 || symbol_bits > 0)) {
+    fprintf(
+        stderr,
+        "%s: shards need whole-capture or bounded-memory mode\n",
+        argv[0]);
+    exit(EXIT_FAILURE);
+  }
 
-      goto cleanup;
-    }
+  if ((partial_path != NULL || merge) && dump_top > 0) {
+    fprintf(
+        stderr,
+        "%s: warning: candidates of shards are not dumped\n",
+        argv[0]);
+    dump_top = 0;
+  }
 
-    if (sbuf.st_size == 0) {
-      fprintf(stderr, "%s: file %s is empty, skipping...\n", argv[0], argv[i]);
-      goto cleanup;
-    }
+  if (cache_path != NULL
+      && (stream_interval > 0 || segment_len > 0 || symbol_bits > 0)) {
+    fprintf(
+        stderr,
+        "%s: warning: results are only cached in whole-capture and "
+        "bounded-memory modes\n",
+        argv[0]);
+    cache_path = NULL;
+  }
+
+  if (db == NULL
+      && ((db = lfsrdesc_db_new()) == NULL
+      || !lfsrdesc_db_load(db, POLY_DB_FILE, POLY_TEXT_FILE))) {
+    fprintf(stderr, "%s: cannot load polynomials\n", argv[0]);
+    exit(EXIT_FAILURE);
+  }
 
-    ALLOCATE_MANY(buffer, sbuf.st_size, uint8_t);
+  params.db = db;
 
-    if ((fp = fopen(argv[i], "rb")) == NULL) {
+  if (prior_file != NULL) {
+    if (!lfsrdesc_db_load_prior(db, prior_file)) {
       fprintf(
           stderr,
-          "%s: cannot open %s: %s\n",
+          "%s: cannot load prior from %s: %s\n",
           argv[0],
-          argv[1],
+          prior_file,
           strerror(errno));
-      goto cleanup;
+      exit(EXIT_FAILURE);
     }
 
-    p = 0;
-    while (fread(&c, 1, 1, fp) == 1)
-      if (c == '0' || c == '1')
-        buffer[p++] = c - '0';
-
-    if ((corr = correlator_new(buffer, p)) == NULL) {
-      fprintf(stderr, "%s: cannot correlate %d bytes\n", argv[0], p);
-      goto cleanup;
-    }
+    lfsrdesc_db_sort_by_prior(db);
+  }
 
-    TRY(correlator_run(corr));
+  if (sweep != NULL && !parse_sweep(&params, sweep))
+    exit(EXIT_FAILURE);
 
-    /* Everything went alright */
-    TRY(correlator_walk_candidates(corr, on_candidate, NULL));
+  if (listen_path != NULL)
+    exit(lfsr_serve(argv[0], listen_path, db, &params)
+        ? EXIT_SUCCESS
+        : EXIT_FAILURE);
 
-    ++files;
+  if (resident != NULL)
+    params.spectra = resident->spectra;
 
-cleanup:
-    if (corr != NULL) {
-      correlator_destroy(corr);
-      corr = NULL;
-    }
+  if (stream_interval > 0)
+    exit(analyze_stream(argv[0], input_format, &params, stream_interval)
+        ? EXIT_SUCCESS
+        : EXIT_FAILURE);
 
-    if (fp != NULL) {
-      fclose(fp);
-      fp = NULL;
-    }
-
-    if (buffer != NULL) {
-      free(buffer);
-      buffer = NULL;
-    }
+  if (dump_top > 0 && (dumper = dumper_new(output_format)) == NULL) {
+    fprintf(stderr, "%s: cannot start background writer\n", argv[0]);
+    exit(EXIT_FAILURE);
   }
 
-  for (i = 0; i < hit_count; ++i) {
-    if (files == 1 || hit_list[i]->hits > 1) {
-      TRY(poly = lfsrdesc_get_poly(hit_list[i]->desc));
-      printf("%3d/%d hits: %s\n", hit_list[i]->hits, files, poly);
-      free(poly);
-      for (j = 0; j < hit_list[i]->params_hit_count; ++j)
-        printf(
-            "      Offset %4d with %3d hits\n",
-            hit_list[i]->params_hit_list[j]->offset,
-            hit_list[i]->params_hit_list[j]->hits);
+  session_params.name = argv[0];
+  session_params.correlator = params;
+  session_params.segment_len = segment_len;
+  session_params.memory_budget = memory_budget;
+  session_params.input_format = input_format;
+  session_params.output_format = output_format;
+  session_params.threads = threads;
+  session_params.top = top;
+  session_params.symbol_bits = symbol_bits;
+  session_params.sync = sync;
+  session_params.sync_count = sync_count;
+  session_params.dumper = dumper;
+  session_params.dump_top = dump_top;
+  session_params.cache_path = cache_path;
+  session_params.sharded = partial_path != NULL;
+  session_params.on_segments = on_segments;
+  session_params.on_symbol_map = on_symbol_map;
+
+  TRY(session = lfsr_session_new(&session_params));
+
+  if (merge) {
+    TRY((files = lfsr_session_merge(
+        session,
+        argv + optind,
+        argc - optind)) != -1);
+    TRY(lfsr_report(session, files, prior_file));
+    goto done;
+  }
 
-      putchar(10);
+  TRY((files = lfsr_session_analyze(
+      session,
+      argv + optind,
+      argc - optind)) != -1);
 
+  if (partial_path != NULL) {
+    if (!lfsr_session_save_partial(session, partial_path)) {
+      fprintf(
+          stderr,
+          "%s: cannot write partial result %s: %s\n",
+          argv[0],
+          partial_path,
+          strerror(errno));
+      goto fail;
     }
 
+    printf(
+        "\033[1mPARTIAL RESULT OF %d FILES WRITTEN TO %s\033[0m\n",
+        files,
+        partial_path);
 
-    if (max_hits < hit_list[i]->max_offset_hits) {
-      best_hit = hit_list[i];
-      max_hits = hit_list[i]->max_offset_hits;
-    }
+    goto done;
   }
 
-  if (best_hit != NULL) {
-    TRY(poly = lfsrdesc_get_poly(best_hit->desc));
-    printf(
-        "\033[1mBEST MATCH: [%s] WITH %d/%d HITS\033[0m\n",
-        poly,
-        best_hit->hits,
-        files);
-    free(poly);
-
-    for (i = 0; i < best_hit->params_hit_count; ++i)
-      if (best_hit->params_hit_list[i]->hits == max_hits)
-        best_offset = best_hit->params_hit_list[i]->offset;
+  /* Wait for pending dumps */
+  if (dumper != NULL && dumper_destroy(dumper) > 0)
+    fprintf(stderr, "%s: some candidate dumps could not be written\n", argv[0]);
+  dumper = NULL;
 
-    printf(
-        "\033[1mBEST OFFSET: %d WITH %d/%d HITS\033[0m\n",
-        best_offset,
-        max_hits,
-        best_hit->hits);
+  TRY(lfsr_report(session, files, prior_file));
 
-    files = 0;
+done:
+  lfsr_session_destroy(session);
 
-    for (i = 1; i < argc; ++i)
-      if (lfsr_hit_descramble_file(
-        best_hit,
-        argv[i],
-        i,
-        best_offset))
-        ++files;
+  if (dumper != NULL)
+    dumper_destroy(dumper);
 
-    printf(
-        "\033[1mDESCRAMBLED %d FILES UNDER %s\033[0m\n",
-        files,
-        OUTPUT_DIRECTORY);
-  } else {
-    printf("%s: no candidate polynomials found. Shame :(\n", argv[0]);
-  }
+  /* Runs of a server leave its database alone */
+  if (resident == NULL)
+    lfsrdesc_db_destroy(db);
 
   return 0;
 
@@ -376,3 +1019,8 @@ fail:
   exit(EXIT_FAILURE);
 }
 
+int
+main(int argc, char *argv[], char *envp[])
+{
+  return lfsr_main(argc, argv, NULL);
+}
@@ -0,0 +1,70 @@
+/*
+
+  mkpolydb.c: Compile the polynomial database
+  Copyright (C) 2016 Gonzalo José Carracedo Carballal
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program.  If not, see
+  <http://www.gnu.org/licenses/>
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "polydb.h"
+
+int
+main(int argc, char *argv[])
+{
+  polydb_t *db;
+  uint64_t i, primitive = 0;
+
+  if (argc != 3) {
+    fprintf(stderr, "Usage:\n\t%s all-irredpoly.txt all-irredpoly.db\n", argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  if (!polydb_compile(argv[1], argv[2])) {
+    fprintf(
+        stderr,
+        "%s: cannot compile %s into %s: %s\n",
+        argv[0],
+        argv[1],
+        argv[2],
+        strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+
+  if ((db = polydb_new(argv[2])) == NULL) {
+    fprintf(stderr, "%s: cannot read back %s: %s\n", argv[0], argv[2], strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+
+  for (i = 0; i < db->count; ++i)
+    if (polydb_is_primitive(db, i))
+      ++primitive;
+
+  printf(
+      "%s: %" PRIu64 " polynomials (%" PRIu64 " primitive)\n",
+      argv[2],
+      db->count,
+      primitive);
+
+  polydb_destroy(db);
+
+  return 0;
+}
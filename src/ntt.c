@@ -0,0 +1,261 @@
+/*
+
+  ntt.c: Number-theoretic transform for exact integer correlation
+  Copyright (C) 2016 Gonzalo José Carracedo Carballal
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program.  If not, see
+  <http://www.gnu.org/licenses/>
+
+*/
+
+#include "ntt.h"
+
+#ifdef __AVX2__
+#  include <immintrin.h>
+#endif /* __AVX2__ */
+
+/* Montgomery form of 1, i.e. 2^32 mod p */
+#define NTT_MONT_ONE ((uint32_t) ((1ull << 32) % NTT_MODULUS))
+
+static inline uint32_t
+ntt_add(uint32_t a, uint32_t b)
+{
+  uint32_t s = a + b;
+
+  return s >= NTT_MODULUS ? s - NTT_MODULUS : s;
+}
+
+static inline uint32_t
+ntt_sub(uint32_t a, uint32_t b)
+{
+  return a >= b ? a - b : a + NTT_MODULUS - b;
+}
+
+static inline uint32_t
+ntt_to_mont(uint32_t a)
+{
+  return ((uint64_t) a << 32) % NTT_MODULUS;
+}
+
+/* Plain modular exponentiation, only used to build tables */
+static uint32_t
+ntt_pow(uint32_t base, uint64_t exp)
+{
+  uint64_t result = 1;
+  uint64_t b = base;
+
+  while (exp != 0) {
+    if (exp & 1)
+      result = result * b % NTT_MODULUS;
+    b = b * b % NTT_MODULUS;
+    exp >>= 1;
+  }
+
+  return result;
+}
+
+#ifdef __AVX2__
+/*
+ * Eight Montgomery products at once. mul_epu32 only multiplies the even
+ * 32-bit lanes, so odd lanes are shifted down and handled separately.
+ */
+static inline __m256i
+ntt_montmul8(__m256i a, __m256i b)
+{
+  const __m256i p = _mm256_set1_epi32(NTT_MODULUS);
+  const __m256i pinv = _mm256_set1_epi32(NTT_MODULUS_NEG_INV);
+  __m256i te, to, me, mo, r;
+
+  te = _mm256_mul_epu32(a, b);
+  to = _mm256_mul_epu32(_mm256_srli_epi64(a, 32), _mm256_srli_epi64(b, 32));
+
+  me = _mm256_mul_epu32(_mm256_mul_epu32(te, pinv), p);
+  mo = _mm256_mul_epu32(_mm256_mul_epu32(to, pinv), p);
+
+  te = _mm256_srli_epi64(_mm256_add_epi64(te, me), 32);
+  to = _mm256_add_epi64(to, mo);
+
+  r = _mm256_blend_epi32(te, to, 0xaa);
+
+  return _mm256_min_epu32(r, _mm256_sub_epi32(r, p));
+}
+
+static inline __m256i
+ntt_add8(__m256i a, __m256i b)
+{
+  const __m256i p = _mm256_set1_epi32(NTT_MODULUS);
+  __m256i s = _mm256_add_epi32(a, b);
+
+  return _mm256_min_epu32(s, _mm256_sub_epi32(s, p));
+}
+
+static inline __m256i
+ntt_sub8(__m256i a, __m256i b)
+{
+  const __m256i p = _mm256_set1_epi32(NTT_MODULUS);
+  __m256i d = _mm256_sub_epi32(a, b);
+
+  return _mm256_min_epu32(d, _mm256_add_epi32(d, p));
+}
+#endif /* __AVX2__ */
+
+void
+ntt_destroy(ntt_t *self)
+{
+  if (self->twiddle != NULL)
+    free(self->twiddle);
+
+  if (self->twiddle_inv != NULL)
+    free(self->twiddle_inv);
+
+  free(self);
+}
+
+ntt_t *
+ntt_new(size_t min_size)
+{
+  ntt_t *new = NULL;
+  size_t h, j;
+  uint32_t w, w_inv, x, x_inv;
+
+  ALLOCATE(new, ntt_t);
+
+  while (((size_t) 1 << new->log2) < min_size)
+    ++new->log2;
+
+  TRY_EXCEPT(
+      new->log2 <= NTT_MAX_LOG2,
+      ERROR("NTT size 2^%d too big (max 2^%d)\n", new->log2, NTT_MAX_LOG2));
+
+  new->size = (size_t) 1 << new->log2;
+
+  /* Stage with half-length h uses h roots of order 2h, at [h, 2h) */
+  ALLOCATE_MANY(new->twiddle, MAX(new->size, 2), uint32_t);
+  ALLOCATE_MANY(new->twiddle_inv, MAX(new->size, 2), uint32_t);
+
+  for (h = 1; h < new->size; h <<= 1) {
+    w = ntt_pow(NTT_GENERATOR, (NTT_MODULUS - 1) / (2 * h));
+    w_inv = ntt_pow(w, NTT_MODULUS - 2);
+    x = x_inv = 1;
+
+    for (j = 0; j < h; ++j) {
+      new->twiddle[h + j] = ntt_to_mont(x);
+      new->twiddle_inv[h + j] = ntt_to_mont(x_inv);
+      x = (uint64_t) x * w % NTT_MODULUS;
+      x_inv = (uint64_t) x_inv * w_inv % NTT_MODULUS;
+    }
+  }
+
+  /* n^-1 * R^2: removes n and the R^-1 left by the pointwise product */
+  new->scale = ntt_to_mont(
+      ntt_to_mont(ntt_pow(new->size % NTT_MODULUS, NTT_MODULUS - 2)));
+
+  return new;
+
+fail:
+  if (new != NULL)
+    ntt_destroy(new);
+
+  return NULL;
+}
+
+/* Gentleman-Sande (decimation in frequency) */
+void
+ntt_forward(const ntt_t *self, uint32_t *data)
+{
+  size_t h, k, j;
+  const uint32_t *w;
+  uint32_t u, v;
+
+  for (h = self->size >> 1; h >= 1; h >>= 1) {
+    w = self->twiddle + h;
+
+    for (k = 0; k < self->size; k += 2 * h) {
+      j = 0;
+#ifdef __AVX2__
+      for (; j + 8 <= h; j += 8) {
+        __m256i a = _mm256_loadu_si256((const __m256i *) (data + k + j));
+        __m256i b = _mm256_loadu_si256((const __m256i *) (data + k + j + h));
+        __m256i t = _mm256_loadu_si256((const __m256i *) (w + j));
+
+        _mm256_storeu_si256((__m256i *) (data + k + j), ntt_add8(a, b));
+        _mm256_storeu_si256(
+            (__m256i *) (data + k + j + h),
+            ntt_montmul8(ntt_sub8(a, b), t));
+      }
+#endif /* __AVX2__ */
+      for (; j < h; ++j) {
+        u = data[k + j];
+        v = data[k + j + h];
+        data[k + j] = ntt_add(u, v);
+        data[k + j + h] = ntt_montmul(ntt_sub(u, v), w[j]);
+      }
+    }
+  }
+}
+
+void
+ntt_multiply(const ntt_t *self, uint32_t *data, const uint32_t *other)
+{
+  size_t i = 0;
+
+#ifdef __AVX2__
+  for (; i + 8 <= self->size; i += 8)
+    _mm256_storeu_si256(
+        (__m256i *) (data + i),
+        ntt_montmul8(
+            _mm256_loadu_si256((const __m256i *) (data + i)),
+            _mm256_loadu_si256((const __m256i *) (other + i))));
+#endif /* __AVX2__ */
+
+  for (; i < self->size; ++i)
+    data[i] = ntt_montmul(data[i], other[i]);
+}
+
+/* Cooley-Tukey (decimation in time) */
+void
+ntt_inverse(const ntt_t *self, uint32_t *data)
+{
+  size_t h, k, j;
+  const uint32_t *w;
+  uint32_t u, v;
+
+  for (h = 1; h < self->size; h <<= 1) {
+    w = self->twiddle_inv + h;
+
+    for (k = 0; k < self->size; k += 2 * h) {
+      j = 0;
+#ifdef __AVX2__
+      for (; j + 8 <= h; j += 8) {
+        __m256i a = _mm256_loadu_si256((const __m256i *) (data + k + j));
+        __m256i b = ntt_montmul8(
+            _mm256_loadu_si256((const __m256i *) (data + k + j + h)),
+            _mm256_loadu_si256((const __m256i *) (w + j)));
+
+        _mm256_storeu_si256((__m256i *) (data + k + j), ntt_add8(a, b));
+        _mm256_storeu_si256((__m256i *) (data + k + j + h), ntt_sub8(a, b));
+      }
+#endif /* __AVX2__ */
+      for (; j < h; ++j) {
+        u = data[k + j];
+        v = ntt_montmul(data[k + j + h], w[j]);
+        data[k + j] = ntt_add(u, v);
+        data[k + j + h] = ntt_sub(u, v);
+      }
+    }
+  }
+
+  for (j = 0; j < self->size; ++j)
+    data[j] = ntt_montmul(data[j], self->scale);
+}
@@ -0,0 +1,78 @@
+/*
+
+  ntt.h: Number-theoretic transform for exact integer correlation
+  Copyright (C) 2016 Gonzalo José Carracedo Carballal
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program.  If not, see
+  <http://www.gnu.org/licenses/>
+
+*/
+
+#ifndef _NTT_H
+#define _NTT_H
+
+#include "types.h"
+
+/*
+ * Arithmetic modulo p = 15 * 2^27 + 1, which fits in 31 bits and has
+ * roots of unity of any power-of-two order up to 2^27. Products are
+ * computed in Montgomery form (R = 2^32), which only needs 32x32->64
+ * multiplications and therefore vectorizes well.
+ */
+#define NTT_MODULUS         2013265921u
+#define NTT_MODULUS_NEG_INV 2013265919u /* -p^-1 mod 2^32 */
+#define NTT_GENERATOR       31u
+#define NTT_MAX_LOG2        27
+
+struct ntt {
+  unsigned int log2;
+  size_t size;
+  uint32_t *twiddle;     /* Forward roots, Montgomery form, per stage */
+  uint32_t *twiddle_inv; /* Inverse roots, Montgomery form, per stage */
+  uint32_t scale;        /* Undoes 1/size and pointwise Montgomery factor */
+};
+
+typedef struct ntt ntt_t;
+
+static inline uint32_t
+ntt_montmul(uint32_t a, uint32_t b)
+{
+  uint64_t t = (uint64_t) a * b;
+  uint32_t m = (uint32_t) t * NTT_MODULUS_NEG_INV;
+  uint32_t u = (t + (uint64_t) m * NTT_MODULUS) >> 32;
+
+  return u >= NTT_MODULUS ? u - NTT_MODULUS : u;
+}
+
+static inline size_t
+ntt_get_size(const ntt_t *self)
+{
+  return self->size;
+}
+
+/* Transform size is the smallest power of two >= min_size */
+ntt_t *ntt_new(size_t min_size);
+
+/* Natural order in, bit-reversed order out */
+void ntt_forward(const ntt_t *self, uint32_t *data);
+
+/* data[i] = data[i] * other[i], both in transformed (bit-reversed) order */
+void ntt_multiply(const ntt_t *self, uint32_t *data, const uint32_t *other);
+
+/* Bit-reversed order in, natural order out. Exact after ntt_multiply */
+void ntt_inverse(const ntt_t *self, uint32_t *data);
+
+void ntt_destroy(ntt_t *self);
+
+#endif /* _NTT_H */
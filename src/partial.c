@@ -0,0 +1,143 @@
+/*
+
+  partial.c: Partial results of sharded runs
+  Copyright (C) 2016 Gonzalo José Carracedo Carballal
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program.  If not, see
+  <http://www.gnu.org/licenses/>
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "partial.h"
+
+BOOL
+partial_save(
+    const char *path,
+    const struct partial_header *header,
+    struct cache_record *const *records,
+    unsigned int count)
+{
+  struct partial_header out = *header;
+  char *tmp_path = NULL;
+  FILE *fp = NULL;
+  unsigned int i;
+  BOOL ok = FALSE;
+
+  memcpy(out.magic, PARTIAL_MAGIC, sizeof(out.magic));
+  out.version = PARTIAL_VERSION;
+  out.byte_order = PARTIAL_BYTE_ORDER;
+  out.count = 0;
+
+  for (i = 0; i < count; ++i)
+    if (records[i] != NULL)
+      ++out.count;
+
+  /* Mergers polling a shared directory never see half a partial */
+  TRY(tmp_path = strbuild("%s.tmp", path));
+  TRY(fp = fopen(tmp_path, "wb"));
+
+  TRY(fwrite(&out, sizeof(struct partial_header), 1, fp) == 1);
+
+  for (i = 0; i < count; ++i)
+    if (records[i] != NULL)
+      TRY(cache_record_write(records[i], fp));
+
+  TRY(fclose(fp) == 0);
+  fp = NULL;
+
+  TRY(rename(tmp_path, path) == 0);
+
+  ok = TRUE;
+
+fail:
+  if (fp != NULL)
+    fclose(fp);
+
+  if (!ok && tmp_path != NULL)
+    unlink(tmp_path);
+
+  if (tmp_path != NULL)
+    free(tmp_path);
+
+  return ok;
+}
+
+void
+partial_destroy(partial_t *self)
+{
+  unsigned int i;
+
+  for (i = 0; i < self->record_count; ++i)
+    if (self->record_list[i] != NULL)
+      cache_record_destroy(self->record_list[i]);
+
+  if (self->record_list != NULL)
+    free(self->record_list);
+
+  free(self);
+}
+
+partial_t *
+partial_new(const char *path)
+{
+  partial_t *new = NULL;
+  struct cache_record *record = NULL;
+  FILE *fp = NULL;
+  uint64_t i;
+  int saved_errno;
+
+  ALLOCATE(new, partial_t);
+
+  TRY(fp = fopen(path, "rb"));
+
+  if (fread(&new->header, sizeof(struct partial_header), 1, fp) != 1
+      || memcmp(new->header.magic, PARTIAL_MAGIC, sizeof(new->header.magic)) != 0
+      || new->header.version != PARTIAL_VERSION
+      || new->header.byte_order != PARTIAL_BYTE_ORDER) {
+    errno = EINVAL;
+    goto fail;
+  }
+
+  for (i = 0; i < new->header.count; ++i) {
+    TRY(record = cache_record_read(fp));
+    TRY(PTR_LIST_APPEND_CHECK(new->record, record) != -1);
+    record = NULL;
+  }
+
+  fclose(fp);
+
+  return new;
+
+fail:
+  saved_errno = errno;
+
+  if (record != NULL)
+    cache_record_destroy(record);
+
+  if (fp != NULL)
+    fclose(fp);
+
+  if (new != NULL)
+    partial_destroy(new);
+
+  errno = saved_errno;
+
+  return NULL;
+}
@@ -0,0 +1,78 @@
+/*
+
+  partial.h: Partial results of sharded runs
+  Copyright (C) 2016 Gonzalo José Carracedo Carballal
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program.  If not, see
+  <http://www.gnu.org/licenses/>
+
+*/
+
+#ifndef _PARTIAL_H
+#define _PARTIAL_H
+
+#include "cache.h"
+
+#define PARTIAL_MAGIC      "LFSRPRT1"
+#define PARTIAL_VERSION    1
+#define PARTIAL_BYTE_ORDER 0x01020304
+
+/*
+ * On-disk layout, in host byte order: this header, then `count' records
+ * in the layout of the result cache, one per input file in command line
+ * order. Every candidate registered by the sweep of a file is kept, with
+ * its output scored, so that merging can tell which ones a single run
+ * would have produced.
+ *
+ * Partials can only be merged if `config' (the settings) and `order' (the
+ * polynomials, in sweep order) match.
+ */
+struct partial_header {
+  char     magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  uint64_t config;
+  uint64_t order;
+  float    exit_sigma;
+  uint32_t variants;
+  uint32_t input_format;
+  uint32_t sync_count;
+  uint32_t sweep_from;
+  uint32_t sweep_to;
+  uint64_t count;
+};
+
+struct partial {
+  struct partial_header header;
+  PTR_LIST(struct cache_record, record);
+};
+
+typedef struct partial partial_t;
+
+/*
+ * Write a partial with the settings in `header' (magic, version, byte
+ * order and count are filled in). NULL records are skipped.
+ */
+BOOL partial_save(
+    const char *path,
+    const struct partial_header *header,
+    struct cache_record *const *records,
+    unsigned int count);
+
+void partial_destroy(partial_t *self);
+
+/* On failure, errno tells why */
+partial_t *partial_new(const char *path);
+
+#endif /* _PARTIAL_H */
@@ -0,0 +1,342 @@
+/*
+
+  polydb.c: Precompiled polynomial database
+  Copyright (C) 2016 Gonzalo José Carracedo Carballal
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program.  If not, see
+  <http://www.gnu.org/licenses/>
+
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "lfsr.h"
+#include "polydb.h"
+
+struct polydb_entry {
+  uint64_t mask;
+  uint64_t cycle_len;
+  uint8_t degree;
+  uint8_t flags;
+};
+
+void
+polydb_destroy(polydb_t *self)
+{
+  if (self->map != NULL)
+    munmap(self->map, self->size);
+
+  free(self);
+}
+
+static BOOL
+polydb_check_array(const polydb_t *self, uint64_t offset, size_t size)
+{
+  return offset % 8 == 0
+      && offset <= self->size
+      && self->count <= (self->size - offset) / size;
+}
+
+polydb_t *
+polydb_new(const char *path)
+{
+  polydb_t *new = NULL;
+  const struct polydb_header *header;
+  struct stat sbuf;
+  int fd = -1;
+  int saved_errno;
+
+  ALLOCATE(new, polydb_t);
+
+  TRY((fd = open(path, O_RDONLY)) != -1);
+  TRY(fstat(fd, &sbuf) != -1);
+
+  if (sbuf.st_size < sizeof(struct polydb_header)) {
+    errno = EINVAL;
+    goto fail;
+  }
+
+  new->size = sbuf.st_size;
+
+  TRY((new->map = mmap(
+      NULL,
+      new->size,
+      PROT_READ,
+      MAP_PRIVATE,
+      fd,
+      0)) != MAP_FAILED);
+
+  close(fd);
+  fd = -1;
+
+  header = (const struct polydb_header *) new->map;
+  new->count = header->count;
+
+  if (memcmp(header->magic, POLYDB_MAGIC, sizeof(header->magic)) != 0
+      || header->version != POLYDB_VERSION
+      || header->byte_order != POLYDB_BYTE_ORDER
+      || !polydb_check_array(new, header->masks_offset, sizeof(uint64_t))
+      || !polydb_check_array(new, header->cycle_lens_offset, sizeof(uint64_t))
+      || !polydb_check_array(new, header->degrees_offset, sizeof(uint8_t))
+      || !polydb_check_array(new, header->flags_offset, sizeof(uint8_t))) {
+    errno = EINVAL;
+    goto fail;
+  }
+
+  new->masks = (const uint64_t *)
+      ((const uint8_t *) new->map + header->masks_offset);
+  new->cycle_lens = (const uint64_t *)
+      ((const uint8_t *) new->map + header->cycle_lens_offset);
+  new->degrees = (const uint8_t *) new->map + header->degrees_offset;
+  new->flags = (const uint8_t *) new->map + header->flags_offset;
+
+  return new;
+
+fail:
+  saved_errno = errno;
+
+  if (fd != -1)
+    close(fd);
+
+  if (new != NULL) {
+    if (new->map == MAP_FAILED)
+      new->map = NULL;
+    polydb_destroy(new);
+  }
+
+  errno = saved_errno;
+
+  return NULL;
+}
+
+/*********************************** Compiler ********************************/
+
+/* a * b mod p, over GF(2), with p of the given degree */
+static uint64_t
+polydb_mulmod(uint64_t a, uint64_t b, uint64_t p, unsigned int degree)
+{
+  uint64_t top = 1ull << (degree - 1);
+  uint64_t low = p & ~(1ull << degree);
+  uint64_t r = 0;
+  int i;
+
+  for (i = degree - 1; i >= 0; --i) {
+    r = (r & top) ? ((r ^ top) << 1) ^ low : r << 1;
+    if (b & (1ull << i))
+      r ^= a;
+  }
+
+  return r;
+}
+
+/* x^e mod p */
+static uint64_t
+polydb_powmod_x(uint64_t e, uint64_t p, unsigned int degree)
+{
+  uint64_t base = polydb_mulmod(2, 1, p, degree);
+  uint64_t r = 1;
+
+  while (e > 0) {
+    if (e & 1)
+      r = polydb_mulmod(r, base, p, degree);
+    base = polydb_mulmod(base, base, p, degree);
+    e >>= 1;
+  }
+
+  return r;
+}
+
+/*
+ * Cycle length of an irreducible polynomial: the order of x, which
+ * divides 2^degree - 1. Strip prime factors while x^(order / q) = 1.
+ */
+static uint64_t
+polydb_order(uint64_t p, unsigned int degree)
+{
+  uint64_t full = (1ull << degree) - 1;
+  uint64_t order = full;
+  uint64_t m = full;
+  uint64_t q;
+
+  for (q = 3; q * q <= m; q += 2)
+    if (m % q == 0) {
+      while (m % q == 0)
+        m /= q;
+      while (order % q == 0 && polydb_powmod_x(order / q, p, degree) == 1)
+        order /= q;
+    }
+
+  if (m > 1)
+    while (order % m == 0 && polydb_powmod_x(order / m, p, degree) == 1)
+      order /= m;
+
+  return order;
+}
+
+static BOOL
+polydb_parse_taps(const char *p, struct polydb_entry *entry)
+{
+  char *end;
+  unsigned long tap;
+
+  entry->mask = 0;
+  entry->degree = 0;
+
+  for (;;) {
+    tap = strtoul(p, &end, 10);
+    if (end == p || tap >= LFSR_MAX_TAPS)
+      return FALSE;
+
+    entry->mask |= 1ull << tap;
+    if (entry->degree < tap)
+      entry->degree = tap;
+
+    for (p = end; isspace(*p); ++p);
+
+    if (*p == '\0')
+      break;
+    else if (*p++ != ',')
+      return FALSE;
+  }
+
+  return entry->degree > 0;
+}
+
+static BOOL
+polydb_write_padding(FILE *fp, uint64_t *pos)
+{
+  static const uint8_t zero[8];
+  size_t pad = (8 - *pos % 8) % 8;
+
+  *pos += pad;
+
+  return pad == 0 || fwrite(zero, pad, 1, fp) == 1;
+}
+
+BOOL
+polydb_compile(const char *text_path, const char *db_path)
+{
+  FILE *in = NULL, *out = NULL;
+  struct polydb_entry *entries = NULL, *tmp;
+  struct polydb_header header;
+  char *line = NULL, *p;
+  size_t line_alloc = 0;
+  uint64_t count = 0, alloc = 0, i, pos;
+  unsigned int lineno = 0;
+  BOOL primitive = TRUE;
+  BOOL ok = FALSE;
+
+  TRY(in = fopen(text_path, "r"));
+
+  /* Same rules as lfsrdesc_load_from_file, but non-primitive are kept */
+  while (getline(&line, &line_alloc, in) != -1) {
+    ++lineno;
+
+    for (p = line; isspace(*p); ++p);
+
+    if (*p == '\0') {
+      primitive = TRUE;
+    } else if (strstr(p, "non-primitive") != NULL) {
+      primitive = FALSE;
+    } else if (*line != '#') {
+      if (count == alloc) {
+        alloc = alloc == 0 ? 1024 : 2 * alloc;
+        TRY(tmp = realloc(entries, alloc * sizeof(struct polydb_entry)));
+        entries = tmp;
+      }
+
+      if (!polydb_parse_taps(p, entries + count)) {
+        ERROR("%s:%u: invalid polynomial\n", text_path, lineno);
+        goto fail;
+      }
+
+      entries[count].flags = primitive ? POLYDB_PRIMITIVE : 0;
+
+      if (primitive)
+        entries[count].cycle_len = (1ull << entries[count].degree) - 1;
+      else if (entries[count].degree <= POLYDB_MAX_ORDER_DEGREE)
+        entries[count].cycle_len = polydb_order(
+            entries[count].mask,
+            entries[count].degree);
+      else
+        entries[count].cycle_len = 0;
+
+      ++count;
+    }
+  }
+
+  memset(&header, 0, sizeof(struct polydb_header));
+  memcpy(header.magic, POLYDB_MAGIC, sizeof(header.magic));
+  header.version = POLYDB_VERSION;
+  header.byte_order = POLYDB_BYTE_ORDER;
+  header.count = count;
+
+  pos = sizeof(struct polydb_header);
+  header.masks_offset = pos;
+  pos += count * sizeof(uint64_t);
+  header.cycle_lens_offset = pos;
+  pos += count * sizeof(uint64_t);
+  header.degrees_offset = pos;
+  pos += count;
+  header.flags_offset = __ALIGN(pos, 8);
+
+  TRY(out = fopen(db_path, "wb"));
+  TRY(fwrite(&header, sizeof(struct polydb_header), 1, out) == 1);
+
+  for (i = 0; i < count; ++i)
+    TRY(fwrite(&entries[i].mask, sizeof(uint64_t), 1, out) == 1);
+
+  for (i = 0; i < count; ++i)
+    TRY(fwrite(&entries[i].cycle_len, sizeof(uint64_t), 1, out) == 1);
+
+  for (i = 0; i < count; ++i)
+    TRY(fputc(entries[i].degree, out) != EOF);
+
+  pos = header.degrees_offset + count;
+  TRY(polydb_write_padding(out, &pos));
+
+  for (i = 0; i < count; ++i)
+    TRY(fputc(entries[i].flags, out) != EOF);
+
+  TRY(fclose(out) == 0);
+  out = NULL;
+
+  ok = TRUE;
+
+fail:
+  if (out != NULL) {
+    fclose(out);
+    unlink(db_path);
+  }
+
+  if (in != NULL)
+    fclose(in);
+
+  if (line != NULL)
+    free(line);
+
+  if (entries != NULL)
+    free(entries);
+
+  return ok;
+}
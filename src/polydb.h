@@ -0,0 +1,82 @@
+/*
+
+  polydb.h: Precompiled polynomial database
+  Copyright (C) 2016 Gonzalo José Carracedo Carballal
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program.  If not, see
+  <http://www.gnu.org/licenses/>
+
+*/
+
+#ifndef _POLYDB_H
+#define _POLYDB_H
+
+#include <stdint.h>
+
+#include "types.h"
+
+#define POLYDB_MAGIC      "LFSRPDB1"
+#define POLYDB_VERSION    2
+#define POLYDB_BYTE_ORDER 0x01020304
+
+/* Flags */
+#define POLYDB_PRIMITIVE  1
+
+/* Cycle lengths of non-primitive polynomials above this are not computed */
+#define POLYDB_MAX_ORDER_DEGREE 40
+
+/*
+ * On-disk layout, in host byte order: this header, then one array per
+ * field (masks, cycle lengths, degrees, flags), each of them `count'
+ * entries long and starting at an 8-byte aligned offset. Polynomials keep
+ * the order of the text file, so that sweep positions, shard ranges and
+ * prior ties mean the same whichever of the two is loaded.
+ */
+struct polydb_header {
+  char     magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  uint64_t count;
+  uint64_t masks_offset;
+  uint64_t cycle_lens_offset;
+  uint64_t degrees_offset;
+  uint64_t flags_offset;
+};
+
+struct polydb {
+  void *map;
+  size_t size;
+
+  uint64_t count;
+  const uint64_t *masks;      /* Feedback masks, bit 0 included */
+  const uint64_t *cycle_lens; /* 0 if unknown */
+  const uint8_t  *degrees;
+  const uint8_t  *flags;
+};
+
+typedef struct polydb polydb_t;
+
+static inline BOOL
+polydb_is_primitive(const polydb_t *self, uint64_t i)
+{
+  return (self->flags[i] & POLYDB_PRIMITIVE) != 0;
+}
+
+polydb_t *polydb_new(const char *path);
+void polydb_destroy(polydb_t *self);
+
+/* Convert the text database (as in all-irredpoly.txt) */
+BOOL polydb_compile(const char *text_path, const char *db_path);
+
+#endif /* _POLYDB_H */
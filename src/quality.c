@@ -0,0 +1,295 @@
+/*
+
+  quality.c: Statistics of descrambled candidates
+  Copyright (C) 2016 Gonzalo José Carracedo Carballal
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program.  If not, see
+  <http://www.gnu.org/licenses/>
+
+*/
+
+#include <string.h>
+#include <math.h>
+
+#include "quality.h"
+
+#ifdef __AVX2__
+#  include <immintrin.h>
+
+/* Per-byte popcount of 32 bytes, with the nibble lookup trick */
+static inline __m256i
+quality_popcount_bytes(__m256i v)
+{
+  const __m256i lut = _mm256_setr_epi8(
+      0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+      0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+  const __m256i low = _mm256_set1_epi8(0x0f);
+
+  return _mm256_add_epi8(
+      _mm256_shuffle_epi8(lut, _mm256_and_si256(v, low)),
+      _mm256_shuffle_epi8(lut, _mm256_and_si256(_mm256_srli_epi16(v, 4), low)));
+}
+
+static inline uint64_t
+quality_sum_epi64(__m256i v)
+{
+  return _mm256_extract_epi64(v, 0) + _mm256_extract_epi64(v, 1)
+      + _mm256_extract_epi64(v, 2) + _mm256_extract_epi64(v, 3);
+}
+#endif /* __AVX2__ */
+
+/* Transitions between bit i and i + 1 of the stream, for bits of `w' */
+static inline uint64_t
+quality_transitions(uint64_t w, uint64_t next)
+{
+  return w ^ ((w >> 1) | (next << 63));
+}
+
+/* Ones and transitions of `count' words, the last transition excluded */
+static void
+quality_count_bits(
+    const uint64_t *words,
+    size_t count,
+    uint64_t *ones,
+    uint64_t *flips)
+{
+  size_t i = 0;
+  uint64_t o = 0, f = 0;
+
+#ifdef __AVX2__
+  const __m256i zero = _mm256_setzero_si256();
+  __m256i acc_o = zero, acc_f = zero;
+  __m256i w, next;
+
+  /* One more word is read ahead for the transitions */
+  for (; i + 4 < count; i += 4) {
+    w = _mm256_loadu_si256((const __m256i *) (words + i));
+    next = _mm256_loadu_si256((const __m256i *) (words + i + 1));
+
+    acc_o = _mm256_add_epi64(
+        acc_o,
+        _mm256_sad_epu8(quality_popcount_bytes(w), zero));
+    acc_f = _mm256_add_epi64(
+        acc_f,
+        _mm256_sad_epu8(
+            quality_popcount_bytes(
+                _mm256_xor_si256(
+                    w,
+                    _mm256_or_si256(
+                        _mm256_srli_epi64(w, 1),
+                        _mm256_slli_epi64(next, 63)))),
+            zero));
+  }
+
+  o = quality_sum_epi64(acc_o);
+  f = quality_sum_epi64(acc_f);
+#endif /* __AVX2__ */
+
+  for (; i < count; ++i) {
+    o += popcount64(words[i]);
+    if (i + 1 < count)
+      f += popcount64(quality_transitions(words[i], words[i + 1]));
+    else
+      f += popcount64(quality_transitions(words[i], 0) & ~(1ull << 63));
+  }
+
+  *ones = o;
+  *flips = f;
+}
+
+/* Whether `x' has `k' consecutive ones, in log2(k) steps */
+static inline BOOL
+quality_has_run(uint64_t x, unsigned int k)
+{
+  unsigned int len = 1, m;
+
+  while (len < k && x != 0) {
+    m = MIN(len, k - len);
+    x &= x >> m;
+    len += m;
+  }
+
+  return x != 0;
+}
+
+static unsigned int
+quality_word_longest_run(uint64_t w)
+{
+  unsigned int i, run = 1, best = 1;
+
+  for (i = 1; i < 64; ++i) {
+    if (((w >> i) & 1) == ((w >> (i - 1)) & 1)) {
+      if (++run > best)
+        best = run;
+    } else {
+      run = 1;
+    }
+  }
+
+  return best;
+}
+
+/*
+ * Runs crossing word boundaries are carried along. Inside a word, runs
+ * are only looked at bit by bit if they may beat the longest one so far,
+ * which on random-looking data soon stops happening.
+ */
+static uint64_t
+quality_longest_run(const uint64_t *words, uint64_t bits)
+{
+  size_t count = bits / CAPTURE_WORD_BITS;
+  uint64_t best = 0, cur = 0;
+  uint64_t w, eq;
+  unsigned int curbit = 0;
+  unsigned int i;
+  size_t j;
+
+  for (j = 0; j < count; ++j) {
+    w = words[j];
+    eq = curbit ? w : ~w;
+
+    if (eq == ~0ull) {
+      cur += 64;
+      continue;
+    }
+
+    cur += __builtin_ctzll(~eq);
+    if (cur > best)
+      best = cur;
+
+    if (best < 64 && (quality_has_run(w, best + 1)
+        || quality_has_run(~w, best + 1)))
+      best = MAX(best, quality_word_longest_run(w));
+
+    curbit = w >> 63;
+    w = curbit ? ~w : w;
+    cur = w == 0 ? 64 : __builtin_clzll(w);
+  }
+
+  for (i = 0; i < bits % CAPTURE_WORD_BITS; ++i) {
+    if (((words[count] >> i) & 1) == curbit) {
+      ++cur;
+    } else {
+      best = MAX(best, cur);
+      curbit = !curbit;
+      cur = 1;
+    }
+  }
+
+  return MAX(best, cur);
+}
+
+static float
+quality_entropy(const uint8_t *bytes, size_t len)
+{
+  /* Interleaved histograms, so that equal bytes don't stall each other */
+  uint32_t hist[4][256];
+  float entropy = 0, p;
+  uint32_t n;
+  size_t i;
+
+  memset(hist, 0, sizeof(hist));
+
+  for (i = 0; i + 4 <= len; i += 4) {
+    ++hist[0][bytes[i]];
+    ++hist[1][bytes[i + 1]];
+    ++hist[2][bytes[i + 2]];
+    ++hist[3][bytes[i + 3]];
+  }
+
+  for (; i < len; ++i)
+    ++hist[0][bytes[i]];
+
+  for (i = 0; i < 256; ++i)
+    if ((n = hist[0][i] + hist[1][i] + hist[2][i] + hist[3][i]) > 0) {
+      p = (float) n / len;
+      entropy -= p * log2f(p);
+    }
+
+  return entropy;
+}
+
+/* Bytes equal to the one `lag' positions back */
+static size_t
+quality_count_repeats(const uint8_t *bytes, size_t len, unsigned int lag)
+{
+  size_t i = lag, n = 0;
+
+#ifdef __AVX2__
+  for (; i + 32 <= len; i += 32)
+    n += __builtin_popcount(
+        _mm256_movemask_epi8(
+            _mm256_cmpeq_epi8(
+                _mm256_loadu_si256((const __m256i *) (bytes + i)),
+                _mm256_loadu_si256((const __m256i *) (bytes + i - lag)))));
+#endif /* __AVX2__ */
+
+  for (; i < len; ++i)
+    n += bytes[i] == bytes[i - lag];
+
+  return n;
+}
+
+void
+quality_measure(struct quality *q, const uint64_t *words, uint64_t bits)
+{
+  const uint8_t *bytes = (const uint8_t *) words;
+  size_t len = bits / 8;
+  float bias, flip_bias, structure, repetition, run_excess;
+  float rate;
+  unsigned int lag;
+
+  memset(q, 0, sizeof(struct quality));
+
+  if ((q->bits = bits) < 2)
+    return;
+
+  quality_count_bits(words, bits / CAPTURE_WORD_BITS, &q->ones, &q->flips);
+  q->longest_run = quality_longest_run(words, bits);
+
+  /* The tail word is counted by hand */
+  if (bits % CAPTURE_WORD_BITS != 0) {
+    uint64_t tail = words[bits / CAPTURE_WORD_BITS]
+        & ((1ull << (bits % CAPTURE_WORD_BITS)) - 1);
+
+    q->ones += popcount64(tail);
+    q->flips += popcount64(
+        quality_transitions(tail, 0)
+        & ((1ull << (bits % CAPTURE_WORD_BITS - 1)) - 1));
+    if (bits >= CAPTURE_WORD_BITS)
+      q->flips += (words[bits / CAPTURE_WORD_BITS - 1] >> 63) != (tail & 1);
+  }
+
+  if (len > 0)
+    q->entropy = quality_entropy(bytes, len);
+
+  for (lag = 1; lag <= QUALITY_MAX_LAG && lag < len; ++lag) {
+    rate = (float) quality_count_repeats(bytes, len, lag) / (len - lag);
+    if (rate > q->repetition) {
+      q->repetition = rate;
+      q->lag = lag;
+    }
+  }
+
+  /* Distance of each statistic to what random bits would give */
+  bias = fabsf(2.f * q->ones / bits - 1.f);
+  flip_bias = fabsf(2.f * q->flips / (bits - 1) - 1.f);
+  structure = len > 0 ? 1.f - q->entropy / 8.f : 0;
+  repetition = MAX(0.f, (q->repetition - 1.f / 256) / (1.f - 1.f / 256));
+  run_excess = MIN(
+      1.f,
+      MAX(0.f, (q->longest_run - log2f(bits)) / CAPTURE_WORD_BITS));
+
+  q->score = (bias + flip_bias + structure + repetition + run_excess) / 5;
+}
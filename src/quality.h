@@ -0,0 +1,50 @@
+/*
+
+  quality.h: Statistics of descrambled candidates
+  Copyright (C) 2016 Gonzalo José Carracedo Carballal
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program.  If not, see
+  <http://www.gnu.org/licenses/>
+
+*/
+
+#ifndef _QUALITY_H
+#define _QUALITY_H
+
+#include "capture.h"
+
+#define QUALITY_MAX_BITS (1 << 20) /* Prefix of the capture that is scored */
+#define QUALITY_MAX_LAG  8         /* Longest byte period looked for */
+
+/*
+ * A wrong polynomial leaves the output as random as the scrambled input,
+ * while the right one usually reveals some structure: bias, long runs,
+ * idle patterns, low entropy. The score sums how far each statistic is
+ * from what random data gives, so it grows with structure.
+ */
+struct quality {
+  uint64_t bits;
+  uint64_t ones;
+  uint64_t flips;       /* Bit transitions */
+  uint64_t longest_run; /* Of equal bits */
+  float entropy;        /* Bits per byte, 8 at most */
+  float repetition;     /* Fraction of bytes equal to the one `lag' back */
+  unsigned int lag;
+  float score;          /* Between 0 (random) and 1 */
+};
+
+/* Statistics of `bits' packed bits */
+void quality_measure(struct quality *q, const uint64_t *words, uint64_t bits);
+
+#endif /* _QUALITY_H */
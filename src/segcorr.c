@@ -0,0 +1,521 @@
+/*
+
+  segcorr.c: Segmented correlator, robust to bit slips and dropouts
+  Copyright (C) 2016 Gonzalo José Carracedo Carballal
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program.  If not, see
+  <http://www.gnu.org/licenses/>
+
+*/
+
+#include <complex.h>
+#include <math.h>
+
+#include "segcorr.h"
+
+#include <string.h>
+#include <pthread.h>
+
+struct segcorr_worker {
+  segcorr_t *owner;
+  unsigned int index;
+  pthread_t thread;
+  BOOL started;
+
+  fftwf_complex *fold_freq;
+  fftwf_complex *prod;
+  fftwf_complex *xcorr;
+};
+
+static void
+segcorr_period_destroy(struct segcorr_period *period)
+{
+  if (period->fft_plan != NULL)
+    correlator_plan_destroy(period->fft_plan);
+
+  if (period->fft_plan_inv != NULL)
+    correlator_plan_destroy(period->fft_plan_inv);
+
+  if (period->desc_index != NULL)
+    free(period->desc_index);
+
+  free(period);
+}
+
+void
+segcorr_destroy(segcorr_t *self)
+{
+  unsigned int i;
+
+  for (i = 0; i < self->period_count; ++i)
+    if (self->period_list[i] != NULL)
+      segcorr_period_destroy(self->period_list[i]);
+
+  if (self->period_list != NULL)
+    free(self->period_list);
+
+  if (self->seq_freq != NULL) {
+    for (i = 0; i < self->params.db->desc_count; ++i)
+      if (self->seq_freq[i] != NULL)
+        fftwf_free(self->seq_freq[i]);
+
+    free(self->seq_freq);
+  }
+
+  if (self->result != NULL)
+    free(self->result);
+
+  for (i = 0; i < self->segment_count; ++i)
+    if (self->segment_list[i] != NULL)
+      free(self->segment_list[i]);
+
+  if (self->segment_list != NULL)
+    free(self->segment_list);
+
+  for (i = 0; i < self->candidate_count; ++i)
+    if (self->candidate_list[i] != NULL)
+      free(self->candidate_list[i]);
+
+  if (self->candidate_list != NULL)
+    free(self->candidate_list);
+
+  free(self);
+}
+
+BOOL
+segcorr_walk_candidates(
+    segcorr_t *self,
+    BOOL (*callback) (const struct correlator_candidate *, void *),
+    void *private)
+{
+  unsigned int i;
+
+  for (i = 0; i < self->candidate_count; ++i)
+    if (!(callback) (self->candidate_list[i], private))
+      return FALSE;
+
+  return TRUE;
+}
+
+BOOL
+segcorr_walk_segments(
+    const segcorr_t *self,
+    BOOL (*callback) (const struct segcorr_segment *, void *),
+    void *private)
+{
+  unsigned int i;
+
+  for (i = 0; i < self->segment_count; ++i)
+    if (!(callback) (self->segment_list[i], private))
+      return FALSE;
+
+  return TRUE;
+}
+
+/* Correlate one block against every polynomial */
+static void
+segcorr_process_block(struct segcorr_worker *worker, unsigned int b)
+{
+  segcorr_t *self = worker->owner;
+  struct segcorr_period *period;
+  struct segcorr_block *result;
+  const fftwf_complex *seq_freq;
+  uint64_t start = (uint64_t) b * self->params.block_len;
+  uint64_t len = MIN(self->params.block_len, self->N - start);
+  uint64_t L, r, j;
+  unsigned int p, k;
+  float amp, K = 1.f / len;
+
+  for (p = 0; p < self->period_count; ++p) {
+    period = self->period_list[p];
+    L = period->period;
+
+    /* Last block may be too short for this period */
+    if (len < 2 * L)
+      continue;
+
+    memset(worker->fold_freq, 0, L * sizeof(fftwf_complex));
+
+    r = start % L;
+    for (j = 0; j < len; ++j) {
+      worker->fold_freq[r] += K * (2 * (int) self->data[start + j] - 1);
+      if (++r == L)
+        r = 0;
+    }
+
+    fftwf_execute_dft(period->fft_plan, worker->fold_freq, worker->fold_freq);
+
+    for (k = 0; k < period->desc_count; ++k) {
+      seq_freq = self->seq_freq[period->desc_index[k]];
+      result = self->result
+          + b * self->params.db->desc_count
+          + period->desc_index[k];
+
+      for (j = 0; j < L; ++j)
+        worker->prod[j] = seq_freq[j] * conj(worker->fold_freq[j]);
+
+      fftwf_execute_dft(period->fft_plan_inv, worker->prod, worker->xcorr);
+
+      result->amp = 0;
+      result->phase = 0;
+      for (j = 0; j < L; ++j) {
+        amp = creal(worker->xcorr[j] * conj(worker->xcorr[j]));
+        if (amp > result->amp) {
+          result->amp = amp;
+          result->phase = j;
+        }
+      }
+    }
+  }
+}
+
+static void *
+segcorr_worker_func(void *data)
+{
+  struct segcorr_worker *worker = (struct segcorr_worker *) data;
+  segcorr_t *self = worker->owner;
+  unsigned int b;
+
+  for (b = worker->index; b < self->block_count; b += self->params.threads)
+    segcorr_process_block(worker, b);
+
+  return NULL;
+}
+
+static BOOL
+segcorr_append_segment(
+    segcorr_t *self,
+    uint64_t start,
+    uint64_t end,
+    uint64_t phase)
+{
+  struct segcorr_segment *segment = NULL;
+
+  ALLOCATE(segment, struct segcorr_segment);
+
+  segment->start = start;
+  segment->end = end;
+  segment->phase = phase;
+
+  TRY(PTR_LIST_APPEND_CHECK(self->segment, segment) != -1);
+
+  return TRUE;
+
+fail:
+  if (segment != NULL)
+    free(segment);
+
+  return FALSE;
+}
+
+/* Merge consecutive blocks of the best polynomial sharing a phase */
+static BOOL
+segcorr_build_segments(segcorr_t *self, unsigned int best)
+{
+  const struct segcorr_block *block;
+  struct segcorr_segment *longest = NULL;
+  struct correlator_candidate *candidate = NULL;
+  uint64_t start = 0, end, phase, curr = 0;
+  unsigned int b, i;
+
+  for (b = 0; b < self->block_count; ++b) {
+    block = self->result + b * self->params.db->desc_count + best;
+    end = MIN((uint64_t) (b + 1) * self->params.block_len, self->N);
+
+    phase = sqrtf(block->amp * (end - (uint64_t) b * self->params.block_len))
+        >= SEGCORR_LOCK_SIGMA
+        ? block->phase
+        : SEGCORR_NO_LOCK;
+
+    if (b > 0 && phase != curr) {
+      TRY(segcorr_append_segment(
+          self,
+          start,
+          (uint64_t) b * self->params.block_len,
+          curr));
+      start = (uint64_t) b * self->params.block_len;
+    }
+
+    curr = phase;
+  }
+
+  if (self->block_count > 0)
+    TRY(segcorr_append_segment(self, start, self->N, curr));
+
+  for (i = 0; i < self->segment_count; ++i)
+    if (self->segment_list[i]->phase != SEGCORR_NO_LOCK
+        && (longest == NULL
+        || self->segment_list[i]->end - self->segment_list[i]->start
+        > longest->end - longest->start))
+      longest = self->segment_list[i];
+
+  /* The longest locked segment provides the phase to vote for */
+  if (longest != NULL) {
+    ALLOCATE(candidate, struct correlator_candidate);
+    candidate->desc = self->best;
+    candidate->offset = longest->phase;
+    candidate->phase = longest->phase;
+    TRY(PTR_LIST_APPEND_CHECK(self->candidate, candidate) != -1);
+    candidate = NULL;
+  }
+
+  return TRUE;
+
+fail:
+  if (candidate != NULL)
+    free(candidate);
+
+  return FALSE;
+}
+
+BOOL
+segcorr_run(segcorr_t *self)
+{
+  struct segcorr_worker *workers = NULL;
+  unsigned int i, b, t;
+  unsigned int best = 0;
+  float score;
+  char poly[LFSR_POLY_STRLEN];
+  const lfsrdesc_db_t *db = self->params.db;
+  BOOL ok = FALSE;
+
+  _DEBUG(
+      "Correlating %d blocks of %lu bits against %d polynomials (%d threads)\n",
+      self->block_count,
+      (unsigned long) self->params.block_len,
+      db->desc_count,
+      self->params.threads);
+
+  ALLOCATE_MANY(workers, self->params.threads, struct segcorr_worker);
+
+  for (t = 0; t < self->params.threads; ++t) {
+    workers[t].owner = self;
+    workers[t].index = t;
+    ALLOCATE_FFT(workers[t].fold_freq, self->max_period);
+    ALLOCATE_FFT(workers[t].prod, self->max_period);
+    ALLOCATE_FFT(workers[t].xcorr, self->max_period);
+  }
+
+  for (t = 0; t < self->params.threads; ++t) {
+    TRY(pthread_create(
+        &workers[t].thread,
+        NULL,
+        segcorr_worker_func,
+        workers + t) == 0);
+    workers[t].started = TRUE;
+  }
+
+  for (t = 0; t < self->params.threads; ++t) {
+    pthread_join(workers[t].thread, NULL);
+    workers[t].started = FALSE;
+  }
+
+  /* Rank polynomials by the sum of their block peaks */
+  self->best = NULL;
+  self->best_score = 0;
+
+  for (i = 0; i < db->desc_count; ++i) {
+    if (self->seq_freq[i] == NULL)
+      continue;
+
+    score = 0;
+    for (b = 0; b < self->block_count; ++b)
+      score += sqrtf(self->result[b * db->desc_count + i].amp);
+
+    if (score > self->best_score) {
+      self->best_score = score;
+      self->best = db->desc_list[i];
+      best = i;
+    }
+  }
+
+  if (self->best != NULL) {
+    lfsrdesc_format_poly(self->best, poly, sizeof(poly));
+    _DEBUG(
+        "Best polynomial: %s (mean block peak %6.2f%%)\n",
+        poly,
+        100.f * self->best_score / self->block_count);
+
+    TRY(segcorr_build_segments(self, best));
+  }
+
+  ok = TRUE;
+
+fail:
+  if (workers != NULL) {
+    for (t = 0; t < self->params.threads; ++t) {
+      if (workers[t].started)
+        pthread_join(workers[t].thread, NULL);
+
+      if (workers[t].fold_freq != NULL)
+        fftwf_free(workers[t].fold_freq);
+
+      if (workers[t].prod != NULL)
+        fftwf_free(workers[t].prod);
+
+      if (workers[t].xcorr != NULL)
+        fftwf_free(workers[t].xcorr);
+    }
+
+    free(workers);
+  }
+
+  return ok;
+}
+
+static struct segcorr_period *
+segcorr_lookup_period(const segcorr_t *self, uint64_t L)
+{
+  unsigned int i;
+
+  for (i = 0; i < self->period_count; ++i)
+    if (self->period_list[i]->period == L)
+      return self->period_list[i];
+
+  return NULL;
+}
+
+static struct segcorr_period *
+segcorr_period_new(uint64_t L, fftwf_complex *a, fftwf_complex *b)
+{
+  struct segcorr_period *new = NULL;
+
+  ALLOCATE(new, struct segcorr_period);
+
+  new->period = L;
+
+  TRY(new->fft_plan = correlator_plan_dft(L, a, a, FFTW_FORWARD, FFTW_ESTIMATE));
+  TRY(new->fft_plan_inv = correlator_plan_dft(
+      L,
+      a,
+      b,
+      FFTW_BACKWARD,
+      FFTW_ESTIMATE));
+
+  return new;
+
+fail:
+  if (new != NULL)
+    segcorr_period_destroy(new);
+
+  return NULL;
+}
+
+segcorr_t *
+segcorr_new(
+    const struct segcorr_params *params,
+    const uint8_t *data,
+    uint64_t N)
+{
+  segcorr_t *new = NULL;
+  struct segcorr_params defaults = segcorr_params_INITIALIZER;
+  struct segcorr_period *period = NULL;
+  const lfsrdesc_db_t *db;
+  fftwf_complex *a = NULL, *b = NULL;
+  uint8_t *seq = NULL;
+  uint64_t L, j;
+  unsigned int i;
+
+  if (params == NULL)
+    params = &defaults;
+
+  ALLOCATE(new, segcorr_t);
+
+  new->params = *params;
+  new->data = data;
+  new->N = N;
+
+  /* Every search runs against a database */
+  TRY(db = params->db);
+
+  if (new->params.threads == 0)
+    new->params.threads = 1;
+
+  if (new->params.block_len == 0 || new->params.block_len > N)
+    new->params.block_len = N;
+
+  new->block_count = __UNITS(N, new->params.block_len);
+
+  /* Only periods that fit at least twice in a block are observable */
+  for (i = 0; i < db->desc_count; ++i) {
+    L = lfsrdesc_get_cycle_len(db->desc_list[i]);
+    if (L > 0 && 2 * L <= new->params.block_len && L > new->max_period)
+      new->max_period = L;
+  }
+
+  TRY_EXCEPT(
+      new->max_period > 0,
+      ERROR("Blocks of %lu bits are too short for any polynomial\n",
+          (unsigned long) new->params.block_len));
+
+  ALLOCATE_FFT(a, new->max_period);
+  ALLOCATE_FFT(b, new->max_period);
+  ALLOCATE_MANY(seq, new->max_period, uint8_t);
+  ALLOCATE_MANY(new->seq_freq, db->desc_count, fftwf_complex *);
+  ALLOCATE_MANY(
+      new->result,
+      (size_t) new->block_count * db->desc_count,
+      struct segcorr_block);
+
+  /* Keystream spectra do not depend on the block: compute them once */
+  for (i = 0; i < db->desc_count; ++i) {
+    L = lfsrdesc_get_cycle_len(db->desc_list[i]);
+    if (L == 0 || 2 * L > new->params.block_len)
+      continue;
+
+    if ((period = segcorr_lookup_period(new, L)) == NULL) {
+      CONSTRUCT(period, segcorr_period, L, a, b);
+      TRY(PTR_LIST_APPEND_CHECK(new->period, period) != -1);
+      ALLOCATE_MANY(period->desc_index, db->desc_count, unsigned int);
+    }
+
+    period->desc_index[period->desc_count++] = i;
+    period = NULL;
+
+    ALLOCATE_FFT(new->seq_freq[i], L);
+
+    lfsrdesc_generate_into(db->desc_list[i], seq, L);
+    for (j = 0; j < L; ++j)
+      new->seq_freq[i][j] = 2.f / L * (seq[j] - .5);
+
+    fftwf_execute_dft(
+        segcorr_lookup_period(new, L)->fft_plan,
+        new->seq_freq[i],
+        new->seq_freq[i]);
+  }
+
+  fftwf_free(a);
+  fftwf_free(b);
+  free(seq);
+
+  return new;
+
+fail:
+  if (period != NULL)
+    segcorr_period_destroy(period);
+
+  if (a != NULL)
+    fftwf_free(a);
+
+  if (b != NULL)
+    fftwf_free(b);
+
+  if (seq != NULL)
+    free(seq);
+
+  if (new != NULL)
+    segcorr_destroy(new);
+
+  return NULL;
+}
@@ -0,0 +1,110 @@
+/*
+
+  segcorr.h: Segmented correlator, robust to bit slips and dropouts
+  Copyright (C) 2016 Gonzalo José Carracedo Carballal
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program.  If not, see
+  <http://www.gnu.org/licenses/>
+
+*/
+
+#ifndef _SEGCORR_H
+#define _SEGCORR_H
+
+#include "correlator.h"
+
+#define SEGCORR_DEFAULT_BLOCK_LEN 16384
+#define SEGCORR_LOCK_SIGMA        5.f /* Min block peak to trust its phase */
+#define SEGCORR_NO_LOCK           ((uint64_t) -1)
+
+/*
+ * The capture is split in fixed-size blocks that are correlated
+ * independently. Each block is folded modulo the cycle length (using
+ * absolute bit positions, so phases are comparable across blocks) and
+ * correlated against one keystream period with small FFTs. Polynomials
+ * are ranked by the sum of their per-block peaks, which does not smear
+ * when the phase jumps.
+ */
+struct segcorr_params {
+  size_t block_len;
+  unsigned int threads;
+  const lfsrdesc_db_t *db; /* Polynomials swept */
+};
+
+#define segcorr_params_INITIALIZER \
+{                                  \
+  SEGCORR_DEFAULT_BLOCK_LEN, /* block_len */ \
+  1,                         /* threads */   \
+  NULL,                      /* db */        \
+}
+
+struct segcorr_segment {
+  uint64_t start;   /* First bit */
+  uint64_t end;     /* One past the last bit */
+  uint64_t phase;   /* SEGCORR_NO_LOCK if the keystream was lost */
+};
+
+struct segcorr_period {
+  uint64_t period;
+  fftwf_plan fft_plan;      /* In-place forward, for block folds */
+  fftwf_plan fft_plan_inv;  /* Out-of-place inverse */
+  unsigned int *desc_index; /* Polynomials with this cycle length */
+  unsigned int desc_count;
+};
+
+struct segcorr_block {
+  float amp;        /* Peak power */
+  uint64_t phase;   /* Lag of the peak */
+};
+
+struct segcorr {
+  struct segcorr_params params;
+  const uint8_t *data; /* Borrowed, must outlive the correlator */
+  uint64_t N;
+
+  unsigned int block_count;
+  uint64_t max_period;
+
+  PTR_LIST(struct segcorr_period, period);
+  fftwf_complex **seq_freq;      /* Keystream spectrum, per polynomial */
+  struct segcorr_block *result;  /* block_count x desc_count */
+
+  lfsrdesc_t *best;
+  float best_score;              /* Sum of per-block peaks */
+  PTR_LIST(struct segcorr_segment, segment);
+  PTR_LIST(struct correlator_candidate, candidate);
+};
+
+typedef struct segcorr segcorr_t;
+
+void segcorr_destroy(segcorr_t *self);
+
+BOOL segcorr_run(segcorr_t *self);
+
+BOOL segcorr_walk_candidates(
+    segcorr_t *self,
+    BOOL (*callback) (const struct correlator_candidate *, void *),
+    void *private);
+
+BOOL segcorr_walk_segments(
+    const segcorr_t *self,
+    BOOL (*callback) (const struct segcorr_segment *, void *),
+    void *private);
+
+segcorr_t *segcorr_new(
+    const struct segcorr_params *params,
+    const uint8_t *data,
+    uint64_t N);
+
+#endif /* _SEGCORR_H */
@@ -0,0 +1,476 @@
+/*
+
+  server.c: Resident server on a Unix domain socket
+  Copyright (C) 2016 Gonzalo José Carracedo Carballal
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program.  If not, see
+  <http://www.gnu.org/licenses/>
+
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "server.h"
+
+static BOOL
+server_write_all(int fd, const void *data, size_t size)
+{
+  const uint8_t *p = (const uint8_t *) data;
+  ssize_t n;
+
+  while (size > 0) {
+    if ((n = write(fd, p, size)) == -1) {
+      if (errno == EINTR)
+        continue;
+      return FALSE;
+    }
+
+    p += n;
+    size -= n;
+  }
+
+  return TRUE;
+}
+
+/* FALSE on end of file too (errno is then 0) */
+static BOOL
+server_read_all(int fd, void *data, size_t size)
+{
+  uint8_t *p = (uint8_t *) data;
+  ssize_t n;
+
+  while (size > 0) {
+    if ((n = read(fd, p, size)) <= 0) {
+      if (n == -1 && errno == EINTR)
+        continue;
+      if (n == 0)
+        errno = 0;
+      return FALSE;
+    }
+
+    p += n;
+    size -= n;
+  }
+
+  return TRUE;
+}
+
+static BOOL
+server_get_address(const char *path, struct sockaddr_un *addr)
+{
+  if (strlen(path) >= sizeof(addr->sun_path)) {
+    errno = ENAMETOOLONG;
+    return FALSE;
+  }
+
+  memset(addr, 0, sizeof(struct sockaddr_un));
+  addr->sun_family = AF_UNIX;
+  strcpy(addr->sun_path, path);
+
+  return TRUE;
+}
+
+int
+server_connect(const char *path)
+{
+  struct sockaddr_un addr;
+  int fd = -1;
+  int saved_errno;
+
+  TRY(server_get_address(path, &addr));
+  TRY((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) != -1);
+
+  /* Not an exception: server_listen probes with this */
+  if (connect(fd, (struct sockaddr *) &addr, sizeof(struct sockaddr_un)) == -1)
+    goto fail;
+
+  return fd;
+
+fail:
+  saved_errno = errno;
+
+  if (fd != -1)
+    close(fd);
+
+  errno = saved_errno;
+
+  return -1;
+}
+
+int
+server_listen(const char *path)
+{
+  struct sockaddr_un addr;
+  struct stat sbuf;
+  int fd = -1;
+  int saved_errno;
+
+  TRY(server_get_address(path, &addr));
+
+  /* A socket nobody answers on is left over from a server that died */
+  if ((fd = server_connect(path)) != -1) {
+    close(fd);
+    fd = -1;
+    errno = EADDRINUSE;
+    goto fail;
+  }
+
+  if (lstat(path, &sbuf) == 0 && S_ISSOCK(sbuf.st_mode))
+    unlink(path);
+
+  TRY((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) != -1);
+  TRY(bind(fd, (struct sockaddr *) &addr, sizeof(struct sockaddr_un)) != -1);
+  TRY(listen(fd, SERVER_BACKLOG) != -1);
+
+  return fd;
+
+fail:
+  saved_errno = errno;
+
+  if (fd != -1)
+    close(fd);
+
+  errno = saved_errno;
+
+  return -1;
+}
+
+BOOL
+server_send_request(int fd, int argc, char **argv)
+{
+  struct server_request_header header;
+  union {
+    struct cmsghdr align;
+    char buf[CMSG_SPACE(SERVER_FD_COUNT * sizeof(int))];
+  } control;
+  int fds[SERVER_FD_COUNT] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+  struct msghdr msg;
+  struct cmsghdr *cmsg;
+  struct iovec iov;
+  char *cwd = NULL;
+  char *strings = NULL;
+  size_t size, len;
+  int i;
+  BOOL ok = FALSE;
+
+  TRY(cwd = getcwd(NULL, 0));
+
+  size = strlen(cwd) + 1;
+  for (i = 0; i < argc; ++i)
+    size += strlen(argv[i]) + 1;
+
+  if (size > SERVER_MAX_REQUEST || argc > SERVER_MAX_ARGS) {
+    errno = E2BIG;
+    goto fail;
+  }
+
+  ALLOCATE_MANY(strings, size, char);
+
+  len = strlen(cwd) + 1;
+  memcpy(strings, cwd, len);
+  for (i = 0, size = len; i < argc; ++i) {
+    len = strlen(argv[i]) + 1;
+    memcpy(strings + size, argv[i], len);
+    size += len;
+  }
+
+  memcpy(header.magic, SERVER_MAGIC, sizeof(header.magic));
+  header.argc = argc;
+  header.size = size;
+
+  memset(&msg, 0, sizeof(struct msghdr));
+  memset(&control, 0, sizeof(control));
+
+  iov.iov_base = &header;
+  iov.iov_len = sizeof(struct server_request_header);
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof(control.buf);
+
+  cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(SERVER_FD_COUNT * sizeof(int));
+  memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+  TRY(sendmsg(fd, &msg, MSG_NOSIGNAL) == sizeof(struct server_request_header));
+  TRY(server_write_all(fd, strings, size));
+
+  ok = TRUE;
+
+fail:
+  if (strings != NULL)
+    free(strings);
+
+  if (cwd != NULL)
+    free(cwd);
+
+  return ok;
+}
+
+BOOL
+server_receive_status(int fd, int *status)
+{
+  int32_t code;
+
+  if (!server_read_all(fd, &code, sizeof(int32_t)))
+    return FALSE;
+
+  *status = code;
+
+  return TRUE;
+}
+
+static void
+server_request_destroy(struct server_request *self)
+{
+  unsigned int i;
+
+  for (i = 0; i < SERVER_FD_COUNT; ++i)
+    if (self->fds[i] != -1)
+      close(self->fds[i]);
+
+  if (self->argv != NULL)
+    free(self->argv);
+
+  if (self->strings != NULL)
+    free(self->strings);
+
+  free(self);
+}
+
+static struct server_request *
+server_request_receive(int fd)
+{
+  struct server_request *new = NULL;
+  struct server_request_header header;
+  union {
+    struct cmsghdr align;
+    char buf[CMSG_SPACE(SERVER_FD_COUNT * sizeof(int))];
+  } control;
+  struct msghdr msg;
+  struct cmsghdr *cmsg;
+  struct iovec iov;
+  unsigned int i, fd_count = 0;
+  const char *p, *end;
+  ssize_t got;
+
+  ALLOCATE(new, struct server_request);
+
+  for (i = 0; i < SERVER_FD_COUNT; ++i)
+    new->fds[i] = -1;
+
+  memset(&msg, 0, sizeof(struct msghdr));
+
+  iov.iov_base = &header;
+  iov.iov_len = sizeof(struct server_request_header);
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof(control.buf);
+
+  TRY((got = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC)) > 0);
+
+  for (cmsg = CMSG_FIRSTHDR(&msg);
+      cmsg != NULL;
+      cmsg = CMSG_NXTHDR(&msg, cmsg))
+    if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+      fd_count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+      memcpy(new->fds, CMSG_DATA(cmsg), MIN(fd_count, SERVER_FD_COUNT) * sizeof(int));
+    }
+
+  if (got < sizeof(struct server_request_header))
+    TRY(server_read_all(
+        fd,
+        (uint8_t *) &header + got,
+        sizeof(struct server_request_header) - got));
+
+  if (memcmp(header.magic, SERVER_MAGIC, sizeof(header.magic)) != 0
+      || fd_count != SERVER_FD_COUNT
+      || (msg.msg_flags & MSG_CTRUNC)
+      || header.argc == 0
+      || header.argc > SERVER_MAX_ARGS
+      || header.argc >= header.size /* Every string takes a byte at least */
+      || header.size > SERVER_MAX_REQUEST) {
+    errno = EPROTO;
+    goto fail;
+  }
+
+  ALLOCATE_MANY(new->strings, (size_t) header.size + 1, char);
+  TRY(server_read_all(fd, new->strings, header.size));
+
+  ALLOCATE_MANY(new->argv, (size_t) header.argc + 1, char *);
+
+  p = new->cwd = new->strings;
+  end = new->strings + header.size;
+
+  for (i = 0; i <= header.argc; ++i) {
+    if (p >= end) {
+      errno = EPROTO;
+      goto fail;
+    }
+
+    if (i > 0)
+      new->argv[i - 1] = (char *) p;
+
+    p += strlen(p) + 1;
+  }
+
+  new->argc = header.argc;
+
+  return new;
+
+fail:
+  if (new != NULL)
+    server_request_destroy(new);
+
+  return NULL;
+}
+
+/*
+ * One connection. The run happens in a process of its own, so that it
+ * may exit wherever it likes: this one waits for it and reports how it
+ * ended. A client that goes away takes its run with it.
+ */
+static int
+server_serve(int fd, server_handler_t handler, void *private)
+{
+  struct server_request *request = NULL;
+  struct pollfd pfd[2];
+  int done[2] = {-1, -1}; /* The run holds the write end */
+  int32_t code = EXIT_FAILURE;
+  int status;
+  unsigned int i;
+  pid_t pid;
+
+  signal(SIGCHLD, SIG_DFL);
+
+  TRY(request = server_request_receive(fd));
+  TRY(pipe(done) != -1);
+  TRY((pid = fork()) != -1);
+
+  if (pid == 0) {
+    close(fd);
+    close(done[0]);
+
+    if (chdir(request->cwd) == -1) {
+      dprintf(
+          request->fds[STDERR_FILENO],
+          "%s: cannot change to %s: %s\n",
+          request->argv[0],
+          request->cwd,
+          strerror(errno));
+      _exit(EXIT_FAILURE);
+    }
+
+    for (i = 0; i < SERVER_FD_COUNT; ++i) {
+      dup2(request->fds[i], i);
+      close(request->fds[i]);
+    }
+
+    exit(handler(request, private));
+  }
+
+  signal(SIGPIPE, SIG_IGN);
+
+  close(done[1]);
+  done[1] = -1;
+
+  pfd[0].fd = fd;
+  pfd[0].events = POLLIN;
+  pfd[1].fd = done[0];
+  pfd[1].events = POLLIN;
+
+  /* The client sends nothing else: anything readable means it left */
+  for (;;) {
+    if (poll(pfd, 2, -1) == -1) {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+
+    if (pfd[1].revents != 0)
+      break;
+
+    if (pfd[0].revents != 0) {
+      kill(pid, SIGTERM);
+      pfd[0].fd = -1;
+    }
+  }
+
+  while (waitpid(pid, &status, 0) == -1)
+    TRY(errno == EINTR);
+
+  if (WIFEXITED(status))
+    code = WEXITSTATUS(status);
+  else if (WIFSIGNALED(status))
+    code = 128 + WTERMSIG(status);
+
+  server_write_all(fd, &code, sizeof(int32_t));
+
+fail:
+  for (i = 0; i < 2; ++i)
+    if (done[i] != -1)
+      close(done[i]);
+
+  if (request != NULL)
+    server_request_destroy(request);
+
+  close(fd);
+
+  return code;
+}
+
+BOOL
+server_run(int fd, server_handler_t handler, void *private)
+{
+  int client;
+  pid_t pid;
+
+  /* Connections are never waited for */
+  signal(SIGCHLD, SIG_IGN);
+
+  for (;;) {
+    if ((client = accept4(fd, NULL, NULL, SOCK_CLOEXEC)) == -1) {
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      return FALSE;
+    }
+
+    /* Nothing buffered here may come out of the children */
+    fflush(NULL);
+
+    if ((pid = fork()) == 0) {
+      close(fd);
+      _exit(server_serve(client, handler, private));
+    }
+
+    if (pid == -1)
+      WARNING("Cannot serve request: %s\n", strerror(errno));
+
+    close(client);
+  }
+}
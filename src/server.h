@@ -0,0 +1,81 @@
+/*
+
+  server.h: Resident server on a Unix domain socket
+  Copyright (C) 2016 Gonzalo José Carracedo Carballal
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program.  If not, see
+  <http://www.gnu.org/licenses/>
+
+*/
+
+#ifndef _SERVER_H
+#define _SERVER_H
+
+#include <stdint.h>
+
+#include "types.h"
+
+#define SERVER_MAGIC       "LFSRREQ1"
+#define SERVER_MAX_REQUEST (1 << 20) /* Bytes of command line */
+#define SERVER_MAX_ARGS    4096      /* Arguments of command line */
+#define SERVER_FD_COUNT    3         /* Standard streams of the client */
+#define SERVER_BACKLOG     64
+
+/*
+ * A request is a command line, run as if the client had run it: in its
+ * working directory and on its standard streams, which are passed along
+ * with the request (SCM_RIGHTS). Output goes straight to the client. The
+ * header carries the descriptors, and is followed by `size' bytes: the
+ * working directory and the `argc' arguments, each one terminated by a
+ * null byte.
+ *
+ * When the run is over, the server sends back its exit status as an
+ * int32_t, and closes the connection.
+ */
+struct server_request_header {
+  char     magic[8];
+  uint32_t argc;
+  uint32_t size;
+};
+
+struct server_request {
+  char *cwd;
+  int argc;
+  char **argv; /* NULL-terminated */
+  int fds[SERVER_FD_COUNT];
+  char *strings;
+};
+
+/*
+ * Runs a request, in a process of its own. Returns the exit status, if
+ * it does not exit by itself.
+ */
+typedef int (*server_handler_t) (
+    const struct server_request *request,
+    void *private);
+
+/* Bind and listen. On failure, errno tells why */
+int server_listen(const char *path);
+
+/* Serve requests forever. Returns only on failure */
+BOOL server_run(int fd, server_handler_t handler, void *private);
+
+/* Client side */
+int server_connect(const char *path);
+
+BOOL server_send_request(int fd, int argc, char **argv);
+
+BOOL server_receive_status(int fd, int *status);
+
+#endif /* _SERVER_H */
@@ -0,0 +1,1910 @@
+/*
+
+  session.c: Analysis of a set of captures, from files to the vote
+  Copyright (C) 2016 Gonzalo José Carracedo Carballal
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program.  If not, see
+  <http://www.gnu.org/licenses/>
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "session.h"
+#include "foldcorr.h"
+#include "descrambler.h"
+#include "workpool.h"
+#include "quality.h"
+
+#define SYMBOLS_PRUNE_RATIO .5f /* Of the best period significance */
+#define CACHE_MIN_APPEND (1 << 16) /* Bits worth correlating on their own */
+
+/* Candidates of one file, recorded in the table of its worker */
+struct lfsr_file_hits {
+  struct lfsr_hit_table *table;
+  unsigned int file;
+  unsigned int rank;
+
+  /* Candidates from `score_from' on are descrambled and scored */
+  const uint64_t *words;
+  uint64_t N;
+  unsigned int index;
+  unsigned int score_from;
+
+  /* Sync words looked for in the scored outputs */
+  const struct syncword *sync;
+  unsigned int sync_count;
+  BOOL polarity; /* Tell inverted outputs by their sync words */
+
+  /* What this file produced, for the result cache */
+  struct cache_record *record;
+
+  /* Appended bits of a grown file: `shift' bits in, after `prior' */
+  const struct cache_record *prior;
+  uint64_t shift;
+};
+
+/*
+ * Descramble the first bits of a capture, up to QUALITY_MAX_BITS. The
+ * first bits of a reversed capture are its last ones, so the whole
+ * capture is reversed first.
+ */
+static uint64_t *
+lfsr_candidate_output(
+    const struct correlator_candidate *candidate,
+    const uint64_t *words,
+    uint64_t *bits)
+{
+  struct capture_variant_state reverse =
+      capture_variant_state_INITIALIZER(CAPTURE_VARIANT_REVERSED);
+  descrambler_t *descrambler = NULL;
+  unsigned int variant = candidate->variant;
+  uint64_t *reversed = NULL;
+  uint64_t *out = NULL;
+
+  if (variant & CAPTURE_VARIANT_REVERSED) {
+    ALLOCATE_MANY(reversed, __UNITS(*bits, CAPTURE_WORD_BITS), uint64_t);
+    capture_variant_words(&reverse, words, reversed, *bits);
+    words = reversed;
+    variant &= ~CAPTURE_VARIANT_REVERSED;
+  }
+
+  *bits = MIN(*bits, QUALITY_MAX_BITS);
+
+  TRY(descrambler = descrambler_new(
+      candidate->desc,
+      candidate->phase,
+      variant,
+      NULL,
+      CAPTURE_FORMAT_ASCII));
+  ALLOCATE_MANY(out, __UNITS(*bits, CAPTURE_WORD_BITS), uint64_t);
+
+  descrambler_apply(descrambler, words, out, *bits);
+
+  descrambler_destroy(descrambler);
+
+  if (reversed != NULL)
+    free(reversed);
+
+  return out;
+
+fail:
+  if (descrambler != NULL)
+    descrambler_destroy(descrambler);
+
+  if (reversed != NULL)
+    free(reversed);
+
+  return NULL;
+}
+
+static BOOL
+lfsr_candidate_check_sync(
+    const struct lfsr_file_hits *file_hits,
+    const struct correlator_candidate *candidate,
+    const uint64_t *out,
+    uint64_t bits,
+    struct lfsr_params_hit *params_hit)
+{
+  struct syncword_result results[SESSION_MAX_SYNC_WORDS];
+  char poly[LFSR_POLY_STRLEN];
+  BOOL locked = FALSE;
+  unsigned int i;
+
+  TRY(syncword_scan(file_hits->sync, file_hits->sync_count, out, bits, results));
+
+  lfsrdesc_format_poly(candidate->desc, poly, sizeof(poly));
+
+  ++params_hit->checked;
+
+  for (i = 0; i < file_hits->sync_count; ++i) {
+    _DEBUG(
+        "[%s] at %" PRIu64 ": sync word %u: %" PRIu64 " hits, "
+        "period %" PRIu64 " (%" PRIu64 " times)%s\n",
+        poly,
+        candidate->phase,
+        i + 1,
+        results[i].hits,
+        results[i].period,
+        results[i].period_hits,
+        results[i].locked ? ", locked" : "");
+
+    if (results[i].locked) {
+      locked = TRUE;
+      params_hit->sync_hits += results[i].hits;
+      if (params_hit->sync_period == 0
+          || results[i].period < params_hit->sync_period)
+        params_hit->sync_period = results[i].period;
+    }
+  }
+
+  if (locked)
+    ++params_hit->synced;
+
+  return TRUE;
+
+fail:
+  return FALSE;
+}
+
+/*
+ * The correlator cannot tell an inverted capture from a plaintext of the
+ * opposite bias. If no sync word locks in the output but one does in its
+ * complement, the capture was inverted: `out' is complemented in place
+ * and so is the polarity of the candidate.
+ */
+static BOOL
+lfsr_candidate_resolve_polarity(
+    const struct lfsr_file_hits *file_hits,
+    struct correlator_candidate *candidate,
+    uint64_t *out,
+    uint64_t bits)
+{
+  struct syncword_result results[SESSION_MAX_SYNC_WORDS];
+  uint64_t i, count = __UNITS(bits, CAPTURE_WORD_BITS);
+  unsigned int j;
+
+  for (j = 0; j < 2; ++j) {
+    TRY(syncword_scan(file_hits->sync, file_hits->sync_count, out, bits, results));
+
+    for (i = 0; i < file_hits->sync_count; ++i)
+      if (results[i].locked) {
+        if (j == 1)
+          candidate->variant |= CAPTURE_VARIANT_INVERTED;
+        return TRUE;
+      }
+
+    for (i = 0; i < count; ++i)
+      out[i] = ~out[i];
+  }
+
+  return TRUE;
+
+fail:
+  return FALSE;
+}
+
+/* Keep what a file said about a candidate for the next run */
+static BOOL
+lfsr_cache_push(
+    struct cache_record *record,
+    const struct correlator_candidate *candidate,
+    const struct lfsr_params_hit *evidence)
+{
+  struct cache_candidate entry;
+
+  memset(&entry, 0, sizeof(struct cache_candidate));
+
+  entry.mask = candidate->desc->lfsr->mask;
+  entry.phase = candidate->phase;
+  entry.variant = candidate->variant;
+  entry.quality = evidence->quality;
+  entry.scored = evidence->scored;
+  entry.checked = evidence->checked;
+  entry.synced = evidence->synced;
+  entry.sync_hits = evidence->sync_hits;
+  entry.sync_period = evidence->sync_period;
+  entry.score = candidate->score;
+  entry.position = candidate->position;
+
+  return cache_record_push(record, &entry);
+}
+
+static BOOL
+on_candidate(const struct correlator_candidate *found, void *private)
+{
+  struct lfsr_file_hits *file_hits = (struct lfsr_file_hits *) private;
+  struct correlator_candidate resolved = *found;
+  const struct correlator_candidate *candidate = &resolved;
+  struct lfsr_params_hit evidence;
+  struct quality q;
+  char poly[LFSR_POLY_STRLEN];
+  uint64_t *out = NULL;
+  uint64_t bits = file_hits->N;
+
+  memset(&evidence, 0, sizeof(struct lfsr_params_hit));
+
+  /* Record only polynomials whose cycle length is at least 31 */
+  if (lfsrdesc_get_cycle_len(candidate->desc) < 16) {
+    ++file_hits->index;
+    return file_hits->record == NULL
+        || lfsr_cache_push(file_hits->record, candidate, &evidence);
+  }
+
+  /* Candidates come by increasing correlation: score the best ones */
+  if (file_hits->words != NULL && file_hits->index++ >= file_hits->score_from) {
+    TRY(out = lfsr_candidate_output(candidate, file_hits->words, &bits));
+
+    if (file_hits->polarity && file_hits->sync_count > 0)
+      TRY(lfsr_candidate_resolve_polarity(file_hits, &resolved, out, bits));
+  }
+
+  TRY(lfsr_hit_assert(
+      file_hits->table,
+      candidate->desc,
+      candidate->phase,
+      candidate->variant,
+      1,
+      file_hits->file,
+      file_hits->rank++));
+
+  if (out != NULL) {
+    quality_measure(&q, out, bits);
+
+    evidence.quality = q.score;
+    evidence.scored = 1;
+
+    lfsrdesc_format_poly(candidate->desc, poly, sizeof(poly));
+    _DEBUG(
+        "[%s] at %" PRIu64 ": score %.3f (%" PRIu64 "/%" PRIu64 " ones, "
+        "%" PRIu64 " flips, run %" PRIu64 ", %.2f bits/byte, "
+        "%.1f%% repeats at lag %u)\n",
+        poly,
+        candidate->phase,
+        q.score,
+        q.ones,
+        q.bits,
+        q.flips,
+        q.longest_run,
+        q.entropy,
+        100 * q.repetition,
+        q.lag);
+
+    if (file_hits->sync_count > 0)
+      TRY(lfsr_candidate_check_sync(file_hits, candidate, out, bits, &evidence));
+
+    free(out);
+    out = NULL;
+
+    lfsr_params_hit_add(
+        lfsr_params_hit_lookup(
+            file_hits->table,
+            candidate->desc,
+            candidate->phase,
+            candidate->variant),
+        &evidence);
+  }
+
+  if (file_hits->record != NULL)
+    TRY(lfsr_cache_push(file_hits->record, candidate, &evidence));
+
+  return TRUE;
+
+fail:
+  if (out != NULL)
+    free(out);
+
+  return FALSE;
+}
+
+/*
+ * Candidates of the appended bits of a grown capture. Their phases are
+ * moved to the start of the capture, and those the old bits had already
+ * found are not counted twice.
+ */
+static BOOL
+on_appended_candidate(const struct correlator_candidate *candidate, void *private)
+{
+  struct lfsr_file_hits *file_hits = (struct lfsr_file_hits *) private;
+  struct correlator_candidate moved = *candidate;
+  uint64_t cycle_len = lfsrdesc_get_cycle_len(candidate->desc);
+
+  moved.phase =
+      (candidate->phase + cycle_len - file_hits->shift % cycle_len) % cycle_len;
+  moved.offset = moved.phase;
+
+  if (cache_record_find(
+      file_hits->prior,
+      candidate->desc->lfsr->mask,
+      moved.phase,
+      moved.variant) != NULL) {
+    ++file_hits->index;
+    return TRUE;
+  }
+
+  return on_candidate(&moved, file_hits);
+}
+
+/* Vote again with the candidates of a file from a previous run */
+static BOOL
+lfsr_cache_replay(
+    const lfsrdesc_db_t *db,
+    const struct cache_record *record,
+    struct lfsr_file_hits *file_hits)
+{
+  const struct cache_candidate *entry;
+  struct lfsr_params_hit evidence;
+  lfsrdesc_t *desc;
+  unsigned int i;
+
+  memset(&evidence, 0, sizeof(struct lfsr_params_hit));
+
+  for (i = 0; i < record->candidate_count; ++i) {
+    entry = record->candidates + i;
+
+    /* Same settings, same database: this only skips corrupt entries */
+    if ((desc = lfsrdesc_db_lookup_by_mask(db, entry->mask)) == NULL)
+      continue;
+
+    if (file_hits->record != NULL)
+      TRY(cache_record_push(file_hits->record, entry));
+
+    /* Kept for the sweep, but not voted (see on_candidate) */
+    if (lfsrdesc_get_cycle_len(desc) < 16)
+      continue;
+
+    TRY(lfsr_hit_assert(
+        file_hits->table,
+        desc,
+        entry->phase,
+        entry->variant,
+        1,
+        file_hits->file,
+        file_hits->rank++));
+
+    evidence.quality = entry->quality;
+    evidence.scored = entry->scored;
+    evidence.checked = entry->checked;
+    evidence.synced = entry->synced;
+    evidence.sync_hits = entry->sync_hits;
+    evidence.sync_period = entry->sync_period;
+
+    lfsr_params_hit_add(
+        lfsr_params_hit_lookup(
+            file_hits->table,
+            desc,
+            entry->phase,
+            entry->variant),
+        &evidence);
+  }
+
+  return TRUE;
+
+fail:
+  return FALSE;
+}
+
+struct lfsr_descramble_job {
+  descrambler_t **descramblers;
+  unsigned int count;
+};
+
+/* Every hypothesis descrambles the same parsed window */
+static BOOL
+on_descramble_words(const uint64_t *words, size_t len, void *private)
+{
+  const struct lfsr_descramble_job *job =
+      (const struct lfsr_descramble_job *) private;
+  unsigned int i;
+
+  for (i = 0; i < job->count; ++i)
+    if (!descrambler_feed(job->descramblers[i], words, len))
+      return FALSE;
+
+  return TRUE;
+}
+
+/*
+ * Descramble one input with `count' hypotheses in a single pass. With a
+ * single hypothesis the output keeps its historical name, otherwise the
+ * rank of the hypothesis is appended to it. Reversed variants cannot be
+ * streamed: if any hypothesis needs one, the whole input is loaded. So
+ * are symbol captures, which are mapped to bits with `map' first.
+ */
+static BOOL
+lfsr_hit_descramble_file(
+    const struct lfsr_hypothesis *hypotheses,
+    unsigned int count,
+    const char *input,
+    const struct symbol_map *map,
+    unsigned int index,
+    enum capture_format in_format,
+    enum capture_format out_format)
+{
+  char *path = NULL;
+  FILE **ofp = NULL;
+  descrambler_t **descramblers = NULL;
+  struct lfsr_descramble_job job;
+  capture_t *capture = NULL;
+  symbols_t *symbols = NULL;
+  uint64_t *words = NULL;
+  BOOL whole = FALSE;
+  unsigned int i;
+  BOOL ok = FALSE;
+
+  if (access(SESSION_OUTPUT_DIRECTORY, F_OK) == -1)
+    TRY_EXCEPT(
+        mkdir(SESSION_OUTPUT_DIRECTORY, 0755) != -1 || errno == EEXIST,
+        fprintf(
+            stderr,
+            "Failed to create output directory %s: %s\n",
+            SESSION_OUTPUT_DIRECTORY,
+            strerror(errno)));
+
+  ALLOCATE_MANY(ofp, count, FILE *);
+  ALLOCATE_MANY(descramblers, count, descrambler_t *);
+
+  for (i = 0; i < count; ++i) {
+    if (count == 1) {
+      TRY(path = strbuild("%s/descrambled-%06d.log", SESSION_OUTPUT_DIRECTORY, index));
+    } else {
+      TRY(path = strbuild(
+          "%s/descrambled-%06d-top%d.log",
+          SESSION_OUTPUT_DIRECTORY,
+          index,
+          i + 1));
+    }
+
+    TRY_EXCEPT(
+        ofp[i] = fopen(path, "w"),
+        fprintf(
+            stderr,
+            "Failed to open %s for writing: %s\n",
+            path,
+            strerror(errno)));
+
+    free(path);
+    path = NULL;
+
+    setvbuf(ofp[i], NULL, _IOFBF, DESCRAMBLER_BUFSIZ);
+
+    TRY(descramblers[i] = descrambler_new(
+        hypotheses[i].hit->desc,
+        hypotheses[i].offset,
+        hypotheses[i].variant,
+        ofp[i],
+        out_format));
+
+    if (hypotheses[i].variant & CAPTURE_VARIANT_REVERSED)
+      whole = TRUE;
+  }
+
+  job.descramblers = descramblers;
+  job.count = count;
+
+  if (map != NULL) {
+    TRY_EXCEPT(
+        symbols = symbols_new(input, map->bits),
+        fprintf(
+            stderr,
+            "Failed to descramble %s: %s\n",
+            input,
+            strerror(errno)));
+    ALLOCATE_MANY(words, symbols_get_word_count(symbols), uint64_t);
+    symbols_apply_map(map, symbols, words);
+    TRY(on_descramble_words(words, symbols->count * symbols->bits, &job));
+  } else if (whole) {
+    TRY_EXCEPT(
+        capture = capture_new(input, in_format),
+        fprintf(
+            stderr,
+            "Failed to descramble %s: %s\n",
+            input,
+            strerror(errno)));
+    TRY(on_descramble_words(capture->words, capture->N, &job));
+  } else {
+    TRY_EXCEPT(
+        capture_walk_words(
+            input,
+            in_format,
+            DESCRAMBLER_WINDOW,
+            on_descramble_words,
+            &job),
+        fprintf(
+            stderr,
+            "Failed to descramble %s: %s\n",
+            input,
+            strerror(errno)));
+  }
+
+  for (i = 0; i < count; ++i)
+    TRY(descrambler_flush(descramblers[i]));
+
+  ok = TRUE;
+
+fail:
+  if (path != NULL)
+    free(path);
+
+  for (i = 0; i < count; ++i) {
+    if (descramblers != NULL && descramblers[i] != NULL)
+      descrambler_destroy(descramblers[i]);
+
+    if (ofp != NULL && ofp[i] != NULL && fclose(ofp[i]) == EOF)
+      ok = FALSE;
+  }
+
+  if (descramblers != NULL)
+    free(descramblers);
+
+  if (ofp != NULL)
+    free(ofp);
+
+  if (capture != NULL)
+    capture_destroy(capture);
+
+  if (words != NULL)
+    free(words);
+
+  if (symbols != NULL)
+    symbols_destroy(symbols);
+
+  return ok;
+}
+
+static int
+lfsr_hypothesis_cmp(const void *a, const void *b)
+{
+  const struct lfsr_hypothesis *ha = (const struct lfsr_hypothesis *) a;
+  const struct lfsr_hypothesis *hb = (const struct lfsr_hypothesis *) b;
+
+  if (ha->hits != hb->hits)
+    return ha->hits < hb->hits ? 1 : -1;
+
+  if (ha->hit->hits != hb->hit->hits)
+    return ha->hit->hits < hb->hit->hits ? 1 : -1;
+
+  if (ha->quality != hb->quality)
+    return ha->quality < hb->quality ? 1 : -1;
+
+  return 0;
+}
+
+/*
+ * Rank every (polynomial, offset) pair by its hits, then by the quality
+ * of its output. At most `max' are returned, `best' being always the
+ * first.
+ */
+static struct lfsr_hypothesis *
+lfsr_hypothesis_rank(
+    const struct lfsr_hit_table *table,
+    const struct lfsr_hit *best,
+    const struct lfsr_params_hit *best_offset,
+    unsigned int max,
+    unsigned int *count)
+{
+  struct lfsr_hypothesis *list = NULL;
+  unsigned int i, j, n = 0;
+
+  for (i = 0; i < table->hit_count; ++i)
+    n += table->hit_list[i]->params_hit_count;
+
+  ALLOCATE_MANY(list, n + 1, struct lfsr_hypothesis);
+
+  /* Rejected offsets are left out */
+
+  list[0].hit = best;
+  list[0].offset = best_offset->offset;
+  list[0].variant = best_offset->variant;
+  list[0].hits = best_offset->hits;
+  list[0].quality = lfsr_params_hit_get_quality(best_offset);
+
+  for (i = 0, n = 1; i < table->hit_count; ++i)
+    for (j = 0; j < table->hit_list[i]->params_hit_count; ++j)
+      if (table->hit_list[i]->params_hit_list[j] != best_offset
+          && !lfsr_params_hit_is_rejected(
+              table->hit_list[i]->params_hit_list[j])) {
+        list[n].hit = table->hit_list[i];
+        list[n].offset = table->hit_list[i]->params_hit_list[j]->offset;
+        list[n].variant = table->hit_list[i]->params_hit_list[j]->variant;
+        list[n].hits = table->hit_list[i]->params_hit_list[j]->hits;
+        list[n].quality = lfsr_params_hit_get_quality(
+            table->hit_list[i]->params_hit_list[j]);
+        ++n;
+      }
+
+  qsort(list + 1, n - 1, sizeof(struct lfsr_hypothesis), lfsr_hypothesis_cmp);
+
+  *count = MIN(n, max);
+
+  return list;
+
+fail:
+  return NULL;
+}
+
+static BOOL
+on_bits(const uint8_t *bits, size_t len, void *private)
+{
+  return foldcorr_feed((foldcorr_t *) private, bits, len);
+}
+
+static BOOL
+analyze_file_bounded(
+    const char *a0,
+    const char *path,
+    enum capture_format format,
+    const struct correlator_params *params,
+    size_t budget,
+    struct lfsr_file_hits *file_hits)
+{
+  foldcorr_t *fold = NULL;
+  size_t footprint;
+  BOOL ok = FALSE;
+
+  TRY_EXCEPT(
+      fold = foldcorr_new(params),
+      fprintf(stderr, "%s: cannot create folded correlator\n", a0));
+
+  /* Each window is mapped, packed and unpacked: at most 17/8 bytes per bit */
+  footprint = foldcorr_get_footprint(fold);
+  if (footprint >= budget)
+    WARNING("Memory budget too small, folds alone take %zu bytes\n", footprint);
+
+  TRY_EXCEPT(
+      capture_walk(
+          path,
+          format,
+          footprint < budget ? (budget - footprint) * 8 / 17 : 0,
+          on_bits,
+          fold),
+      fprintf(stderr, "%s: cannot read %s: %s\n", a0, path, strerror(errno)));
+
+  if (fold->N == 0) {
+    fprintf(stderr, "%s: file %s is empty, skipping...\n", a0, path);
+    goto fail;
+  }
+
+  if (file_hits->record != NULL)
+    file_hits->record->bits = fold->N;
+
+  TRY(foldcorr_run(fold));
+  TRY(foldcorr_walk_candidates(fold, on_candidate, file_hits));
+
+  ok = TRUE;
+
+fail:
+  if (fold != NULL)
+    foldcorr_destroy(fold);
+
+  return ok;
+}
+
+/*
+ * Segmented mode: blocks are correlated independently so that a bit
+ * slip only affects the block it falls in. Phase jumps show up as
+ * segment boundaries.
+ */
+static BOOL
+analyze_segments(
+    const struct lfsr_session *session,
+    const char *path,
+    const uint8_t *bits,
+    size_t len,
+    struct lfsr_file_hits *file_hits)
+{
+  segcorr_t *seg = NULL;
+  BOOL ok = FALSE;
+
+  TRY_EXCEPT(
+      seg = segcorr_new(&session->seg_params, bits, len),
+      fprintf(
+          stderr,
+          "%s: cannot segment %zu bits\n",
+          session->params.name,
+          len));
+
+  TRY(segcorr_run(seg));
+
+  if (session->params.on_segments != NULL)
+    TRY((session->params.on_segments) (path, seg, session->params.private));
+
+  TRY(segcorr_walk_candidates(seg, on_candidate, file_hits));
+
+  ok = TRUE;
+
+fail:
+  if (seg != NULL)
+    segcorr_destroy(seg);
+
+  return ok;
+}
+
+/* Every mapping of the symbols of one file */
+struct lfsr_symbol_search {
+  const struct lfsr_session *session;
+  const symbols_t *symbols;
+
+  struct symbol_map maps[SYMBOLS_MAX_MAPS];
+  unsigned int map_count;
+  float sigma[SYMBOLS_MAX_MAPS]; /* Of the strongest period */
+
+  unsigned int survivors[SYMBOLS_MAX_MAPS];
+  unsigned int survivor_count;
+  float score[SYMBOLS_MAX_MAPS]; /* Best correlation of the sweep */
+  struct correlator_candidate *candidates[SYMBOLS_MAX_MAPS];
+  unsigned int candidate_count[SYMBOLS_MAX_MAPS];
+};
+
+static correlator_t *
+lfsr_symbol_correlator(
+    const struct lfsr_symbol_search *search,
+    unsigned int map,
+    uint8_t **bits)
+{
+  const symbols_t *symbols = search->symbols;
+  size_t N = symbols->count * symbols->bits;
+  uint64_t *words = NULL;
+  correlator_t *corr = NULL;
+
+  ALLOCATE_MANY(words, symbols_get_word_count(symbols), uint64_t);
+  ALLOCATE_MANY(*bits, N, uint8_t);
+
+  symbols_apply_map(search->maps + map, symbols, words);
+  capture_unpack(words, 0, N, *bits);
+
+  corr = correlator_new(&search->session->params.correlator, *bits, N);
+
+fail:
+  if (words != NULL)
+    free(words);
+
+  return corr;
+}
+
+static BOOL
+symbol_probe_task(unsigned int task, unsigned int worker, void *private)
+{
+  struct lfsr_symbol_search *search = (struct lfsr_symbol_search *) private;
+  correlator_t *corr = NULL;
+  uint8_t *bits = NULL;
+  BOOL ok = FALSE;
+
+  TRY(corr = lfsr_symbol_correlator(search, task, &bits));
+
+  search->sigma[task] = correlator_get_period_sigma(corr);
+
+  ok = TRUE;
+
+fail:
+  if (corr != NULL)
+    correlator_destroy(corr);
+
+  if (bits != NULL)
+    free(bits);
+
+  return ok;
+}
+
+static BOOL
+symbol_sweep_task(unsigned int task, unsigned int worker, void *private)
+{
+  struct lfsr_symbol_search *search = (struct lfsr_symbol_search *) private;
+  unsigned int map = search->survivors[task];
+  correlator_t *corr = NULL;
+  uint8_t *bits = NULL;
+  unsigned int i;
+  BOOL ok = FALSE;
+
+  TRY(corr = lfsr_symbol_correlator(search, map, &bits));
+  TRY(correlator_run(corr));
+
+  search->score[map] = corr->best_score;
+
+  /* Candidates outlive the correlator */
+  if (corr->candidate_count > 0) {
+    ALLOCATE_MANY(
+        search->candidates[map],
+        corr->candidate_count,
+        struct correlator_candidate);
+
+    for (i = 0; i < corr->candidate_count; ++i)
+      search->candidates[map][i] = *corr->candidate_list[i];
+
+    search->candidate_count[map] = corr->candidate_count;
+  }
+
+  ok = TRUE;
+
+fail:
+  if (corr != NULL)
+    correlator_destroy(corr);
+
+  if (bits != NULL)
+    free(bits);
+
+  return ok;
+}
+
+/*
+ * Symbol captures: every mapping yields a bit stream of its own. The
+ * keystream period only stands out in the autocorrelation of the right
+ * ones, which costs a transform per mapping. Only mappings whose period
+ * is about as significant as the best one get the polynomial sweep, and
+ * the one with the strongest correlation is kept.
+ */
+static BOOL
+analyze_symbols(
+    const struct lfsr_session *session,
+    unsigned int task,
+    struct lfsr_file_hits *file_hits)
+{
+  const char *a0 = session->params.name;
+  const char *path = session->paths[task];
+  struct lfsr_symbol_search *search = NULL;
+  symbols_t *symbols = NULL;
+  uint64_t *words = NULL;
+  float best_sigma = 0;
+  unsigned int i, best, count;
+  BOOL ok = FALSE;
+
+  TRY_EXCEPT(
+      symbols = symbols_new(path, session->params.symbol_bits),
+      fprintf(stderr, "%s: cannot open %s: %s\n", a0, path, strerror(errno)));
+
+  if (symbols->count == 0) {
+    fprintf(stderr, "%s: file %s is empty, skipping...\n", a0, path);
+    goto fail;
+  }
+
+  ALLOCATE(search, struct lfsr_symbol_search);
+
+  search->session = session;
+  search->symbols = symbols;
+  search->map_count = symbols_enumerate_maps(symbols->bits, search->maps);
+
+  TRY(workpool_run(
+      session->symbol_threads,
+      search->map_count,
+      symbol_probe_task,
+      search) == search->map_count);
+
+  for (i = 0; i < search->map_count; ++i)
+    best_sigma = MAX(best_sigma, search->sigma[i]);
+
+  /* If no period stands out anywhere, there is nothing to prune with */
+  for (i = 0; i < search->map_count; ++i)
+    if (best_sigma < CORRELATOR_PERIOD_SIGMA
+        || search->sigma[i] >= SYMBOLS_PRUNE_RATIO * best_sigma)
+      search->survivors[search->survivor_count++] = i;
+
+  _DEBUG(
+      "%s: %u of %u symbol mappings pruned\n",
+      path,
+      search->map_count - search->survivor_count,
+      search->map_count);
+
+  TRY(workpool_run(
+      session->symbol_threads,
+      search->survivor_count,
+      symbol_sweep_task,
+      search) == search->survivor_count);
+
+  best = search->survivors[0];
+  for (i = 1; i < search->survivor_count; ++i)
+    if (search->score[search->survivors[i]] > search->score[best])
+      best = search->survivors[i];
+
+  session->file_maps[task] = search->maps[best];
+
+  if (session->params.on_symbol_map != NULL)
+    TRY((session->params.on_symbol_map) (
+        path,
+        search->maps + best,
+        session->params.private));
+
+  ALLOCATE_MANY(words, symbols_get_word_count(symbols), uint64_t);
+  symbols_apply_map(search->maps + best, symbols, words);
+
+  file_hits->words = words;
+  file_hits->N = symbols->count * symbols->bits;
+  file_hits->sync = session->params.sync;
+  file_hits->sync_count = session->params.sync_count;
+  file_hits->polarity =
+      (session->params.correlator.variants & CAPTURE_VARIANT_INVERTED) != 0;
+
+  /* Same scoring rules as bit captures */
+  count = search->candidate_count[best];
+  if (session->params.sync_count == 0 && count > session->score_top)
+    file_hits->score_from = count - session->score_top;
+
+  for (i = 0; i < count; ++i)
+    TRY(on_candidate(search->candidates[best] + i, file_hits));
+
+  ok = TRUE;
+
+fail:
+  if (search != NULL) {
+    for (i = 0; i < search->map_count; ++i)
+      if (search->candidates[i] != NULL)
+        free(search->candidates[i]);
+
+    free(search);
+  }
+
+  if (words != NULL)
+    free(words);
+
+  if (symbols != NULL)
+    symbols_destroy(symbols);
+
+  return ok;
+}
+
+/*
+ * Everything the candidates of a file depend on besides its contents and
+ * the polynomials swept. The sweep order set by a prior is left out: it
+ * only decides where an early exit stops, and it changes from run to run.
+ */
+static uint64_t
+lfsr_settings_hash(const struct lfsr_session *session)
+{
+  const struct correlator_params *params = &session->params.correlator;
+  uint64_t fields[] = {
+    session->params.memory_budget > 0,
+    session->params.input_format,
+    session->score_top,
+    session->params.sync_count,
+    params->backend,
+    params->period_filter,
+    params->stage_count,
+    params->variants
+  };
+  uint64_t polys = 0;
+  uint64_t h;
+  unsigned int i;
+
+  h = cache_hash(fields, sizeof(fields), CACHE_VERSION);
+  h = cache_hash(params->stage_len, params->stage_count * sizeof(size_t), h);
+  h = cache_hash(params->stage_sigma, params->stage_count * sizeof(float), h);
+  h = cache_hash(&params->exit_sigma, sizeof(float), h);
+  h = cache_hash(
+      session->params.sync,
+      session->params.sync_count * sizeof(struct syncword),
+      h);
+
+  /* The same polynomials, in whatever order */
+  for (i = 0; i < params->db->desc_count; ++i)
+    if (params->db->desc_list[i] != NULL)
+      polys += cache_hash(
+          &params->db->desc_list[i]->lfsr->mask,
+          sizeof(uint64_t),
+          0);
+
+  return cache_hash(&polys, sizeof(uint64_t), h);
+}
+
+/* The polynomials in sweep order, which positions of the sweep refer to */
+static uint64_t
+lfsr_sweep_order_hash(const lfsrdesc_db_t *db)
+{
+  uint64_t h = 0;
+  unsigned int i;
+
+  for (i = 0; i < db->desc_count; ++i)
+    if (db->desc_list[i] != NULL)
+      h = cache_hash(&db->desc_list[i]->lfsr->mask, sizeof(uint64_t), h);
+
+  return h;
+}
+
+static uint64_t
+lfsr_cache_config(const struct lfsr_session *session)
+{
+  const struct correlator_params *params = &session->params.correlator;
+  uint64_t sweep[] = {
+    params->sweep_from,
+    MIN(params->sweep_to, (unsigned int) params->db->desc_count),
+    0
+  };
+
+  /* A part of the sweep depends on its order */
+  if (sweep[0] > 0 || sweep[1] < params->db->desc_count)
+    sweep[2] = lfsr_sweep_order_hash(params->db);
+
+  return cache_hash(sweep, sizeof(sweep), lfsr_settings_hash(session));
+}
+
+/*
+ * Look a file up in the result cache. If its contents were seen before,
+ * wherever they were, their candidates vote again and `done' is set. If
+ * the file only grew since it was last analyzed, `prior' receives the
+ * record of its old contents.
+ */
+static BOOL
+lfsr_cache_check(
+    const struct lfsr_session *session,
+    unsigned int task,
+    struct lfsr_file_hits *file_hits,
+    const struct cache_record **prior,
+    BOOL *done)
+{
+  const char *a0 = session->params.name;
+  const char *path = session->paths[task];
+  const struct cache_record *record;
+  uint64_t size = file_hits->record->size;
+  uint64_t prefix_hash;
+
+  if ((record = cache_lookup(
+      session->cache,
+      size,
+      file_hits->record->hash)) != NULL) {
+    fprintf(stderr, "%s: file %s unchanged, using cached candidates\n", a0, path);
+    file_hits->record->bits = record->bits;
+    file_hits->record->format = record->format;
+    TRY(lfsr_cache_replay(session->params.correlator.db, record, file_hits));
+    *done = TRUE;
+  } else if ((record = cache_lookup_path(session->cache, path)) != NULL
+      && record->size < size) {
+    TRY_EXCEPT(
+        cache_hash_file(path, record->size, &size, &prefix_hash),
+        fprintf(stderr, "%s: cannot open %s: %s\n", a0, path, strerror(errno)));
+
+    if (prefix_hash == record->hash)
+      *prior = record;
+  }
+
+  return TRUE;
+
+fail:
+  return FALSE;
+}
+
+/*
+ * A capture that grew since it was last analyzed: the old bits already
+ * voted, so only the appended ones are correlated. Appends too short to
+ * be correlated on their own are left for a later run, the record still
+ * describing the old contents.
+ */
+static BOOL
+analyze_appended(
+    const struct lfsr_session *session,
+    const char *path,
+    const uint8_t *bits,
+    uint64_t N,
+    const struct cache_record *prior,
+    struct lfsr_file_hits *file_hits)
+{
+  const char *a0 = session->params.name;
+  struct cache_record *record = file_hits->record;
+  uint64_t appended = N - prior->bits;
+  correlator_t *corr = NULL;
+  BOOL ok = FALSE;
+
+  TRY(lfsr_cache_replay(session->params.correlator.db, prior, file_hits));
+
+  if (appended < CACHE_MIN_APPEND) {
+    fprintf(
+        stderr,
+        "%s: file %s grew by only %" PRIu64 " bits, using cached candidates\n",
+        a0,
+        path,
+        appended);
+    record->size = prior->size;
+    record->hash = prior->hash;
+    record->bits = prior->bits;
+    return TRUE;
+  }
+
+  fprintf(
+      stderr,
+      "%s: file %s grew by %" PRIu64 " bits, correlating them only\n",
+      a0,
+      path,
+      appended);
+
+  TRY_EXCEPT(
+      corr = correlator_new(&session->params.correlator, bits + prior->bits, appended),
+      fprintf(
+          stderr,
+          "%s: cannot correlate %" PRIu64 " bits\n",
+          a0,
+          appended));
+
+  TRY(correlator_run(corr));
+
+  if (session->params.sync_count == 0 && corr->candidate_count > session->score_top)
+    file_hits->score_from = corr->candidate_count - session->score_top;
+
+  file_hits->prior = prior;
+  file_hits->shift = prior->bits;
+
+  TRY(correlator_walk_candidates(corr, on_appended_candidate, file_hits));
+
+  ok = TRUE;
+
+fail:
+  if (corr != NULL)
+    correlator_destroy(corr);
+
+  return ok;
+}
+
+static BOOL
+analyze_task(unsigned int task, unsigned int worker, void *private)
+{
+  const struct lfsr_session *session = (const struct lfsr_session *) private;
+  const char *a0 = session->params.name;
+  const char *path = session->paths[task];
+  struct lfsr_file_hits file_hits = {session->tables + worker, task};
+  const struct cache_record *prior = NULL;
+  capture_t *capture = NULL;
+  correlator_t *corr = NULL;
+  const uint8_t *bits;
+  uint8_t *input_copy = NULL;
+  char *dump_path = NULL;
+  BOOL cached = FALSE;
+  BOOL ok = FALSE;
+
+  if (session->params.symbol_bits > 0)
+    return analyze_symbols(session, task, &file_hits);
+
+  /* Partials list every file, analyzed or not */
+  if (session->records != NULL) {
+    TRY(file_hits.record = cache_record_new(path, 0, 0));
+    session->records[task] = file_hits.record;
+
+    TRY_EXCEPT(
+        cache_hash_file(
+            path,
+            UINT64_MAX,
+            &file_hits.record->size,
+            &file_hits.record->hash),
+        fprintf(stderr, "%s: cannot open %s: %s\n", a0, path, strerror(errno)));
+  }
+
+  if (session->cache != NULL) {
+    TRY(lfsr_cache_check(session, task, &file_hits, &prior, &cached));
+    if (cached) {
+      ok = TRUE;
+      goto fail;
+    }
+  }
+
+  if (session->params.memory_budget > 0) {
+    ok = analyze_file_bounded(
+        a0,
+        path,
+        session->params.input_format,
+        &session->params.correlator,
+        session->params.memory_budget,
+        &file_hits);
+    goto fail;
+  }
+
+  TRY_EXCEPT(
+      capture = capture_new(path, session->params.input_format),
+      fprintf(stderr, "%s: cannot open %s: %s\n", a0, path, strerror(errno)));
+
+  if (capture->N == 0) {
+    fprintf(stderr, "%s: file %s is empty, skipping...\n", a0, path);
+    goto fail;
+  }
+
+  TRY(bits = capture_get_bits(capture));
+
+  file_hits.words = capture->words;
+  file_hits.N = capture->N;
+  file_hits.sync = session->params.sync;
+  file_hits.sync_count = session->params.sync_count;
+  file_hits.polarity =
+      (session->params.correlator.variants & CAPTURE_VARIANT_INVERTED) != 0;
+
+  if (session->params.segment_len > 0) {
+    ok = analyze_segments(session, path, bits, capture->N, &file_hits);
+    goto fail;
+  }
+
+  if (file_hits.record != NULL) {
+    file_hits.record->bits = capture->N;
+    file_hits.record->format = capture->format;
+  }
+
+  /*
+   * Time reversal and bit order within bytes do not survive the cut, and
+   * shards must register candidates as a whole sweep would
+   */
+  if (prior != NULL
+      && !session->params.sharded
+      && capture->format == prior->format
+      && capture->N >= prior->bits
+      && (session->params.correlator.variants
+      & (CAPTURE_VARIANT_REVERSED | CAPTURE_VARIANT_BITREV)) == 0) {
+    ok = analyze_appended(
+        session,
+        path,
+        bits,
+        capture->N,
+        prior,
+        &file_hits);
+    goto fail;
+  }
+
+  TRY_EXCEPT(
+      corr = correlator_new(&session->params.correlator, bits, capture->N),
+      fprintf(
+          stderr,
+          "%s: cannot correlate %" PRIu64 " bits\n",
+          a0,
+          capture->N));
+
+  TRY(correlator_run(corr));
+
+  /* With sync words, every candidate must prove itself */
+  if (session->params.sync_count == 0 && corr->candidate_count > session->score_top)
+    file_hits.score_from = corr->candidate_count - session->score_top;
+
+  /* Everything went alright */
+  TRY(correlator_walk_candidates(corr, on_candidate, &file_hits));
+
+  if (session->params.dumper != NULL) {
+    TRY(dump_path = strdup("input.log"));
+    ALLOCATE_MANY(input_copy, capture->N, uint8_t);
+    memcpy(input_copy, bits, capture->N);
+    dumper_push(session->params.dumper, dump_path, input_copy, capture->N);
+    dump_path = NULL;
+    input_copy = NULL;
+    TRY(correlator_dump(corr, session->params.dumper, session->params.dump_top));
+  }
+
+  ok = TRUE;
+
+fail:
+  /* Half-analyzed files are not cached */
+  if (!ok && file_hits.record != NULL) {
+    file_hits.record->bits = 0;
+    file_hits.record->candidate_count = 0;
+  }
+
+  if (dump_path != NULL)
+    free(dump_path);
+
+  if (input_copy != NULL)
+    free(input_copy);
+
+  if (corr != NULL)
+    correlator_destroy(corr);
+
+  if (capture != NULL)
+    capture_destroy(capture);
+
+  return ok;
+}
+
+static BOOL
+descramble_task(unsigned int task, unsigned int worker, void *private)
+{
+  const struct lfsr_session *session = (const struct lfsr_session *) private;
+
+  return lfsr_hit_descramble_file(
+      session->hypotheses,
+      session->hypothesis_count,
+      session->paths[task],
+      session->params.symbol_bits > 0 ? session->file_maps + task : NULL,
+      task + 1,
+      session->params.input_format,
+      session->params.output_format);
+}
+
+/* A record of a partial, and the part of the sweep behind it */
+struct lfsr_merge_entry {
+  struct cache_record *record;
+  const struct partial_header *header;
+  unsigned int order; /* Of appearance, across partials */
+};
+
+/* The records of one input file */
+struct lfsr_merge_file {
+  struct lfsr_merge_entry *entries;
+  unsigned int count;
+};
+
+static int
+lfsr_merge_entry_cmp(const void *a, const void *b)
+{
+  const struct lfsr_merge_entry *ea = (const struct lfsr_merge_entry *) a;
+  const struct lfsr_merge_entry *eb = (const struct lfsr_merge_entry *) b;
+  int cmp;
+
+  if ((cmp = strcmp(ea->record->path, eb->record->path)) != 0)
+    return cmp;
+
+  return ea->order < eb->order ? -1 : ea->order > eb->order;
+}
+
+static int
+lfsr_merge_file_cmp(const void *a, const void *b)
+{
+  const struct lfsr_merge_file *fa = (const struct lfsr_merge_file *) a;
+  const struct lfsr_merge_file *fb = (const struct lfsr_merge_file *) b;
+
+  return fa->entries[0].order < fb->entries[0].order
+      ? -1
+      : fa->entries[0].order > fb->entries[0].order;
+}
+
+static int
+lfsr_merge_range_cmp(const void *a, const void *b)
+{
+  const struct lfsr_merge_entry *ea = (const struct lfsr_merge_entry *) a;
+  const struct lfsr_merge_entry *eb = (const struct lfsr_merge_entry *) b;
+
+  return ea->header->sweep_from < eb->header->sweep_from
+      ? -1
+      : ea->header->sweep_from > eb->header->sweep_from;
+}
+
+static int
+lfsr_merge_candidate_cmp(const void *a, const void *b)
+{
+  const struct cache_candidate *ca = *(const struct cache_candidate **) a;
+  const struct cache_candidate *cb = *(const struct cache_candidate **) b;
+
+  return ca->position < cb->position ? -1 : ca->position > cb->position;
+}
+
+/*
+ * Vote with the candidates the shards found in one file, as a single
+ * sweep would have registered them: by position, each one beating the
+ * best correlation so far, up to the first one past the exit threshold.
+ * Shards scored all of their candidates, the best ones are picked here.
+ */
+static BOOL
+lfsr_merge_file(
+    const struct lfsr_session *session,
+    struct lfsr_merge_file *file,
+    unsigned int index,
+    BOOL *analyzed)
+{
+  const char *a0 = session->params.name;
+  const char *path = file->entries[0].record->path;
+  const struct partial_header *header = file->entries[0].header;
+  unsigned int desc_count = session->params.correlator.db->desc_count;
+  const struct cache_candidate **candidates = NULL;
+  const struct cache_candidate *entry;
+  const struct cache_record *record;
+  struct lfsr_params_hit evidence;
+  lfsrdesc_t *desc;
+  uint64_t N = 0;
+  uint64_t hash = 0;
+  unsigned int covered = 0;
+  unsigned int i, j, n, count = 0, failed = 0;
+  unsigned int rank = 0, scored = 0, score_from = 0;
+  float best = 0;
+  BOOL exited = FALSE;
+  BOOL ok = FALSE;
+
+  *analyzed = FALSE;
+
+  for (i = 0, n = 0; i < file->count; ++i) {
+    record = file->entries[i].record;
+
+    /* Shards already said why */
+    if (record->bits == 0) {
+      ++failed;
+      continue;
+    }
+
+    if (N > 0 && (record->bits != N || record->hash != hash)) {
+      fprintf(
+          stderr,
+          "%s: file %s changed between shards, skipping...\n",
+          a0,
+          path);
+      return TRUE;
+    }
+
+    N = record->bits;
+    hash = record->hash;
+    n += record->candidate_count;
+  }
+
+  if (failed > 0) {
+    if (failed < file->count)
+      fprintf(
+          stderr,
+          "%s: file %s was not analyzed by every shard, skipping...\n",
+          a0,
+          path);
+    return TRUE;
+  }
+
+  ALLOCATE_MANY(candidates, n + 1, const struct cache_candidate *);
+
+  for (i = 0; i < file->count; ++i)
+    for (j = 0; j < file->entries[i].record->candidate_count; ++j)
+      candidates[count++] = file->entries[i].record->candidates + j;
+
+  qsort(
+      candidates,
+      count,
+      sizeof(const struct cache_candidate *),
+      lfsr_merge_candidate_cmp);
+
+  /* Overlapping shards found the same ones: they do not beat themselves */
+  for (i = 0, n = 0; i < count && !exited; ++i) {
+    entry = candidates[i];
+    if (entry->score > best) {
+      candidates[n++] = entry;
+      best = entry->score;
+      exited = header->exit_sigma > 0
+          && sqrtf(entry->score * N) >= header->exit_sigma;
+    }
+  }
+
+  qsort(
+      file->entries,
+      file->count,
+      sizeof(struct lfsr_merge_entry),
+      lfsr_merge_range_cmp);
+
+  for (i = 0; i < file->count && file->entries[i].header->sweep_from <= covered; ++i)
+    covered = MAX(
+        covered,
+        MIN(file->entries[i].header->sweep_to, desc_count));
+
+  /* A gap after the early exit would not have been swept anyway */
+  if (covered < desc_count
+      && !(exited && candidates[n - 1]->position < covered))
+    fprintf(
+        stderr,
+        "%s: warning: no shard swept the polynomials of %s from position %u\n",
+        a0,
+        path,
+        covered);
+
+  if (header->sync_count == 0 && n > session->score_top)
+    score_from = n - session->score_top;
+
+  memset(&evidence, 0, sizeof(struct lfsr_params_hit));
+
+  for (i = 0; i < n; ++i) {
+    entry = candidates[i];
+
+    TRY_EXCEPT(
+        desc = lfsrdesc_db_lookup_by_mask(session->params.correlator.db, entry->mask),
+        fprintf(
+            stderr,
+            "%s: %s refers to polynomials that are not in the database\n",
+            a0,
+            path));
+
+    /* Not voted, but they count for scoring (see on_candidate) */
+    if (lfsrdesc_get_cycle_len(desc) < 16) {
+      ++scored;
+      continue;
+    }
+
+    TRY(lfsr_hit_assert(
+        session->hits,
+        desc,
+        entry->phase,
+        entry->variant,
+        1,
+        index,
+        rank++));
+
+    if (scored++ >= score_from) {
+      evidence.quality = entry->quality;
+      evidence.scored = entry->scored;
+      evidence.checked = entry->checked;
+      evidence.synced = entry->synced;
+      evidence.sync_hits = entry->sync_hits;
+      evidence.sync_period = entry->sync_period;
+
+      lfsr_params_hit_add(
+          lfsr_params_hit_lookup(
+              session->hits,
+              desc,
+              entry->phase,
+              entry->variant),
+          &evidence);
+    }
+  }
+
+  *analyzed = TRUE;
+  ok = TRUE;
+
+fail:
+  if (candidates != NULL)
+    free(candidates);
+
+  return ok;
+}
+
+int
+lfsr_session_merge(lfsr_session_t *self, char **paths, unsigned int count)
+{
+  const char *a0 = self->params.name;
+  partial_t **partials = NULL;
+  const struct partial_header *header;
+  struct lfsr_merge_entry *entries = NULL;
+  struct lfsr_merge_file *merged = NULL;
+  struct correlator_params params = correlator_params_INITIALIZER;
+  char **files = NULL;
+  unsigned int i, j, n = 0;
+  unsigned int file_count = 0;
+  unsigned int analyzed = 0;
+  BOOL file_analyzed;
+  int ret = -1;
+
+  ALLOCATE_MANY(partials, count, partial_t *);
+
+  for (i = 0; i < count; ++i) {
+    TRY_EXCEPT(
+        partials[i] = partial_new(paths[i]),
+        fprintf(
+            stderr,
+            "%s: cannot load partial result %s: %s\n",
+            a0,
+            paths[i],
+            strerror(errno)));
+
+    if (partials[i]->header.config != partials[0]->header.config
+        || partials[i]->header.order != partials[0]->header.order) {
+      fprintf(
+          stderr,
+          "%s: %s and %s were written with different settings or "
+          "polynomials\n",
+          a0,
+          paths[0],
+          paths[i]);
+      goto fail;
+    }
+
+    n += partials[i]->record_count;
+  }
+
+  header = &partials[0]->header;
+
+  ALLOCATE_MANY(entries, n + 1, struct lfsr_merge_entry);
+
+  for (i = 0, n = 0; i < count; ++i)
+    for (j = 0; j < partials[i]->record_count; ++j) {
+      entries[n].record = partials[i]->record_list[j];
+      entries[n].header = &partials[i]->header;
+      entries[n].order = n;
+      ++n;
+    }
+
+  qsort(entries, n, sizeof(struct lfsr_merge_entry), lfsr_merge_entry_cmp);
+
+  ALLOCATE_MANY(merged, n + 1, struct lfsr_merge_file);
+
+  for (i = 0; i < n; ++i) {
+    if (i == 0 || strcmp(entries[i].record->path, entries[i - 1].record->path) != 0)
+      merged[file_count++].entries = entries + i;
+
+    ++merged[file_count - 1].count;
+  }
+
+  qsort(merged, file_count, sizeof(struct lfsr_merge_file), lfsr_merge_file_cmp);
+
+  /* What the vote and the descramblers need from the settings */
+  params.db = self->params.correlator.db;
+  params.variants = header->variants;
+  self->params.correlator = params;
+  self->params.input_format = header->input_format;
+  self->params.sync_count = header->sync_count;
+
+  ALLOCATE_MANY(files, file_count + 1, char *);
+
+  for (i = 0; i < file_count; ++i) {
+    files[i] = merged[i].entries[0].record->path;
+    TRY(lfsr_merge_file(self, merged + i, i, &file_analyzed));
+    if (file_analyzed)
+      ++analyzed;
+  }
+
+  lfsr_hit_table_sort(self->hits);
+
+  /* Paths point into the partials, which live as long as the session */
+  self->paths = files;
+  self->path_count = file_count;
+  self->partials = partials;
+  self->partial_count = count;
+  files = NULL;
+  partials = NULL;
+
+  ret = analyzed;
+
+fail:
+  if (files != NULL)
+    free(files);
+
+  if (merged != NULL)
+    free(merged);
+
+  if (entries != NULL)
+    free(entries);
+
+  if (partials != NULL) {
+    for (i = 0; i < count; ++i)
+      if (partials[i] != NULL)
+        partial_destroy(partials[i]);
+
+    free(partials);
+  }
+
+  return ret;
+}
+
+int
+lfsr_session_analyze(lfsr_session_t *self, char **paths, unsigned int count)
+{
+  const char *a0 = self->params.name;
+  unsigned int threads = self->params.threads;
+  unsigned int i;
+  int ret = -1;
+
+  self->paths = paths;
+  self->path_count = count;
+
+  if (self->params.cache_path != NULL) {
+    if ((self->cache = cache_new(
+        self->params.cache_path,
+        lfsr_cache_config(self))) == NULL) {
+      fprintf(
+          stderr,
+          "%s: cannot load cache from %s: %s\n",
+          a0,
+          self->params.cache_path,
+          strerror(errno));
+      goto fail;
+    }
+
+    if (self->cache->discarded > 0)
+      fprintf(
+          stderr,
+          "%s: warning: %s was written with other settings, "
+          "discarding %u cached files\n",
+          a0,
+          self->params.cache_path,
+          self->cache->discarded);
+  }
+
+  if (self->cache != NULL || self->params.sharded)
+    ALLOCATE_MANY(self->records, count + 1, struct cache_record *);
+
+  /*
+   * Threads go to files first, to the segments or symbol mappings of a
+   * lone file otherwise
+   */
+  if (count > 1) {
+    self->seg_params.threads = 1;
+    self->symbol_threads = 1;
+  }
+
+  ALLOCATE_MANY(self->tables, threads, struct lfsr_hit_table);
+
+  if (self->params.symbol_bits > 0)
+    ALLOCATE_MANY(self->file_maps, count + 1, struct symbol_map);
+
+  TRY((ret = workpool_run(threads, count, analyze_task, self)) != -1);
+
+  for (i = 0; i < threads; ++i)
+    TRY(lfsr_hit_table_merge(self->hits, self->tables + i));
+
+  for (i = 0; i < threads; ++i)
+    lfsr_hit_table_finalize(self->tables + i);
+
+  free(self->tables);
+  self->tables = NULL;
+
+  lfsr_hit_table_sort(self->hits);
+
+  if (self->cache != NULL) {
+    if (!cache_save(self->cache, self->params.cache_path, self->records, count))
+      fprintf(
+          stderr,
+          "%s: cannot update cache %s: %s\n",
+          a0,
+          self->params.cache_path,
+          strerror(errno));
+
+    cache_destroy(self->cache);
+    self->cache = NULL;
+  }
+
+  return ret;
+
+fail:
+  return -1;
+}
+
+BOOL
+lfsr_session_save_partial(const lfsr_session_t *self, const char *path)
+{
+  const struct correlator_params *params = &self->params.correlator;
+  struct partial_header partial;
+
+  memset(&partial, 0, sizeof(struct partial_header));
+
+  partial.config = lfsr_settings_hash(self);
+  partial.order = lfsr_sweep_order_hash(params->db);
+  partial.exit_sigma = params->exit_sigma;
+  partial.variants = params->variants;
+  partial.input_format = self->params.input_format;
+  partial.sync_count = self->params.sync_count;
+  partial.sweep_from = params->sweep_from;
+  partial.sweep_to = MIN(params->sweep_to, (unsigned int) params->db->desc_count);
+
+  return partial_save(path, &partial, self->records, self->path_count);
+}
+
+BOOL
+lfsr_session_vote(const lfsr_session_t *self, struct lfsr_vote *vote)
+{
+  struct lfsr_hit *hit;
+  const struct lfsr_params_hit *params_hit;
+  unsigned int max_hits = 0;
+  unsigned int i, j;
+
+  memset(vote, 0, sizeof(struct lfsr_vote));
+
+  for (i = 0; i < self->hits->hit_count; ++i) {
+    hit = self->hits->hit_list[i];
+
+    /* Most voted offset, then most voted polynomial, then best output */
+    for (j = 0; j < hit->params_hit_count; ++j) {
+      params_hit = hit->params_hit_list[j];
+      if (lfsr_params_hit_is_rejected(params_hit))
+        continue;
+
+      if (params_hit->hits > max_hits
+          || (params_hit->hits == max_hits && hit->hits > vote->best->hits)
+          || (params_hit->hits == max_hits && hit->hits == vote->best->hits
+          && lfsr_params_hit_get_quality(params_hit)
+          > lfsr_params_hit_get_quality(vote->best_offset))) {
+        vote->best = hit;
+        vote->best_offset = params_hit;
+        max_hits = params_hit->hits;
+      }
+    }
+  }
+
+  if (vote->best != NULL)
+    TRY(vote->hypotheses = lfsr_hypothesis_rank(
+        self->hits,
+        vote->best,
+        vote->best_offset,
+        self->params.top,
+        &vote->hypothesis_count));
+
+  return TRUE;
+
+fail:
+  return FALSE;
+}
+
+void
+lfsr_vote_finalize(struct lfsr_vote *vote)
+{
+  if (vote->hypotheses != NULL)
+    free(vote->hypotheses);
+
+  memset(vote, 0, sizeof(struct lfsr_vote));
+}
+
+int
+lfsr_session_descramble(lfsr_session_t *self, const struct lfsr_vote *vote)
+{
+  int ret;
+
+  self->hypotheses = vote->hypotheses;
+  self->hypothesis_count = vote->hypothesis_count;
+
+  ret = workpool_run(
+      self->params.threads,
+      self->path_count,
+      descramble_task,
+      self);
+
+  self->hypotheses = NULL;
+  self->hypothesis_count = 0;
+
+  return ret;
+}
+
+void
+lfsr_session_destroy(lfsr_session_t *self)
+{
+  unsigned int i;
+
+  if (self->tables != NULL) {
+    for (i = 0; i < self->params.threads; ++i)
+      lfsr_hit_table_finalize(self->tables + i);
+
+    free(self->tables);
+  }
+
+  if (self->hits != NULL)
+    lfsr_hit_table_destroy(self->hits);
+
+  if (self->cache != NULL)
+    cache_destroy(self->cache);
+
+  if (self->records != NULL) {
+    for (i = 0; i < self->path_count; ++i)
+      if (self->records[i] != NULL)
+        cache_record_destroy(self->records[i]);
+
+    free(self->records);
+  }
+
+  if (self->file_maps != NULL)
+    free(self->file_maps);
+
+  /* Merged paths are the session's, analyzed ones the caller's */
+  if (self->partials != NULL) {
+    for (i = 0; i < self->partial_count; ++i)
+      if (self->partials[i] != NULL)
+        partial_destroy(self->partials[i]);
+
+    free(self->partials);
+    free(self->paths);
+  }
+
+  free(self);
+}
+
+lfsr_session_t *
+lfsr_session_new(const struct lfsr_session_params *params)
+{
+  lfsr_session_t *new = NULL;
+
+  TRY(params->correlator.db != NULL);
+  TRY(params->threads > 0);
+
+  ALLOCATE(new, lfsr_session_t);
+
+  new->params = *params;
+
+  new->seg_params.block_len = params->segment_len;
+  new->seg_params.threads = params->threads;
+  new->seg_params.db = params->correlator.db;
+  new->symbol_threads = params->threads;
+
+  /* Merging picks the best candidates of the shards */
+  new->score_top = params->sharded
+      ? UINT_MAX
+      : MAX(params->top, SESSION_MIN_SCORED);
+
+  TRY(new->hits = lfsr_hit_table_new());
+
+  return new;
+
+fail:
+  if (new != NULL)
+    lfsr_session_destroy(new);
+
+  return NULL;
+}
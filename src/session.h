@@ -0,0 +1,169 @@
+/*
+
+  session.h: Analysis of a set of captures, from files to the vote
+  Copyright (C) 2016 Gonzalo José Carracedo Carballal
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program.  If not, see
+  <http://www.gnu.org/licenses/>
+
+*/
+
+#ifndef _SESSION_H
+#define _SESSION_H
+
+#include "correlator.h"
+#include "segcorr.h"
+#include "dumper.h"
+#include "syncword.h"
+#include "symbols.h"
+#include "cache.h"
+#include "partial.h"
+#include "hits.h"
+
+#define SESSION_OUTPUT_DIRECTORY "descrambled"
+#define SESSION_MAX_SYNC_WORDS   8
+#define SESSION_MIN_SCORED       4 /* Best candidates scored per file */
+
+/*
+ * A session analyzes a set of captures against the polynomials of its
+ * correlator parameters, and keeps what they voted for in a hit table.
+ * Files are analyzed in parallel, each worker filling a table of its own.
+ * Sessions own no global state: any number of them may run at once,
+ * sharing one database.
+ */
+struct lfsr_session_params {
+  const char *name;       /* Prefix of diagnostics, like argv[0] */
+  struct correlator_params correlator; /* Carries the database */
+  size_t segment_len;     /* Segmented mode if not 0 */
+  size_t memory_budget;   /* Bounded-memory mode if not 0, in bytes */
+  enum capture_format input_format;
+  enum capture_format output_format;
+  unsigned int threads;
+  unsigned int top;       /* Hypotheses descrambled */
+  unsigned int symbol_bits; /* Symbol captures if not 0 */
+  const struct syncword *sync; /* Borrowed, must outlive the session */
+  unsigned int sync_count;
+  dumper_t *dumper;       /* Candidates of each capture, or NULL */
+  unsigned int dump_top;
+  const char *cache_path; /* Result cache, or NULL */
+  BOOL sharded;           /* Analysis is saved as a partial result */
+
+  /* Per-file reports, called from the workers. NULL to stay silent */
+  BOOL (*on_segments) (const char *path, const segcorr_t *seg, void *private);
+  BOOL (*on_symbol_map) (
+      const char *path,
+      const struct symbol_map *map,
+      void *private);
+  void *private;
+};
+
+#define lfsr_session_params_INITIALIZER                  \
+{                                                        \
+  "lfsrintruder", /* name */                             \
+  correlator_params_INITIALIZER, /* correlator */        \
+  0,              /* segment_len */                      \
+  0,              /* memory_budget */                    \
+  CAPTURE_FORMAT_AUTO,  /* input_format */               \
+  CAPTURE_FORMAT_ASCII, /* output_format */              \
+  1,              /* threads */                          \
+  1,              /* top */                              \
+  0,              /* symbol_bits */                      \
+  NULL,           /* sync */                             \
+  0,              /* sync_count */                       \
+  NULL,           /* dumper */                           \
+  0,              /* dump_top */                         \
+  NULL,           /* cache_path */                       \
+  FALSE,          /* sharded */                          \
+  NULL,           /* on_segments */                      \
+  NULL,           /* on_symbol_map */                    \
+  NULL,           /* private */                          \
+}
+
+/* A (polynomial, offset, variant) to descramble with */
+struct lfsr_hypothesis {
+  const struct lfsr_hit *hit;
+  uint64_t offset;
+  unsigned int variant;
+  unsigned int hits;
+  float quality;
+};
+
+/*
+ * Outcome of a vote: the most voted offset, then the most voted
+ * polynomial, then the best output. Hypotheses start with it and follow
+ * by the same order, up to `top'.
+ */
+struct lfsr_vote {
+  struct lfsr_hit *best;  /* NULL if no candidate survived */
+  const struct lfsr_params_hit *best_offset;
+  struct lfsr_hypothesis *hypotheses;
+  unsigned int hypothesis_count;
+};
+
+struct lfsr_session {
+  struct lfsr_session_params params;
+  struct segcorr_params seg_params;
+  unsigned int score_top;       /* Candidates scored per file */
+  unsigned int symbol_threads;  /* Mappings of a lone file in parallel */
+
+  /* Inputs, analyzed or merged */
+  char **paths;
+  unsigned int path_count;
+  struct symbol_map *file_maps; /* Best mapping of each file */
+
+  struct lfsr_hit_table *tables; /* One per worker */
+  struct lfsr_hit_table *hits;   /* Merged from every worker */
+
+  cache_t *cache;                /* NULL if results are not cached */
+  struct cache_record **records; /* New record of each file */
+
+  /* Merged partials, which the paths point into */
+  partial_t **partials;
+  unsigned int partial_count;
+
+  const struct lfsr_hypothesis *hypotheses; /* Being descrambled */
+  unsigned int hypothesis_count;
+};
+
+typedef struct lfsr_session lfsr_session_t;
+
+/*
+ * Analyze `count' captures and vote with their candidates. Returns how
+ * many could be analyzed, -1 on failure. Paths are borrowed.
+ */
+int lfsr_session_analyze(lfsr_session_t *self, char **paths, unsigned int count);
+
+/* Write the candidates of an analysis in shard mode to a partial result */
+BOOL lfsr_session_save_partial(const lfsr_session_t *self, const char *path);
+
+/*
+ * Vote with the partial results of shards as a single analysis over all
+ * of their files would. Returns how many files could be merged, -1 on
+ * failure.
+ */
+int lfsr_session_merge(lfsr_session_t *self, char **paths, unsigned int count);
+
+BOOL lfsr_session_vote(const lfsr_session_t *self, struct lfsr_vote *vote);
+void lfsr_vote_finalize(struct lfsr_vote *vote);
+
+/*
+ * Descramble every input with the hypotheses of a vote, under
+ * SESSION_OUTPUT_DIRECTORY. Returns how many could be, -1 on failure.
+ */
+int lfsr_session_descramble(lfsr_session_t *self, const struct lfsr_vote *vote);
+
+void lfsr_session_destroy(lfsr_session_t *self);
+lfsr_session_t *lfsr_session_new(const struct lfsr_session_params *params);
+
+#endif /* _SESSION_H */
@@ -0,0 +1,273 @@
+/*
+
+  spectrum.c: Keystream spectra shared between runs
+  Copyright (C) 2016 Gonzalo José Carracedo Carballal
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program.  If not, see
+  <http://www.gnu.org/licenses/>
+
+*/
+
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "spectrum.h"
+
+struct spectrum_slot {
+  uint64_t mask;
+  uint64_t N;      /* 0: free */
+  uint64_t offset; /* Of the spectrum, from the start of the data */
+};
+
+/*
+ * Head of the mapping: the lock, then the index, then the data. Offsets
+ * rather than pointers, so the layout means the same in every process.
+ */
+struct spectrum_arena {
+  pthread_mutex_t lock; /* Process-shared and robust */
+  size_t index_size;    /* Power of two */
+  size_t data_offset;   /* From the start of the mapping */
+  size_t data_size;
+  size_t used;
+  unsigned int count;
+  size_t pending;       /* 1 + index of the slot being written, or 0 */
+};
+
+#define SPECTRUM_PRIME1 0x9e3779b185ebca87ull
+#define SPECTRUM_PRIME2 0xc2b2ae3d27d4eb4full
+
+static inline size_t
+spectrum_hash(uint64_t mask, uint64_t N)
+{
+  uint64_t h = (mask ^ (N * SPECTRUM_PRIME1)) * SPECTRUM_PRIME2;
+
+  return h ^ (h >> 29);
+}
+
+static inline struct spectrum_slot *
+spectrum_arena_get_index(struct spectrum_arena *arena)
+{
+  return (struct spectrum_slot *) (arena + 1);
+}
+
+static inline uint8_t *
+spectrum_arena_get_data(struct spectrum_arena *arena)
+{
+  return (uint8_t *) arena + arena->data_offset;
+}
+
+/* The slot of (mask, N), or the free one where it would go */
+static struct spectrum_slot *
+spectrum_arena_find(struct spectrum_arena *arena, uint64_t mask, uint64_t N)
+{
+  struct spectrum_slot *index = spectrum_arena_get_index(arena);
+  size_t i = spectrum_hash(mask, N) & (arena->index_size - 1);
+
+  while (index[i].N != 0 && (index[i].N != N || index[i].mask != mask))
+    i = (i + 1) & (arena->index_size - 1);
+
+  return index + i;
+}
+
+/*
+ * Runs of a server may be killed at any point, holding the lock. The
+ * next one to take it drops the slot that was being written, if any:
+ * space it may have taken is lost, but nothing points into it.
+ */
+static void
+spectrum_arena_repair(struct spectrum_arena *arena)
+{
+  struct spectrum_slot *index = spectrum_arena_get_index(arena);
+  size_t i;
+
+  if (arena->pending != 0) {
+    index[arena->pending - 1].N = 0;
+    arena->pending = 0;
+  }
+
+  arena->count = 0;
+  for (i = 0; i < arena->index_size; ++i)
+    if (index[i].N != 0)
+      ++arena->count;
+}
+
+static void
+spectrum_arena_lock(struct spectrum_arena *arena)
+{
+  if (pthread_mutex_lock(&arena->lock) == EOWNERDEAD) {
+    WARNING("Spectrum cache owner died, recovering\n");
+    spectrum_arena_repair(arena);
+    pthread_mutex_consistent(&arena->lock);
+  }
+}
+
+const fftwf_complex *
+spectrum_cache_lookup(spectrum_cache_t *self, uint64_t mask, size_t N)
+{
+  struct spectrum_arena *arena = self->arena;
+  const struct spectrum_slot *slot;
+  const fftwf_complex *spectrum = NULL;
+
+  spectrum_arena_lock(arena);
+
+  slot = spectrum_arena_find(arena, mask, N);
+  if (slot->N != 0)
+    spectrum = (const fftwf_complex *)
+        (spectrum_arena_get_data(arena) + slot->offset);
+
+  pthread_mutex_unlock(&arena->lock);
+
+  return spectrum;
+}
+
+BOOL
+spectrum_cache_insert(
+    spectrum_cache_t *self,
+    uint64_t mask,
+    size_t N,
+    const fftwf_complex *spectrum)
+{
+  struct spectrum_arena *arena = self->arena;
+  struct spectrum_slot *slot;
+  size_t bytes = __ALIGN(N * sizeof(fftwf_complex), SPECTRUM_ALIGNMENT);
+  BOOL ok = FALSE;
+
+  spectrum_arena_lock(arena);
+
+  slot = spectrum_arena_find(arena, mask, N);
+
+  /* Another worker got there first */
+  if (slot->N != 0) {
+    ok = TRUE;
+    goto done;
+  }
+
+  if (bytes > arena->data_size - arena->used
+      || 2 * (arena->count + 1) > arena->index_size)
+    goto done;
+
+  /* Published last, and dropped by the repair if we die before */
+  arena->pending = 1 + (slot - spectrum_arena_get_index(arena));
+
+  slot->mask = mask;
+  slot->offset = arena->used;
+
+  memcpy(
+      spectrum_arena_get_data(arena) + arena->used,
+      spectrum,
+      N * sizeof(fftwf_complex));
+
+  arena->used += bytes;
+  ++arena->count;
+
+  slot->N = N;
+  arena->pending = 0;
+
+  ok = TRUE;
+
+done:
+  pthread_mutex_unlock(&arena->lock);
+
+  return ok;
+}
+
+void
+spectrum_cache_get_usage(
+    spectrum_cache_t *self,
+    unsigned int *count,
+    size_t *bytes)
+{
+  spectrum_arena_lock(self->arena);
+
+  *count = self->arena->count;
+  *bytes = self->arena->used;
+
+  pthread_mutex_unlock(&self->arena->lock);
+}
+
+void
+spectrum_cache_destroy(spectrum_cache_t *self)
+{
+  if (self->arena != NULL) {
+    pthread_mutex_destroy(&self->arena->lock);
+    munmap(self->arena, self->size);
+  }
+
+  free(self);
+}
+
+spectrum_cache_t *
+spectrum_cache_new(size_t budget)
+{
+  spectrum_cache_t *new = NULL;
+  struct spectrum_arena *arena;
+  pthread_mutexattr_t attr;
+  size_t index_size = 64;
+  size_t head;
+  void *map;
+  int saved_errno;
+
+  /* Room for twice as many of the smallest spectra as would fit */
+  while (index_size < 2 * budget / (SPECTRUM_MIN_BINS * sizeof(fftwf_complex)))
+    index_size <<= 1;
+
+  head = sizeof(struct spectrum_arena)
+      + index_size * sizeof(struct spectrum_slot);
+  head = __ALIGN(head, SPECTRUM_ALIGNMENT);
+
+  ALLOCATE(new, spectrum_cache_t);
+
+  new->size = head + budget;
+
+  /* Pages are only committed as spectra are stored */
+  TRY((map = mmap(
+      NULL,
+      new->size,
+      PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_ANONYMOUS,
+      -1,
+      0)) != MAP_FAILED);
+
+  arena = new->arena = (struct spectrum_arena *) map;
+
+  arena->index_size = index_size;
+  arena->data_offset = head;
+  arena->data_size = budget;
+
+  TRY(pthread_mutexattr_init(&attr) == 0);
+  pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+  pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+  errno = pthread_mutex_init(&arena->lock, &attr);
+  pthread_mutexattr_destroy(&attr);
+
+  if (errno != 0) {
+    munmap(map, new->size);
+    new->arena = NULL;
+    goto fail;
+  }
+
+  return new;
+
+fail:
+  saved_errno = errno;
+
+  if (new != NULL)
+    spectrum_cache_destroy(new);
+
+  errno = saved_errno;
+
+  return NULL;
+}
@@ -0,0 +1,78 @@
+/*
+
+  spectrum.h: Keystream spectra shared between runs
+  Copyright (C) 2016 Gonzalo José Carracedo Carballal
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program.  If not, see
+  <http://www.gnu.org/licenses/>
+
+*/
+
+#ifndef _SPECTRUM_H
+#define _SPECTRUM_H
+
+#include <stdint.h>
+#include <complex.h>
+#include <fftw3.h>
+
+#include "types.h"
+
+#define SPECTRUM_MIN_BINS   1024 /* Smallest transform the index is sized for */
+#define SPECTRUM_ALIGNMENT  64   /* Of every spectrum, as FFTW allocates */
+
+/*
+ * The transform of the keystream of a polynomial at a given size only
+ * depends on its feedback mask and on the size. Spectra are stored in
+ * an arena of fixed size, indexed by (mask, size) with open addressing.
+ *
+ * The arena is a shared anonymous mapping, so processes forked after the
+ * cache was created see the spectra each other computed. Entries are
+ * never evicted nor modified once published: pointers returned by
+ * spectrum_cache_lookup stay valid as long as the cache. When the arena
+ * is full, new spectra are simply not kept.
+ */
+struct spectrum_arena;
+
+struct spectrum_cache {
+  struct spectrum_arena *arena;
+  size_t size; /* Of the mapping */
+};
+
+typedef struct spectrum_cache spectrum_cache_t;
+
+/* NULL if not cached */
+const fftwf_complex *spectrum_cache_lookup(
+    spectrum_cache_t *self,
+    uint64_t mask,
+    size_t N);
+
+/* FALSE if there was no room for it */
+BOOL spectrum_cache_insert(
+    spectrum_cache_t *self,
+    uint64_t mask,
+    size_t N,
+    const fftwf_complex *spectrum);
+
+/* Spectra cached so far, and the bytes they take */
+void spectrum_cache_get_usage(
+    spectrum_cache_t *self,
+    unsigned int *count,
+    size_t *bytes);
+
+void spectrum_cache_destroy(spectrum_cache_t *self);
+
+/* A cache of at most `budget' bytes. On failure, errno tells why */
+spectrum_cache_t *spectrum_cache_new(size_t budget);
+
+#endif /* _SPECTRUM_H */
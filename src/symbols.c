@@ -0,0 +1,295 @@
+/*
+
+  symbols.c: Symbol-to-bit mappings of multi-bit-symbol captures
+  Copyright (C) 2016 Gonzalo José Carracedo Carballal
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program.  If not, see
+  <http://www.gnu.org/licenses/>
+
+*/
+
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "symbols.h"
+
+BOOL
+symbols_parse_order(const char *name, unsigned int *bits)
+{
+  char *end;
+
+  if (strcmp(name, "bpsk") == 0) {
+    *bits = 1;
+  } else if (strcmp(name, "qpsk") == 0) {
+    *bits = 2;
+  } else if (strcmp(name, "8psk") == 0) {
+    *bits = 3;
+  } else {
+    *bits = strtoul(name, &end, 10);
+    if (end == name || *end != '\0')
+      return FALSE;
+  }
+
+  return *bits >= 1 && *bits <= SYMBOLS_MAX_BITS;
+}
+
+/* `n' bits of the packed stream starting at bit `pos' (n < 64) */
+static inline unsigned int
+symbols_get(const uint64_t *words, uint64_t pos, unsigned int n)
+{
+  const uint64_t *word = words + pos / CAPTURE_WORD_BITS;
+  unsigned int shift = pos % CAPTURE_WORD_BITS;
+  uint64_t x = word[0] >> shift;
+
+  if (shift + n > CAPTURE_WORD_BITS)
+    x |= word[1] << (CAPTURE_WORD_BITS - shift);
+
+  return x & ((1ull << n) - 1);
+}
+
+/* OR `n' bits into the packed stream, at bit `pos' */
+static inline void
+symbols_put(uint64_t *words, uint64_t pos, uint64_t value, unsigned int n)
+{
+  uint64_t *word = words + pos / CAPTURE_WORD_BITS;
+  unsigned int shift = pos % CAPTURE_WORD_BITS;
+
+  word[0] |= value << shift;
+
+  if (shift + n > CAPTURE_WORD_BITS)
+    word[1] |= value >> (CAPTURE_WORD_BITS - shift);
+}
+
+static inline unsigned int
+symbols_gray_decode(unsigned int g)
+{
+  g ^= g >> 1;
+  g ^= g >> 2;
+
+  return g;
+}
+
+static void
+symbol_map_build(struct symbol_map *map)
+{
+  unsigned int order = 1 << map->bits;
+  unsigned int chunk, s, p, v, j, t, x;
+  unsigned int label;
+
+  for (s = 0; s < order; ++s) {
+    p = map->mirrored ? (order - s) % order : s;
+    p = (p + map->rotation) % order;
+    v = map->gray ? symbols_gray_decode(p) : p;
+
+    label = 0;
+    for (j = 0; j < map->bits; ++j)
+      label |= (map->lsb_first
+          ? (v >> j) & 1
+          : (v >> (map->bits - 1 - j)) & 1) << j;
+
+    map->label[s] = label;
+  }
+
+  map->group = 8 / map->bits;
+  chunk = map->group * map->bits;
+
+  for (x = 0; x < (1u << chunk); ++x) {
+    map->lut[x] = 0;
+    for (t = 0; t < map->group; ++t)
+      map->lut[x] |=
+          map->label[(x >> (t * map->bits)) & (order - 1)] << (t * map->bits);
+  }
+}
+
+unsigned int
+symbols_enumerate_maps(unsigned int bits, struct symbol_map *maps)
+{
+  unsigned int order = 1 << bits;
+  unsigned int lsb, gray, mirrored, rotation, i, n = 0;
+  struct symbol_map *map;
+
+  for (lsb = 0; lsb < 2; ++lsb)
+    for (gray = 0; gray < 2; ++gray)
+      for (mirrored = 0; mirrored < 2; ++mirrored)
+        for (rotation = 0; rotation < order; ++rotation) {
+          map = maps + n;
+
+          memset(map, 0, sizeof(struct symbol_map));
+          map->bits = bits;
+          map->rotation = rotation;
+          map->mirrored = mirrored;
+          map->gray = gray;
+          map->lsb_first = lsb;
+
+          symbol_map_build(map);
+
+          /* Small orders make many combinations equivalent */
+          for (i = 0; i < n; ++i)
+            if (memcmp(maps[i].label, map->label, order) == 0)
+              break;
+
+          if (i == n)
+            ++n;
+        }
+
+  return n;
+}
+
+void
+symbol_map_to_string(const struct symbol_map *map, char *buf, size_t size)
+{
+  snprintf(
+      buf,
+      size,
+      "%s, %s first, rotation %u%s",
+      map->gray ? "gray" : "natural",
+      map->lsb_first ? "lsb" : "msb",
+      map->rotation,
+      map->mirrored ? ", mirrored" : "");
+}
+
+/*
+ * Whole groups are looked up at once. When they fill a byte (BPSK and
+ * QPSK) the packed stream is mapped byte by byte.
+ */
+void
+symbols_apply_map(
+    const struct symbol_map *map,
+    const symbols_t *self,
+    uint64_t *out)
+{
+  uint64_t total = self->count * self->bits;
+  size_t words = symbols_get_word_count(self);
+  unsigned int chunk = map->group * map->bits;
+  const uint8_t *in_bytes = (const uint8_t *) self->words;
+  uint8_t *out_bytes = (uint8_t *) out;
+  uint64_t pos;
+  size_t i;
+
+  if (chunk == 8) {
+    for (i = 0; i < __UNITS(total, 8); ++i)
+      out_bytes[i] = map->lut[in_bytes[i]];
+
+    memset(
+        out_bytes + i,
+        0,
+        words * CAPTURE_WORD_BYTES - i);
+  } else {
+    memset(out, 0, words * sizeof(uint64_t));
+
+    for (pos = 0; pos < total; pos += chunk)
+      symbols_put(out, pos, map->lut[symbols_get(self->words, pos, chunk)], chunk);
+  }
+
+  /* Padding symbols of the last group are not part of the stream */
+  if (total % CAPTURE_WORD_BITS != 0)
+    out[total / CAPTURE_WORD_BITS] &=
+        (1ull << (total % CAPTURE_WORD_BITS)) - 1;
+
+  memset(
+      out + __UNITS(total, CAPTURE_WORD_BITS),
+      0,
+      (words - __UNITS(total, CAPTURE_WORD_BITS)) * sizeof(uint64_t));
+}
+
+void
+symbols_destroy(symbols_t *self)
+{
+  if (self->words != NULL)
+    free(self->words);
+
+  free(self);
+}
+
+symbols_t *
+symbols_new(const char *path, unsigned int bits)
+{
+  symbols_t *new = NULL;
+  struct stat sbuf;
+  const uint8_t *map = NULL;
+  unsigned int order = 1 << bits;
+  unsigned int s;
+  BOOL text = TRUE;
+  int fd = -1;
+  int saved_errno;
+  size_t i;
+
+  ALLOCATE(new, symbols_t);
+
+  new->bits = bits;
+
+  TRY((fd = open(path, O_RDONLY)) != -1);
+  TRY(fstat(fd, &sbuf) != -1);
+
+  ALLOCATE_MANY(
+      new->words,
+      __UNITS((uint64_t) sbuf.st_size * bits, CAPTURE_WORD_BITS) + 1,
+      uint64_t);
+
+  if (sbuf.st_size > 0) {
+    TRY((map = mmap(
+        NULL,
+        sbuf.st_size,
+        PROT_READ,
+        MAP_PRIVATE,
+        fd,
+        0)) != MAP_FAILED);
+
+    madvise((void *) map, sbuf.st_size, MADV_SEQUENTIAL);
+
+    for (i = 0; i < sbuf.st_size && i < CAPTURE_DETECT_LEN && text; ++i)
+      text = isdigit(map[i]) || isspace(map[i]);
+
+    for (i = 0; i < sbuf.st_size; ++i) {
+      if (text && isspace(map[i]))
+        continue;
+
+      s = text ? map[i] - '0' : map[i];
+      if (s >= order) {
+        errno = EINVAL;
+        goto fail;
+      }
+
+      symbols_put(new->words, new->count++ * bits, s, bits);
+    }
+
+    munmap((void *) map, sbuf.st_size);
+    map = NULL;
+  }
+
+  close(fd);
+
+  return new;
+
+fail:
+  saved_errno = errno;
+
+  if (map != NULL && map != MAP_FAILED)
+    munmap((void *) map, sbuf.st_size);
+
+  if (fd != -1)
+    close(fd);
+
+  if (new != NULL)
+    symbols_destroy(new);
+
+  errno = saved_errno;
+
+  return NULL;
+}
@@ -0,0 +1,99 @@
+/*
+
+  symbols.h: Symbol-to-bit mappings of multi-bit-symbol captures
+  Copyright (C) 2016 Gonzalo José Carracedo Carballal
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program.  If not, see
+  <http://www.gnu.org/licenses/>
+
+*/
+
+#ifndef _SYMBOLS_H
+#define _SYMBOLS_H
+
+#include "capture.h"
+
+#define SYMBOLS_MAX_BITS  3  /* Up to 8PSK */
+#define SYMBOLS_MAX_ORDER (1 << SYMBOLS_MAX_BITS)
+#define SYMBOLS_MAX_MAPS  (SYMBOLS_MAX_ORDER * 8) /* Rotations x 2 x 2 x 2 */
+#define SYMBOLS_MAP_STRLEN 64
+
+/*
+ * How the constellation positions reported by a demodulator become bits.
+ * The demodulator may lock rotated or mirrored, labels may be Gray or
+ * natural binary, and their bits may go out MSB or LSB first. Every
+ * combination reduces to a table from position to label, bit j of the
+ * label being the j-th bit out.
+ *
+ * Symbols are looked up `group' at a time, as many as fit in a byte of
+ * the packed stream.
+ */
+struct symbol_map {
+  unsigned int bits;      /* Per symbol */
+  unsigned int rotation;  /* Positions added after mirroring */
+  BOOL mirrored;
+  BOOL gray;
+  BOOL lsb_first;
+  uint8_t label[SYMBOLS_MAX_ORDER];
+  unsigned int group;
+  uint8_t lut[256];
+};
+
+/*
+ * A capture of symbol indices. Symbol i takes bits i * bits to
+ * (i + 1) * bits - 1 of the packed words, least significant first, so
+ * that a mapped stream has the same layout as a bit capture.
+ */
+struct symbols {
+  unsigned int bits;
+  uint64_t *words; /* With one spare word */
+  uint64_t count;
+};
+
+typedef struct symbols symbols_t;
+
+/* "bpsk", "qpsk", "8psk", or a number of bits per symbol */
+BOOL symbols_parse_order(const char *name, unsigned int *bits);
+
+/*
+ * Fill `maps' (at least SYMBOLS_MAX_MAPS) with every distinct mapping of
+ * symbols of `bits' bits. Returns how many there are.
+ */
+unsigned int symbols_enumerate_maps(unsigned int bits, struct symbol_map *maps);
+
+void symbol_map_to_string(const struct symbol_map *map, char *buf, size_t size);
+
+/* Bits of the symbols under a map, packed in `out' (count * bits, plus one word) */
+void symbols_apply_map(
+    const struct symbol_map *map,
+    const symbols_t *self,
+    uint64_t *out);
+
+/* Size of the mapped stream, in words (including the spare one) */
+static inline size_t
+symbols_get_word_count(const symbols_t *self)
+{
+  return __UNITS(self->count * self->bits, CAPTURE_WORD_BITS) + 1;
+}
+
+void symbols_destroy(symbols_t *self);
+
+/*
+ * Load a capture of symbols: text with one digit per symbol (whitespace
+ * is ignored) or, if anything else shows up, one symbol per byte. On
+ * failure, errno tells why.
+ */
+symbols_t *symbols_new(const char *path, unsigned int bits);
+
+#endif /* _SYMBOLS_H */
@@ -0,0 +1,250 @@
+/*
+
+  syncword.c: Bit-level search of frame synchronization words
+  Copyright (C) 2016 Gonzalo José Carracedo Carballal
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program.  If not, see
+  <http://www.gnu.org/licenses/>
+
+*/
+
+#include <string.h>
+#include <ctype.h>
+
+#include "syncword.h"
+
+#ifdef __AVX2__
+#  include <immintrin.h>
+#endif /* __AVX2__ */
+
+struct syncword_state {
+  struct syncword_result *result;
+  uint64_t last;
+  uint64_t *gaps;
+  unsigned int gap_count;
+};
+
+BOOL
+syncword_parse(const char *spec, struct syncword *sw)
+{
+  const char *p = spec;
+  unsigned int digit, bits_per_digit = 1, i;
+  uint64_t msb_first = 0;
+  char *end;
+
+  memset(sw, 0, sizeof(struct syncword));
+
+  if (p[0] == '0' && (p[1] == 'x' || p[1] == 'X')) {
+    bits_per_digit = 4;
+    p += 2;
+  } else if (p[0] == '0' && (p[1] == 'b' || p[1] == 'B')) {
+    p += 2;
+  }
+
+  for (; *p != '\0' && *p != '/'; ++p) {
+    if (bits_per_digit == 4 && isxdigit(*p))
+      digit = isdigit(*p) ? *p - '0' : tolower(*p) - 'a' + 10;
+    else if (bits_per_digit == 1 && (*p == '0' || *p == '1'))
+      digit = *p - '0';
+    else
+      return FALSE;
+
+    if (sw->len + bits_per_digit > SYNCWORD_MAX_LEN)
+      return FALSE;
+
+    msb_first = (msb_first << bits_per_digit) | digit;
+    sw->len += bits_per_digit;
+  }
+
+  if (sw->len == 0)
+    return FALSE;
+
+  if (*p == '/') {
+    sw->max_errors = strtoul(p + 1, &end, 10);
+    if (end == p + 1 || *end != '\0' || sw->max_errors >= sw->len)
+      return FALSE;
+  }
+
+  /* First written bit goes first in the stream */
+  for (i = 0; i < sw->len; ++i)
+    sw->pattern |= ((msb_first >> (sw->len - 1 - i)) & 1) << i;
+
+  sw->mask = sw->len == 64 ? ~0ull : (1ull << sw->len) - 1;
+
+  return TRUE;
+}
+
+static void
+syncword_state_hit(struct syncword_state *state, uint64_t pos)
+{
+  if (state->result->hits++ == 0)
+    state->result->first = pos;
+  else if (state->gap_count < SYNCWORD_MAX_GAPS)
+    state->gaps[state->gap_count++] = pos - state->last;
+
+  state->last = pos;
+}
+
+static int
+syncword_gap_cmp(const void *a, const void *b)
+{
+  uint64_t ga = *(const uint64_t *) a;
+  uint64_t gb = *(const uint64_t *) b;
+
+  return ga < gb ? -1 : ga > gb;
+}
+
+static void
+syncword_state_finish(struct syncword_state *state)
+{
+  struct syncword_result *result = state->result;
+  unsigned int i, run = 0;
+
+  if (state->gap_count == 0)
+    return;
+
+  qsort(state->gaps, state->gap_count, sizeof(uint64_t), syncword_gap_cmp);
+
+  /* Most frequent gap, the shortest one on ties */
+  for (i = 0; i < state->gap_count; ++i) {
+    run = i > 0 && state->gaps[i] == state->gaps[i - 1] ? run + 1 : 1;
+    if (run > result->period_hits) {
+      result->period = state->gaps[i];
+      result->period_hits = run;
+    }
+  }
+
+  result->locked = 2 * result->period_hits >= state->gap_count;
+}
+
+#ifdef __AVX2__
+static inline __m256i
+syncword_popcount_epi64(__m256i v)
+{
+  const __m256i lut = _mm256_setr_epi8(
+      0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+      0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+  const __m256i low = _mm256_set1_epi8(0x0f);
+
+  return _mm256_sad_epu8(
+      _mm256_add_epi8(
+          _mm256_shuffle_epi8(lut, _mm256_and_si256(v, low)),
+          _mm256_shuffle_epi8(
+              lut,
+              _mm256_and_si256(_mm256_srli_epi16(v, 4), low))),
+      _mm256_setzero_si256());
+}
+#endif /* __AVX2__ */
+
+/*
+ * Every bit position is tried: the 64-bit window starting at each of
+ * them is built with a funnel shift of two consecutive words, four
+ * shifts at a time with AVX2, and compared against every pattern.
+ */
+BOOL
+syncword_scan(
+    const struct syncword *patterns,
+    unsigned int count,
+    const uint64_t *words,
+    uint64_t bits,
+    struct syncword_result *results)
+{
+  struct syncword_state *states = NULL;
+  size_t word_count = __UNITS(bits, CAPTURE_WORD_BITS);
+  uint64_t lo, hi, pos;
+  unsigned int i, s;
+  size_t j;
+  BOOL ok = FALSE;
+#ifdef __AVX2__
+  const __m256i sixty_four = _mm256_set1_epi64x(64);
+  __m256i shifts, vwin, diff;
+  unsigned int k, matches;
+#else
+  uint64_t window;
+#endif /* __AVX2__ */
+
+  ALLOCATE_MANY(states, count, struct syncword_state);
+
+  for (i = 0; i < count; ++i) {
+    memset(results + i, 0, sizeof(struct syncword_result));
+    states[i].result = results + i;
+    ALLOCATE_MANY(states[i].gaps, SYNCWORD_MAX_GAPS, uint64_t);
+  }
+
+  for (j = 0; j < word_count; ++j) {
+    lo = words[j];
+    hi = j + 1 < word_count ? words[j + 1] : 0;
+
+#ifdef __AVX2__
+    for (s = 0; s < CAPTURE_WORD_BITS; s += 4) {
+      shifts = _mm256_setr_epi64x(s, s + 1, s + 2, s + 3);
+
+      /* A shift by 64 yields zero, which is what s = 0 needs */
+      vwin = _mm256_or_si256(
+          _mm256_srlv_epi64(_mm256_set1_epi64x(lo), shifts),
+          _mm256_sllv_epi64(
+              _mm256_set1_epi64x(hi),
+              _mm256_sub_epi64(sixty_four, shifts)));
+
+      for (i = 0; i < count; ++i) {
+        diff = _mm256_and_si256(
+            _mm256_xor_si256(vwin, _mm256_set1_epi64x(patterns[i].pattern)),
+            _mm256_set1_epi64x(patterns[i].mask));
+
+        if (patterns[i].max_errors == 0)
+          diff = _mm256_cmpeq_epi64(diff, _mm256_setzero_si256());
+        else
+          diff = _mm256_cmpgt_epi64(
+              _mm256_set1_epi64x(patterns[i].max_errors + 1),
+              syncword_popcount_epi64(diff));
+
+        matches = _mm256_movemask_pd(_mm256_castsi256_pd(diff));
+
+        for (k = 0; matches != 0; ++k, matches >>= 1) {
+          pos = j * CAPTURE_WORD_BITS + s + k;
+          if ((matches & 1) && pos + patterns[i].len <= bits)
+            syncword_state_hit(states + i, pos);
+        }
+      }
+    }
+#else
+    for (s = 0; s < CAPTURE_WORD_BITS; ++s) {
+      window = s == 0 ? lo : (lo >> s) | (hi << (CAPTURE_WORD_BITS - s));
+      pos = j * CAPTURE_WORD_BITS + s;
+
+      for (i = 0; i < count; ++i)
+        if (popcount64((window ^ patterns[i].pattern) & patterns[i].mask)
+            <= patterns[i].max_errors
+            && pos + patterns[i].len <= bits)
+          syncword_state_hit(states + i, pos);
+    }
+#endif /* __AVX2__ */
+  }
+
+  for (i = 0; i < count; ++i)
+    syncword_state_finish(states + i);
+
+  ok = TRUE;
+
+fail:
+  if (states != NULL) {
+    for (i = 0; i < count; ++i)
+      if (states[i].gaps != NULL)
+        free(states[i].gaps);
+
+    free(states);
+  }
+
+  return ok;
+}
@@ -0,0 +1,70 @@
+/*
+
+  syncword.h: Bit-level search of frame synchronization words
+  Copyright (C) 2016 Gonzalo José Carracedo Carballal
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program.  If not, see
+  <http://www.gnu.org/licenses/>
+
+*/
+
+#ifndef _SYNCWORD_H
+#define _SYNCWORD_H
+
+#include "capture.h"
+
+#define SYNCWORD_MAX_LEN  64
+#define SYNCWORD_MAX_GAPS 4096 /* Hit distances kept to find the period */
+
+/*
+ * A pattern of up to 64 bits, in stream order: bit k of `pattern' is
+ * the k-th bit of the sync word. Windows within `max_errors' bits of it
+ * are hits.
+ */
+struct syncword {
+  uint64_t pattern;
+  uint64_t mask;
+  unsigned int len;
+  unsigned int max_errors;
+};
+
+/*
+ * Hits of a pattern and the distance between consecutive hits seen the
+ * most. A pattern is locked when that distance accounts for at least
+ * half of them, which random matches of short patterns never do.
+ */
+struct syncword_result {
+  uint64_t hits;
+  uint64_t first;       /* Bit position of the first hit */
+  uint64_t period;      /* 0 if fewer than two hits */
+  uint64_t period_hits; /* Gaps equal to `period' */
+  BOOL locked;
+};
+
+/*
+ * Patterns are written MSB first, either in hex ("0x1ACFFC1D") or in
+ * binary ("0b01111110", or just the bits), optionally followed by
+ * "/ERRORS" to tolerate that many bit errors.
+ */
+BOOL syncword_parse(const char *spec, struct syncword *sw);
+
+/* Search `count' patterns in `bits' packed bits */
+BOOL syncword_scan(
+    const struct syncword *patterns,
+    unsigned int count,
+    const uint64_t *words,
+    uint64_t bits,
+    struct syncword_result *results);
+
+#endif /* _SYNCWORD_H */
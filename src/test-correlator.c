@@ -0,0 +1,220 @@
+/*
+
+  test-correlator.c: regression tests of the correlator
+  Copyright (C) 2016 Gonzalo José Carracedo Carballal
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program.  If not, see
+  <http://www.gnu.org/licenses/>
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "correlator.h"
+
+#define TEST_N      65536
+#define TEST_PHASE  20000 /* Well past the default 4096-bit coarse stage */
+
+/* Last candidate registered: the best one */
+static BOOL
+on_candidate(const struct correlator_candidate *candidate, void *private)
+{
+  *(const struct correlator_candidate **) private = candidate;
+
+  return TRUE;
+}
+
+/*
+ * A degree 15 keystream at a phase beyond the coarse stage length, under
+ * 15% plaintext ones, must survive the coarse stage and be found at its
+ * phase by the full-length one.
+ */
+static BOOL
+test_phase_beyond_stage(void)
+{
+  static const unsigned int decoy[] = {15, 1, 0};
+  static const unsigned int taps[] = {15, 7, 2, 1, 0};
+  struct correlator_params params = correlator_params_INITIALIZER;
+  const struct correlator_candidate *best = NULL;
+  lfsrdesc_db_t *db = NULL;
+  lfsrdesc_t *desc = NULL, *truth;
+  correlator_t *corr = NULL;
+  uint8_t *keystream = NULL;
+  uint8_t *data = NULL;
+  uint32_t state = 1;
+  unsigned int i;
+  BOOL ok = FALSE;
+
+  TRY(db = lfsrdesc_db_new());
+
+  CONSTRUCT(desc, lfsrdesc, decoy, sizeof(decoy) / sizeof(decoy[0]));
+  desc->index = db->desc_count;
+  TRY(PTR_LIST_APPEND_CHECK(db->desc, desc) != -1);
+  desc = NULL;
+
+  CONSTRUCT(desc, lfsrdesc, taps, sizeof(taps) / sizeof(taps[0]));
+  desc->index = db->desc_count;
+  TRY(PTR_LIST_APPEND_CHECK(db->desc, desc) != -1);
+  truth = desc;
+  desc = NULL;
+
+  TRY(keystream = lfsrdesc_generate(truth, TEST_PHASE + TEST_N));
+  ALLOCATE_MANY(data, TEST_N, uint8_t);
+
+  for (i = 0; i < TEST_N; ++i) {
+    state = state * 1103515245 + 12345;
+    data[i] = keystream[TEST_PHASE + i] ^ ((state >> 16) % 100 < 15);
+  }
+
+  params.db = db;
+  params.period_filter = FALSE;
+  params.exit_sigma = 0;
+
+  TRY(corr = correlator_new(&params, data, TEST_N));
+  TRY(correlator_run(corr));
+  TRY(correlator_walk_candidates(corr, on_candidate, &best));
+
+  if (best == NULL || best->desc != truth) {
+    fprintf(stderr, "%s: polynomial pruned or missed\n", __FUNCTION__);
+    goto fail;
+  }
+
+  if (best->phase != TEST_PHASE) {
+    fprintf(
+        stderr,
+        "%s: phase %lu, expected %u\n",
+        __FUNCTION__,
+        (unsigned long) best->phase,
+        TEST_PHASE);
+    goto fail;
+  }
+
+  ok = TRUE;
+
+fail:
+  if (corr != NULL)
+    correlator_destroy(corr);
+
+  if (data != NULL)
+    free(data);
+
+  if (keystream != NULL)
+    free(keystream);
+
+  if (desc != NULL)
+    lfsrdesc_destroy(desc);
+
+  if (db != NULL)
+    lfsrdesc_db_destroy(db);
+
+  return ok;
+}
+
+/*
+ * A degree 17 keystream (period beyond N / 2) on three bits out of four,
+ * a degree 5 one on the rest. The period of the latter stands out and
+ * activates the period filter, which must still sweep the former.
+ */
+static BOOL
+test_unobservable_period(void)
+{
+  static const unsigned int decoy[] = {5, 2, 0};
+  static const unsigned int taps[] = {17, 3, 0};
+  struct correlator_params params = correlator_params_INITIALIZER;
+  const struct correlator_candidate *best = NULL;
+  lfsrdesc_db_t *db = NULL;
+  lfsrdesc_t *desc = NULL, *truth, *short_desc;
+  correlator_t *corr = NULL;
+  uint8_t *keystream = NULL;
+  uint8_t *short_keystream = NULL;
+  uint8_t *data = NULL;
+  unsigned int i;
+  BOOL ok = FALSE;
+
+  TRY(db = lfsrdesc_db_new());
+
+  CONSTRUCT(desc, lfsrdesc, decoy, sizeof(decoy) / sizeof(decoy[0]));
+  desc->index = db->desc_count;
+  TRY(PTR_LIST_APPEND_CHECK(db->desc, desc) != -1);
+  short_desc = desc;
+  desc = NULL;
+
+  CONSTRUCT(desc, lfsrdesc, taps, sizeof(taps) / sizeof(taps[0]));
+  desc->index = db->desc_count;
+  TRY(PTR_LIST_APPEND_CHECK(db->desc, desc) != -1);
+  truth = desc;
+  desc = NULL;
+
+  TRY(keystream = lfsrdesc_generate(truth, TEST_PHASE + TEST_N));
+  TRY(short_keystream = lfsrdesc_generate(short_desc, TEST_N));
+  ALLOCATE_MANY(data, TEST_N, uint8_t);
+
+  for (i = 0; i < TEST_N; ++i)
+    data[i] = i % 4 == 1 ? short_keystream[i] : keystream[TEST_PHASE + i];
+
+  params.db = db;
+  params.exit_sigma = 0;
+
+  TRY(corr = correlator_new(&params, data, TEST_N));
+
+  if (correlator_get_period_sigma(corr) <= CORRELATOR_PERIOD_SIGMA) {
+    fprintf(stderr, "%s: period filter not active\n", __FUNCTION__);
+    goto fail;
+  }
+
+  TRY(correlator_run(corr));
+  TRY(correlator_walk_candidates(corr, on_candidate, &best));
+
+  if (best == NULL || best->desc != truth) {
+    fprintf(stderr, "%s: unobservable period filtered out\n", __FUNCTION__);
+    goto fail;
+  }
+
+  ok = TRUE;
+
+fail:
+  if (corr != NULL)
+    correlator_destroy(corr);
+
+  if (data != NULL)
+    free(data);
+
+  if (short_keystream != NULL)
+    free(short_keystream);
+
+  if (keystream != NULL)
+    free(keystream);
+
+  if (desc != NULL)
+    lfsrdesc_destroy(desc);
+
+  if (db != NULL)
+    lfsrdesc_db_destroy(db);
+
+  return ok;
+}
+
+int
+main(int argc, char *argv[])
+{
+  if (!test_phase_beyond_stage())
+    return EXIT_FAILURE;
+
+  if (!test_unobservable_period())
+    return EXIT_FAILURE;
+
+  return EXIT_SUCCESS;
+}
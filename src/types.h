@@ -22,7 +22,7 @@
 #ifndef _TYPES_H
 #define _TYPES_H
 
-#include <util.h>
+#include "util.h"
 #include <stdint.h>
 
 #ifndef _RELEASE
@@ -56,20 +56,20 @@
     TRY_EXCEPT(                              \
         dest = fftwf_alloc_complex(n),         \
         _DEBUG(                                \
-            "%s:%d: failed to allocate FFT array of %d elements\n", \
+            "%s:%d: failed to allocate FFT array of %zu elements\n", \
             __FILE__,                           \
             __LINE__,                           \
-            n))
+            (size_t) (n)))
 
 
 #define ALLOCATE_MANY(dest, n, type)         \
     TRY_EXCEPT(                              \
         dest = calloc(n, sizeof(type)),         \
         _DEBUG(                                \
-            "%s:%d: failed to allocate %d objects of type %s\n", \
+            "%s:%d: failed to allocate %zu objects of type %s\n", \
             __FILE__,                           \
             __LINE__,                           \
-            n,                                  \
+            (size_t) (n),                       \
             STRINGIFY(type)                     \
             ))
 
@@ -0,0 +1,169 @@
+/*
+
+  workpool.c: Work-stealing thread pool
+  Copyright (C) 2016 Gonzalo José Carracedo Carballal
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program.  If not, see
+  <http://www.gnu.org/licenses/>
+
+*/
+
+#include "workpool.h"
+
+static BOOL
+workpool_pop(struct workpool_range *range, unsigned int *task)
+{
+  BOOL ok = FALSE;
+
+  pthread_mutex_lock(&range->lock);
+
+  if (range->head < range->tail) {
+    *task = range->head++;
+    ok = TRUE;
+  }
+
+  pthread_mutex_unlock(&range->lock);
+
+  return ok;
+}
+
+static BOOL
+workpool_steal(struct workpool *self, unsigned int thief, unsigned int *task)
+{
+  struct workpool_range *range;
+  unsigned int i, victim, left, max_left;
+  BOOL ok = FALSE;
+
+  /* The fullest range may be drained before we lock it again: retry */
+  do {
+    max_left = 0;
+    victim = thief;
+
+    for (i = 0; i < self->threads; ++i) {
+      if (i == thief)
+        continue;
+
+      pthread_mutex_lock(&self->ranges[i].lock);
+      left = self->ranges[i].tail - self->ranges[i].head;
+      pthread_mutex_unlock(&self->ranges[i].lock);
+
+      if (left > max_left) {
+        max_left = left;
+        victim = i;
+      }
+    }
+
+    if (victim == thief)
+      return FALSE;
+
+    range = self->ranges + victim;
+
+    pthread_mutex_lock(&range->lock);
+
+    if (range->head < range->tail) {
+      *task = --range->tail;
+      ok = TRUE;
+    }
+
+    pthread_mutex_unlock(&range->lock);
+  } while (!ok);
+
+  return TRUE;
+}
+
+static void *
+workpool_worker_func(void *data)
+{
+  struct workpool_worker *worker = (struct workpool_worker *) data;
+  struct workpool *self = worker->pool;
+  unsigned int task;
+
+  while (workpool_pop(self->ranges + worker->index, &task)
+      || workpool_steal(self, worker->index, &task))
+    if ((self->task) (task, worker->index, self->private))
+      ++worker->succeeded;
+
+  return NULL;
+}
+
+int
+workpool_run(
+    unsigned int threads,
+    unsigned int count,
+    BOOL (*task) (unsigned int task, unsigned int worker, void *private),
+    void *private)
+{
+  struct workpool pool;
+  unsigned int i, started = 0;
+  int succeeded = -1;
+
+  if (threads > count)
+    threads = count;
+
+  /* Nothing to share: run everything here */
+  if (threads <= 1) {
+    for (i = succeeded = 0; i < count; ++i)
+      if ((task) (i, 0, private))
+        ++succeeded;
+
+    return succeeded;
+  }
+
+  pool.threads = threads;
+  pool.task = task;
+  pool.private = private;
+  pool.ranges = NULL;
+  pool.workers = NULL;
+
+  ALLOCATE_MANY(pool.ranges, threads, struct workpool_range);
+  ALLOCATE_MANY(pool.workers, threads, struct workpool_worker);
+
+  for (i = 0; i < threads; ++i) {
+    pthread_mutex_init(&pool.ranges[i].lock, NULL);
+    pool.ranges[i].head = (uint64_t) count * i / threads;
+    pool.ranges[i].tail = (uint64_t) count * (i + 1) / threads;
+
+    pool.workers[i].pool = &pool;
+    pool.workers[i].index = i;
+  }
+
+  for (started = 0; started < threads; ++started)
+    if (pthread_create(
+        &pool.workers[started].thread,
+        NULL,
+        workpool_worker_func,
+        pool.workers + started) != 0)
+      break;
+
+  /* Workers that did start steal the ranges of those that did not */
+  if (started > 0)
+    succeeded = 0;
+
+  for (i = 0; i < started; ++i) {
+    pthread_join(pool.workers[i].thread, NULL);
+    succeeded += pool.workers[i].succeeded;
+  }
+
+  for (i = 0; i < threads; ++i)
+    pthread_mutex_destroy(&pool.ranges[i].lock);
+
+fail:
+  if (pool.ranges != NULL)
+    free(pool.ranges);
+
+  if (pool.workers != NULL)
+    free(pool.workers);
+
+  return succeeded;
+}
@@ -0,0 +1,69 @@
+/*
+
+  workpool.h: Work-stealing thread pool
+  Copyright (C) 2016 Gonzalo José Carracedo Carballal
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program.  If not, see
+  <http://www.gnu.org/licenses/>
+
+*/
+
+#ifndef _WORKPOOL_H
+#define _WORKPOOL_H
+
+#include <pthread.h>
+
+#include "types.h"
+
+/*
+ * Tasks are numbered 0..count-1. Each worker starts with a contiguous
+ * range of them, takes tasks from the front of its own range and, once
+ * it runs dry, steals from the back of the fullest one. A single long
+ * task thus only delays the tasks queued behind it until someone steals
+ * them.
+ */
+struct workpool_range {
+  pthread_mutex_t lock;
+  unsigned int head; /* Next task to run */
+  unsigned int tail; /* One past the last task */
+};
+
+struct workpool_worker {
+  struct workpool *pool;
+  unsigned int index;
+  pthread_t thread;
+  unsigned int succeeded;
+};
+
+struct workpool {
+  unsigned int threads;
+  struct workpool_range *ranges;
+  struct workpool_worker *workers;
+
+  BOOL (*task) (unsigned int task, unsigned int worker, void *private);
+  void *private;
+};
+
+/*
+ * Run `count' tasks in at most `threads' threads. `worker' tells which
+ * thread runs each task, so callers can keep per-thread state. Returns
+ * the number of tasks that succeeded, or -1 if the pool failed to start.
+ */
+int workpool_run(
+    unsigned int threads,
+    unsigned int count,
+    BOOL (*task) (unsigned int task, unsigned int worker, void *private),
+    void *private);
+
+#endif /* _WORKPOOL_H */
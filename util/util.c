@@ -262,6 +262,170 @@ ptr_list_remove_all (void ***list, int *count, void *ptr)
 }
 
 
+static inline int *
+ptr_list_holes (void **list, const struct ptr_list_state *state)
+{
+  return (int *) (list + state->capacity);
+}
+
+/*
+ * Lists that were freed, reset or filled outside these functions may
+ * carry a stale state. Such a block only has room for its `count'
+ * slots: no free slot stack is kept until ptr_list_grow sizes it.
+ */
+static void
+ptr_list_check_state (void **list, int count, struct ptr_list_state *state)
+{
+  if (list == NULL)
+  {
+    state->capacity = 0;
+    state->holes = 0;
+  }
+  else if (state->capacity < count)
+  {
+    state->capacity = count;
+    state->holes = PTR_LIST_NO_HOLES;
+  }
+}
+
+static int
+ptr_list_grow (void ***list, int count, struct ptr_list_state *state)
+{
+  void **reallocd_list;
+  int capacity;
+
+  capacity = state->capacity < PTR_LIST_MIN_CAPACITY ?
+    PTR_LIST_MIN_CAPACITY : 2 * state->capacity;
+
+  if (capacity <= count)
+    capacity = 2 * count;
+
+  if ((reallocd_list = xrealloc (
+    *list,
+    capacity * (sizeof (void *) + sizeof (int)))) == NULL)
+    return -1;
+
+  /* The free slot stack follows the slots, move it past the new ones */
+  if (state->holes > 0)
+    memmove (
+      reallocd_list + capacity,
+      reallocd_list + state->capacity,
+      state->holes * sizeof (int));
+
+  *list = reallocd_list;
+  state->capacity = capacity;
+
+  if (state->holes == PTR_LIST_NO_HOLES)
+    state->holes = 0;
+
+  return 0;
+}
+
+int
+ptr_list_append_check_state (
+  void ***list,
+  int *count,
+  struct ptr_list_state *state,
+  void *new)
+{
+  int *holes;
+  int i;
+
+  ptr_list_check_state (*list, *count, state);
+
+  /* Entries may be stale if the slot was refilled by hand */
+  holes = ptr_list_holes (*list, state);
+  while (state->holes > 0)
+  {
+    i = holes[--state->holes];
+    if (i < *count && (*list)[i] == NULL)
+    {
+      (*list)[i] = new;
+      return i;
+    }
+  }
+
+  if (*count == state->capacity)
+    if (ptr_list_grow (list, *count, state) == -1)
+      return -1;
+
+  i = (*count)++;
+  (*list)[i] = new;
+
+  return i;
+}
+
+void
+ptr_list_append_state (
+  void ***list,
+  int *count,
+  struct ptr_list_state *state,
+  void *new)
+{
+  (void) ptr_list_append_check_state (list, count, state, new);
+}
+
+static void
+ptr_list_push_hole (void **list, struct ptr_list_state *state, int i)
+{
+  /* When full or not sized for it, the slot is simply not reused */
+  if (state->holes != PTR_LIST_NO_HOLES && state->holes < state->capacity)
+    ptr_list_holes (list, state)[state->holes++] = i;
+}
+
+int
+ptr_list_remove_first_state (
+  void ***list,
+  int *count,
+  struct ptr_list_state *state,
+  void *ptr)
+{
+  int i;
+
+  ptr_list_check_state (*list, *count, state);
+
+  for (i = 0; i < *count; i++)
+    if ((*list)[i] == ptr || ptr == NULL)
+    {
+      if ((*list)[i] != NULL)
+        ptr_list_push_hole (*list, state, i);
+
+      (*list)[i] = NULL;
+
+      return 1;
+    }
+
+  return 0;
+}
+
+int
+ptr_list_remove_all_state (
+  void ***list,
+  int *count,
+  struct ptr_list_state *state,
+  void *ptr)
+{
+  int i;
+  int found;
+
+  found = 0;
+
+  ptr_list_check_state (*list, *count, state);
+
+  for (i = 0; i < *count; i++)
+    if ((*list)[i] == ptr || ptr == NULL)
+    {
+      if ((*list)[i] != NULL)
+        ptr_list_push_hole (*list, state, i);
+
+      (*list)[i] = NULL;
+      found++;
+    }
+
+  return found;
+}
+
+
 char *
 str_append_char (char* source, char c)
 {
@@ -348,7 +512,8 @@ strlist_new (void)
 void
 strlist_append_string (struct strlist *list, const char *string)
 {
-  ptr_list_append ((void ***) &list->strings_list, &list->strings_count,
+  ptr_list_append_state ((void ***) &list->strings_list, &list->strings_count,
+    &list->strings_state,
     xstrdup (string));
 }
 
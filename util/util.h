@@ -102,33 +102,54 @@
 #define debug DEBUG
 #define error ERROR
 
+/*
+ * Pointer lists grow geometrically. Slots freed by PTR_LIST_REMOVE are
+ * remembered in a stack stored right after the last allocated slot, in
+ * the same block, so freeing name ## _list still releases everything.
+ */
+struct ptr_list_state
+{
+  int capacity; /* Slots allocated */
+  int holes;    /* Entries in the free slot stack, or PTR_LIST_NO_HOLES */
+};
+
+/* The block was not allocated here and has no room for the stack */
+#define PTR_LIST_NO_HOLES -1
+
+#define PTR_LIST_MIN_CAPACITY 8
+
 #define PTR_LIST(type, name)                         \
   type ** name ## _list;                             \
-  int     name ## _count;
+  int     name ## _count;                            \
+  struct ptr_list_state name ## _state;
 
 #define PTR_LIST_LOCAL(type, name)                   \
   type ** name ## _list = NULL;                      \
-  int     name ## _count = 0;
+  int     name ## _count = 0;                        \
+  struct ptr_list_state name ## _state = {0, 0};
 
 #define PTR_LIST_EXTERN(type, name)                  \
   extern type ** name ## _list;                      \
-  extern int     name ## _count;
+  extern int     name ## _count;                     \
+  extern struct ptr_list_state name ## _state;
 
 #define PTR_LIST_INIT(where, name)                   \
   where->name ## _list = NULL;                       \
-  where->name ## _count = 0;                 
+  where->name ## _count = 0;                         \
+  where->name ## _state.capacity = 0;                \
+  where->name ## _state.holes = 0;
 
 #define PTR_LIST_APPEND(name, ptr)                   \
-  ptr_list_append ((void ***) &JOIN (name, _list),   \
-                   &JOIN (name, _count), ptr)
+  ptr_list_append_state ((void ***) &JOIN (name, _list),   \
+                   &JOIN (name, _count), &JOIN (name, _state), ptr)
 
 #define PTR_LIST_APPEND_CHECK(name, ptr)                   \
-  ptr_list_append_check ((void ***) &JOIN (name, _list),   \
-                   &JOIN (name, _count), ptr)
+  ptr_list_append_check_state ((void ***) &JOIN (name, _list),   \
+                   &JOIN (name, _count), &JOIN (name, _state), ptr)
 
 #define PTR_LIST_REMOVE(name, ptr)  \
-  ptr_list_remove_first ((void ***) &JOIN (name, _list),   \
-                   &JOIN (name, _count), ptr)
+  ptr_list_remove_first_state ((void ***) &JOIN (name, _list),   \
+                   &JOIN (name, _count), &JOIN (name, _state), ptr)
 
 #define FOR_EACH_PTR(this, where, name)              \
   int JOIN (_idx_, __LINE__);                             \
@@ -174,6 +195,10 @@ void ptr_list_append (void ***, int *, void *);
 int  ptr_list_append_check (void ***, int *, void *);
 int  ptr_list_remove_first (void ***, int *, void *);
 int  ptr_list_remove_all (void ***, int *, void *);
+void ptr_list_append_state (void ***, int *, struct ptr_list_state *, void *);
+int  ptr_list_append_check_state (void ***, int *, struct ptr_list_state *, void *);
+int  ptr_list_remove_first_state (void ***, int *, struct ptr_list_state *, void *);
+int  ptr_list_remove_all_state (void ***, int *, struct ptr_list_state *, void *);
 
 void errno_save (void);
 void errno_restore (void);